@@ -0,0 +1,196 @@
+// gemm_service_bench is a load generator for gemm_server: `clients` threads, each with its own connection,
+// keep `inflight` multiplications of size x size matrices queued and measure the round-trip latency.
+//
+//   ./gemm_server --socket /tmp/gemm_service.sock &
+//   ./gemm_service_bench --clients 8 --requests 500 --size 128 --inflight 2
+
+#include "gemm.h"          // generalMatMulTrival
+#include "gemm_service.h" // GemmClient
+
+#include <algorithm> // sort, min, max
+#include <chrono>    // steady_clock
+#include <cmath>     // fabs
+#include <cstdio>    // printf, fprintf
+#include <cstdlib>   // atoi
+#include <map>       // map
+#include <random>    // mt19937
+#include <stdexcept> // runtime_error
+#include <string>    // string
+#include <thread>    // thread
+#include <vector>    // vector
+
+struct Options
+{
+    std::string socket = "/tmp/gemm_service.sock";
+    int clients = 4;
+    int requests = 200; // per client
+    int size = 128;     // M = N = K
+    int inflight = 1;   // requests queued per client
+};
+
+typedef std::chrono::steady_clock Clock;
+
+// Slot holds the operands of one request in flight: A, B and C back to back in one shared region
+struct Slot
+{
+    gemm::service::SharedRegion region;
+    gemm::service::Operand A, B, C;
+};
+
+// runClient sends opt.requests multiplications and appends their latencies in microseconds,
+// the first result of every slot is checked against generalMatMulTrival
+void runClient(const Options &opt, const int seed, std::vector<double> &latencies, int &errors)
+{
+    const int n = opt.size;
+    const uint64_t matrixBytes = (uint64_t)n * n * sizeof(float);
+
+    gemm::service::GemmClient client(opt.socket);
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    std::vector<Slot> slots(opt.inflight);
+    for (Slot &slot : slots)
+    {
+        slot.region = client.Allocate(3 * matrixBytes);
+        slot.A = {slot.region.handle, 0};
+        slot.B = {slot.region.handle, matrixBytes};
+        slot.C = {slot.region.handle, 2 * matrixBytes};
+        for (long long i = 0; i < 2LL * n * n; i++)
+        {
+            slot.region.Floats()[i] = dist(rng);
+        }
+    }
+
+    std::vector<float> expected((size_t)n * n);
+    std::map<uint64_t, std::pair<int, Clock::time_point>> pending; // id -> slot, submit time
+    std::vector<bool> checked(opt.inflight, false);
+
+    int submitted = 0;
+    for (int s = 0; s < opt.inflight && submitted < opt.requests; s++, submitted++)
+    {
+        pending[client.Submit(slots[s].A, slots[s].B, slots[s].C, n, n, n)] = {s, Clock::now()};
+    }
+
+    while (!pending.empty())
+    {
+        const gemm::service::Response response = client.Receive();
+        const Clock::time_point now = Clock::now();
+        auto it = pending.find(response.id);
+        if (it == pending.end())
+        {
+            throw std::runtime_error("unexpected response");
+        }
+        const int s = it->second.first;
+        latencies.push_back(std::chrono::duration<double, std::micro>(now - it->second.second).count());
+        pending.erase(it);
+
+        if (response.status != gemm::service::StatusOk)
+        {
+            errors++;
+        }
+        else if (!checked[s])
+        {
+            checked[s] = true;
+            const Slot &slot = slots[s];
+            gemm::generalMatMulTrival(slot.region.Floats(slot.A.offset), slot.region.Floats(slot.B.offset), expected.data(), n, n, n);
+            for (long long i = 0; i < (long long)n * n; i++)
+            {
+                if (std::fabs(expected[i] - slot.region.Floats(slot.C.offset)[i]) > 1e-3f * n)
+                {
+                    errors++;
+                    break;
+                }
+            }
+        }
+
+        if (submitted < opt.requests)
+        {
+            pending[client.Submit(slots[s].A, slots[s].B, slots[s].C, n, n, n)] = {s, Clock::now()};
+            submitted++;
+        }
+    }
+}
+
+double percentile(const std::vector<double> &sorted, const double p)
+{
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+
+        if (key == "--socket")
+            opt.socket = value;
+        else if (key == "--clients")
+            opt.clients = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--requests")
+            opt.requests = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--size")
+            opt.size = std::max(gemm::service::MulBlock, std::atoi(value.c_str()) / gemm::service::MulBlock * gemm::service::MulBlock);
+        else if (key == "--inflight")
+            opt.inflight = std::max(1, std::atoi(value.c_str()));
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    std::vector<std::vector<double>> latencies(opt.clients);
+    std::vector<int> errors(opt.clients, 0);
+    std::vector<std::string> failures(opt.clients);
+
+    const Clock::time_point start = Clock::now();
+    std::vector<std::thread> threads;
+    for (int c = 0; c < opt.clients; c++)
+    {
+        threads.emplace_back([&, c] {
+            try
+            {
+                runClient(opt, c + 1, latencies[c], errors[c]);
+            }
+            catch (const std::runtime_error &e)
+            {
+                failures[c] = e.what();
+            }
+        });
+    }
+    for (std::thread &t : threads)
+    {
+        t.join();
+    }
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    std::vector<double> all;
+    int errorCount = 0;
+    for (int c = 0; c < opt.clients; c++)
+    {
+        if (!failures[c].empty())
+        {
+            std::fprintf(stderr, "client %d: %s\n", c, failures[c].c_str());
+            return 1;
+        }
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        errorCount += errors[c];
+    }
+    std::sort(all.begin(), all.end());
+
+    const double flops = 2.0 * opt.size * opt.size * opt.size * all.size();
+    std::printf("clients %d, size %d, inflight %d: %zu requests in %.3f s, %.0f req/s, %.2f GFLOP/s, %d errors\n",
+                opt.clients, opt.size, opt.inflight, all.size(), seconds, all.size() / seconds, flops / seconds * 1e-9, errorCount);
+    std::printf("round trip p50 %.1f us p90 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us\n",
+                percentile(all, 0.50), percentile(all, 0.90), percentile(all, 0.99), percentile(all, 0.999), all.back());
+
+    gemm::service::GemmClient client(opt.socket);
+    const gemm::service::Stats stats = client.GetStats();
+    std::printf("server: %llu requests in %llu batches (%.1f per batch), latency p50 %.1f us p99 %.1f us, %.2f GFLOP/s busy\n",
+                (unsigned long long)stats.requests, (unsigned long long)stats.batches,
+                stats.batches > 0 ? (double)stats.requests / stats.batches : 0.0, stats.p50Us, stats.p99Us, stats.gflops);
+
+    return errorCount == 0 ? 0 : 1;
+}
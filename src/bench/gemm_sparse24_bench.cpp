@@ -0,0 +1,89 @@
+// gemm_sparse24_bench compares generalMatMul24 on a 2:4 pruned matrix with generalMatMulOpt
+// on the same matrix stored densely, and checks that the results agree.
+//
+//   ./gemm_sparse24_bench --M 2048 --N 2048 --K 2048 --reps 3
+
+#include "gemm.h"          // generalMatMulOpt
+#include "gemm_sparse24.h" // compress24, generalMatMul24
+#include "gemm_thread.h"   // numThreads
+#include "gemm_utils.h"    // allocMatrix, randomFillMatrix
+
+#include <algorithm>  // max, min
+#include <chrono>     // steady_clock
+#include <cmath>      // fabs
+#include <cstdio>     // printf, fprintf
+#include <cstdlib>    // atoi
+#include <functional> // function
+#include <string>     // string
+
+// bestSeconds returns the fastest of `reps` runs
+double bestSeconds(const int reps, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < reps; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    int M = 2048, N = 2048, K = 2048, reps = 3;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        int value = std::atoi(argv[i + 1]);
+
+        // generalMatMulOpt needs multiples of 64
+        if (key == "--M")
+            M = std::max(64, value / 64 * 64);
+        else if (key == "--N")
+            N = std::max(64, value / 64 * 64);
+        else if (key == "--K")
+            K = std::max(64, value / 64 * 64);
+        else if (key == "--reps")
+            reps = std::max(1, value);
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    float *A = gemm::utils::allocMatrix(M, N);
+    float *B = gemm::utils::allocMatrix(N, K);
+    float *expected = gemm::utils::allocMatrix(M, K);
+    float *C = gemm::utils::allocMatrix(M, K);
+    gemm::utils::randomFillMatrix(A, M, N, -1.0, 1.0);
+    gemm::utils::randomFillMatrix(B, N, K, -1.0, 1.0);
+
+    gemm::Matrix24 sparse = gemm::compress24(A, M, N);
+    gemm::decompress24(sparse, A); // A is now the pruned dense matrix
+
+    const double flops = 2.0 * M * N * K; // dense equivalent
+    const double denseSeconds = bestSeconds(reps, [&] { gemm::generalMatMulOpt(A, B, expected, M, N, K); });
+    const double sparseSeconds = bestSeconds(reps, [&] { gemm::generalMatMul24(sparse, B, C, K); });
+
+    double maxError = 0.0;
+    for (long long i = 0; i < (long long)M * K; i++)
+    {
+        maxError = std::max(maxError, (double)std::fabs(expected[i] - C[i]));
+    }
+
+    const double denseMiB = (double)M * N * sizeof(float) / (1 << 20);
+    const double sparseMiB = ((double)M * (N / 2) * sizeof(float) + (double)M * sparse.indexStride) / (1 << 20);
+    std::printf("A %d x %d, B %d x %d, threads %d\n", M, N, N, K, gemm::utils::numThreads());
+    std::printf("generalMatMulOpt (dense A, %.1f MiB): %.3f s, %.2f GFLOP/s\n", denseMiB, denseSeconds, flops / denseSeconds * 1e-9);
+    std::printf("generalMatMul24  (2:4 A, %.1f MiB):  %.3f s, %.2f dense-equivalent GFLOP/s, speedup %.2fx, max |error| %.3g\n",
+                sparseMiB, sparseSeconds, flops / sparseSeconds * 1e-9, denseSeconds / sparseSeconds, maxError);
+
+    gemm::freeMatrix24(sparse);
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(expected);
+    gemm::utils::freeMatrix(C);
+    return maxError <= 1e-3 * N ? 0 : 1;
+}
@@ -0,0 +1,104 @@
+// gemm_summa_bench compares generalMatMulSumma (forked worker processes, SUMMA over shared memory)
+// with the single-process generalMatMulOpt on the same operands and checks that the results agree.
+//
+//   ./gemm_summa_bench --size 2048 --processes 4 --panel 256 --threads 2 --reps 3
+
+#include "gemm.h"        // generalMatMulOpt
+#include "gemm_summa.h"  // generalMatMulSumma
+#include "gemm_thread.h" // numThreads
+#include "gemm_utils.h"  // allocMatrix, randomFillMatrix
+
+#include <algorithm>  // max, min
+#include <chrono>     // steady_clock
+#include <cmath>      // fabs
+#include <cstdio>     // printf, fprintf
+#include <cstdlib>    // atoi
+#include <functional> // function
+#include <string>     // string
+
+struct Options
+{
+    int size = 1024; // M = N = K
+    int processes = 4;
+    int panel = 256;
+    int threads = 0; // per process, 0 = numThreads() / processes
+    int pin = 0;
+    int reps = 3;
+};
+
+// bestSeconds returns the fastest of `reps` runs
+double bestSeconds(const int reps, const std::function<void()> &run)
+{
+    double best = 1e30;
+    for (int i = 0; i < reps; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        run();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+
+        if (key == "--size")
+            opt.size = std::max(64, std::atoi(value.c_str()) / 64 * 64);
+        else if (key == "--processes")
+            opt.processes = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--panel")
+            opt.panel = std::atoi(value.c_str());
+        else if (key == "--threads")
+            opt.threads = std::atoi(value.c_str());
+        else if (key == "--pin")
+            opt.pin = std::atoi(value.c_str());
+        else if (key == "--reps")
+            opt.reps = std::max(1, std::atoi(value.c_str()));
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    const int n = opt.size;
+    float *A = gemm::utils::allocMatrix(n, n);
+    float *B = gemm::utils::allocMatrix(n, n);
+    float *expected = gemm::utils::allocMatrix(n, n);
+    float *C = gemm::utils::allocMatrix(n, n);
+    gemm::utils::randomFillMatrix(A, n, n, -1.0, 1.0);
+    gemm::utils::randomFillMatrix(B, n, n, -1.0, 1.0);
+
+    gemm::SummaOptions summa;
+    summa.processes = opt.processes;
+    summa.panel = opt.panel;
+    summa.threadsPerProcess = opt.threads;
+    summa.pin = opt.pin != 0;
+
+    const gemm::SummaLayout layout = gemm::summaLayout(n, n, n, summa.processes, summa.panel);
+    const double flops = 2.0 * n * n * n;
+
+    const double optSeconds = bestSeconds(opt.reps, [&] { gemm::generalMatMulOpt(A, B, expected, n, n, n); });
+    const double summaSeconds = bestSeconds(opt.reps, [&] { gemm::generalMatMulSumma(A, B, C, n, n, n, summa); });
+
+    double maxError = 0.0;
+    for (long long i = 0; i < (long long)n * n; i++)
+    {
+        maxError = std::max(maxError, (double)std::fabs(expected[i] - C[i]));
+    }
+
+    std::printf("size %d, threads %d: generalMatMulOpt %.3f s (%.2f GFLOP/s)\n", n, gemm::utils::numThreads(), optSeconds, flops / optSeconds * 1e-9);
+    std::printf("SUMMA %d x %d processes, %zu panels: %.3f s (%.2f GFLOP/s), max |error| %.3g\n",
+                layout.rows, layout.cols, layout.panels.size() - 1, summaSeconds, flops / summaSeconds * 1e-9, maxError);
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(expected);
+    gemm::utils::freeMatrix(C);
+    return maxError <= 1e-3 * n ? 0 : 1;
+}
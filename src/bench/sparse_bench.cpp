@@ -0,0 +1,467 @@
+// sparse_bench times the sparse library on synthetic matrices and writes the results as JSON.
+//
+// usage: sparse_bench [--gen all|rmat|banded|uniform|blockdiag[,...]] [--scale 16] [--degree 16]
+//                     [--ops all|construct,transpose,add,mul,spmv,spmm] [--reps 5] [--threads 0]
+//                     [--seed 1] [--stream-mib 256] [--reorder none|rcm|degree|cluster] [--json results.json]
+//
+// Every matrix has 2^scale rows and about `degree` non-zeros per row. GB/s counts the compulsory traffic
+// (every input and output array read or written once) and is compared with the STREAM triad bandwidth
+// measured at start-up. Peak memory is the resident set high-water mark while the operation runs once.
+// --reorder permutes every matrix symmetrically before the operations, the reordering itself is timed too.
+
+#include "gemm_thread.h" // numThreads, setNumThreads, parallelFor
+#include "gemm_utils.h"  // releasePool
+
+#include "sparseBSR.h"        // SparseBSR
+#include "sparseCSR.h"        // SparseCSR
+#include "sparseFormat.h"     // ChooseFormat
+#include "sparseGenerators.h" // GenerateRMAT, GenerateBanded, GenerateUniform, GenerateBlockDiagonal
+#include "sparseKernels.h"    // SpMV, SpMM
+#include "sparseReorder.h"    // Reorder
+#include "sparseSELL.h"       // SparseSELL
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct Options
+{
+    std::string gens = "all";
+    std::string ops = "all";
+    int scale = 16;
+    int degree = 16;
+    int reps = 5;
+    int threads = 0; // 0 = keep the thread pool default
+    uint64_t seed = 1;
+    int streamMiB = 256;
+    std::string reorder = "none";
+    std::string json; // empty = stdout
+};
+
+struct Result
+{
+    std::string op;
+    double msMin = 0.0;
+    double msMedian = 0.0;
+    double flops = 0.0; // useful floating point operations of one run, 0 = not reported
+    double bytes = 0.0; // compulsory bytes of one run, 0 = not reported
+    double peakMiB = 0.0;
+    double extraMiB = 0.0; // peak minus the resident set before the run
+};
+
+struct MatrixResults
+{
+    std::string name;
+    long long rows;
+    long long cols;
+    long long nnz;
+    std::string format; // ChooseFormat
+    std::vector<Result> results;
+};
+
+std::vector<std::string> splitList(const std::string &s)
+{
+    std::vector<std::string> items;
+    std::stringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ','))
+    {
+        items.push_back(item);
+    }
+    return items;
+}
+
+bool selected(const std::string &list, const std::string &name)
+{
+    std::vector<std::string> items = splitList(list);
+    return std::find(items.begin(), items.end(), "all") != items.end() || std::find(items.begin(), items.end(), name) != items.end();
+}
+
+// statusKiB reads a "Vm..." field of /proc/self/status in KiB, 0 when not available
+long long statusKiB(const char *field)
+{
+    std::FILE *file = std::fopen("/proc/self/status", "r");
+    if (file == nullptr)
+    {
+        return 0;
+    }
+
+    char line[256];
+    long long kib = 0;
+    while (std::fgets(line, sizeof(line), file) != nullptr)
+    {
+        if (std::strncmp(line, field, std::strlen(field)) == 0)
+        {
+            kib = std::atoll(line + std::strlen(field) + 1);
+            break;
+        }
+    }
+    std::fclose(file);
+    return kib;
+}
+
+// resetPeak restarts the VmHWM high-water mark (Linux >= 4.0)
+void resetPeak()
+{
+    std::FILE *file = std::fopen("/proc/self/clear_refs", "w");
+    if (file != nullptr)
+    {
+        std::fputs("5", file);
+        std::fclose(file);
+    }
+}
+
+double nowMs()
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// measure runs op once for the memory high-water mark, then `reps` timed times
+Result measure(const std::string &op, const int reps, const std::function<void()> &run)
+{
+    Result r;
+    r.op = op;
+
+    gemm::utils::releasePool(); // pooled blocks of earlier operations would hide the allocations of this one
+    resetPeak();
+    long long baseKiB = statusKiB("VmRSS");
+    run();
+    long long peakKiB = statusKiB("VmHWM");
+    r.peakMiB = peakKiB / 1024.0;
+    r.extraMiB = std::max(0LL, peakKiB - baseKiB) / 1024.0;
+
+    std::vector<double> times;
+    for (int i = 0; i < reps; i++)
+    {
+        double start = nowMs();
+        run();
+        times.push_back(nowMs() - start);
+    }
+    std::sort(times.begin(), times.end());
+    r.msMin = times.front();
+    r.msMedian = times[times.size() / 2];
+
+    return r;
+}
+
+// streamTriad returns the best STREAM triad bandwidth a[i] = b[i] + s * c[i] in GB/s over float arrays of `mib` MiB each
+double streamTriad(const int mib, const int reps)
+{
+    const long long n = (long long)mib * 1024 * 1024 / sizeof(float);
+    float *a = gemm::utils::allocArray<float>(n);
+    float *b = gemm::utils::allocArray<float>(n);
+    float *c = gemm::utils::allocArray<float>(n);
+
+    // first touch by the threads that run the triad
+    gemm::utils::parallelFor(0, n, 1 << 16, [&](const long long begin, const long long end) {
+        for (long long i = begin; i < end; i++)
+        {
+            a[i] = 0.0f;
+            b[i] = 1.0f;
+            c[i] = 2.0f;
+        }
+    });
+
+    double best = 1e30;
+    for (int rep = 0; rep < std::max(reps, 3); rep++)
+    {
+        double start = nowMs();
+        gemm::utils::parallelFor(0, n, 1 << 16, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                a[i] = b[i] + 3.0f * c[i];
+            }
+        });
+        best = std::min(best, nowMs() - start);
+    }
+
+    gemm::utils::alignedFree(a);
+    gemm::utils::alignedFree(b);
+    gemm::utils::alignedFree(c);
+
+    return 3.0 * n * sizeof(float) / (best * 1e6);
+}
+
+std::vector<sparse::ElementCOO> generate(const std::string &name, const Options &opt)
+{
+    const int n = 1 << opt.scale;
+
+    if (name == "rmat")
+    {
+        return sparse::GenerateRMAT(opt.scale, opt.degree, opt.seed);
+    }
+    if (name == "banded")
+    {
+        return sparse::GenerateBanded(n, opt.degree / 2, opt.seed);
+    }
+    if (name == "uniform")
+    {
+        return sparse::GenerateUniform(n, n, opt.degree, opt.seed);
+    }
+    return sparse::GenerateBlockDiagonal(n, std::max(1, opt.degree), opt.seed);
+}
+
+// csrBytes is the size of the CSR arrays of A
+double csrBytes(const sparse::SparseCSR &A)
+{
+    return (A.Rows() + 1) * sizeof(int) + (double)A.Nnz() * (sizeof(int) + sizeof(float));
+}
+
+MatrixResults benchMatrix(const std::string &name, const Options &opt)
+{
+    std::vector<sparse::ElementCOO> coo = generate(name, opt);
+    const int n = 1 << opt.scale;
+
+    sparse::SparseCSR A(n, n, coo.size(), coo.data());
+    MatrixResults m;
+
+    if (opt.reorder != "none")
+    {
+        sparse::ReorderMethod method = (opt.reorder == "rcm") ? sparse::ReorderRCM : (opt.reorder == "degree") ? sparse::ReorderDegree : sparse::ReorderCluster;
+
+        Result r = measure("reorder_" + opt.reorder, opt.reps, [&]() {
+            sparse::ReorderedCSR reordered = sparse::Reorder(A, method);
+        });
+        m.results.push_back(r);
+
+        sparse::ReorderedCSR reordered = sparse::Reorder(A, method);
+        std::swap(A, reordered.matrix);
+
+        // the generator entries follow the new numbering so that construction builds the same matrix
+        const sparse::Permutation &p = reordered.permutation;
+        for (sparse::ElementCOO &e : coo)
+        {
+            e.row = p.inverse[e.row];
+            e.col = p.inverse[e.col];
+        }
+    }
+
+    sparse::FormatChoice choice = sparse::ChooseFormat(A);
+
+    m.name = name;
+    m.rows = A.Rows();
+    m.cols = A.Cols();
+    m.nnz = A.Nnz();
+    m.format = (choice.format == sparse::FormatBSR) ? "bsr" + std::to_string(choice.blockDim) : (choice.format == sparse::FormatSELL) ? "sell" : "csr";
+
+    if (selected(opt.ops, "construct"))
+    {
+        Result r = measure("construct", opt.reps, [&]() {
+            sparse::SparseCSR B(n, n, coo.size(), coo.data());
+        });
+        r.bytes = coo.size() * sizeof(sparse::ElementCOO) + csrBytes(A);
+        m.results.push_back(r);
+    }
+    std::vector<sparse::ElementCOO>().swap(coo);
+
+    sparse::SparseCSR T = A.Transpose();
+
+    if (selected(opt.ops, "transpose"))
+    {
+        Result r = measure("transpose", opt.reps, [&]() {
+            sparse::SparseCSR B = A.Transpose();
+        });
+        r.bytes = 2 * csrBytes(A);
+        m.results.push_back(r);
+    }
+
+    if (selected(opt.ops, "add"))
+    {
+        long long nnzC = 0;
+        Result r = measure("add", opt.reps, [&]() {
+            nnzC = A.Add(T).Nnz(); // A + A^T
+        });
+        r.flops = A.Nnz() + T.Nnz() - nnzC; // one addition per common entry
+        r.bytes = csrBytes(A) + csrBytes(T) + (A.Rows() + 1) * sizeof(int) + (double)nnzC * (sizeof(int) + sizeof(float));
+        m.results.push_back(r);
+    }
+
+    if (selected(opt.ops, "mul"))
+    {
+        double flops = 0.0;
+        for (int row = 0; row < A.Rows(); row++)
+        {
+            for (int k = A.RowStart()[row]; k < A.RowStart()[row + 1]; k++)
+            {
+                flops += A.RowStart()[A.ColIdx()[k] + 1] - A.RowStart()[A.ColIdx()[k]];
+            }
+        }
+
+        long long nnzC = 0;
+        Result r = measure("mul", opt.reps, [&]() {
+            nnzC = A.Mul(A).Nnz(); // A * A
+        });
+        r.flops = 2.0 * flops;
+        r.bytes = 2 * csrBytes(A) + (A.Rows() + 1) * sizeof(int) + (double)nnzC * (sizeof(int) + sizeof(float));
+        m.results.push_back(r);
+    }
+
+    std::vector<float> x(A.Cols(), 1.0f), y(A.Rows(), 0.0f);
+    const double vectorBytes = (A.Cols() + A.Rows()) * sizeof(float);
+
+    if (selected(opt.ops, "spmv"))
+    {
+        Result r = measure("spmv_csr", opt.reps, [&]() {
+            sparse::SpMV(A, x.data(), y.data());
+        });
+        r.flops = 2.0 * A.Nnz();
+        r.bytes = csrBytes(A) + vectorBytes;
+        m.results.push_back(r);
+
+        sparse::SparseSELL S(A);
+        r = measure("spmv_sell", opt.reps, [&]() {
+            S.SpMV(x.data(), y.data());
+        });
+        r.flops = 2.0 * A.Nnz();
+        r.bytes = (double)S.PaddedSize() * (sizeof(int) + sizeof(float)) + A.Rows() * sizeof(int) + vectorBytes;
+        m.results.push_back(r);
+
+        if (choice.format == sparse::FormatBSR) // BSR of a badly blocked matrix mostly stores zeros
+        {
+            sparse::SparseBSR B(A, choice.blockDim);
+            r = measure("spmv_bsr", opt.reps, [&]() {
+                B.SpMV(x.data(), y.data());
+            });
+            r.flops = 2.0 * A.Nnz();
+            r.bytes = (double)B.Nnzb() * (sizeof(int) + B.BlockDim() * B.BlockDim() * sizeof(float)) + vectorBytes;
+            m.results.push_back(r);
+        }
+    }
+
+    if (selected(opt.ops, "spmm"))
+    {
+        const int K = 16;
+        std::vector<float> X((size_t)A.Cols() * K, 1.0f), Y((size_t)A.Rows() * K, 0.0f);
+
+        Result r = measure("spmm_k16", opt.reps, [&]() {
+            sparse::SpMM(A, X.data(), Y.data(), K, K, K);
+        });
+        r.flops = 2.0 * A.Nnz() * K;
+        r.bytes = csrBytes(A) + vectorBytes * K;
+        m.results.push_back(r);
+    }
+
+    return m;
+}
+
+void writeJson(std::FILE *out, const Options &opt, const double streamGBs, const std::vector<MatrixResults> &matrices)
+{
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"config\": {\"scale\": %d, \"degree\": %d, \"reps\": %d, \"threads\": %d, \"seed\": %llu, \"reorder\": \"%s\"},\n",
+                 opt.scale, opt.degree, opt.reps, gemm::utils::numThreads(), (unsigned long long)opt.seed, opt.reorder.c_str());
+    std::fprintf(out, "  \"stream_triad_gbs\": %.3f,\n", streamGBs);
+    std::fprintf(out, "  \"matrices\": [\n");
+
+    for (size_t i = 0; i < matrices.size(); i++)
+    {
+        const MatrixResults &m = matrices[i];
+        std::fprintf(out, "    {\"name\": \"%s\", \"rows\": %lld, \"cols\": %lld, \"nnz\": %lld, \"format\": \"%s\", \"results\": [\n",
+                     m.name.c_str(), m.rows, m.cols, m.nnz, m.format.c_str());
+
+        for (size_t j = 0; j < m.results.size(); j++)
+        {
+            const Result &r = m.results[j];
+            std::fprintf(out, "      {\"op\": \"%s\", \"ms_min\": %.4f, \"ms_median\": %.4f", r.op.c_str(), r.msMin, r.msMedian);
+            if (r.flops > 0.0)
+            {
+                std::fprintf(out, ", \"gflops\": %.4f", r.flops / (r.msMin * 1e6));
+            }
+            if (r.bytes > 0.0)
+            {
+                double gbs = r.bytes / (r.msMin * 1e6);
+                std::fprintf(out, ", \"gbs\": %.4f, \"stream_fraction\": %.4f", gbs, gbs / streamGBs);
+            }
+            std::fprintf(out, ", \"peak_rss_mib\": %.2f, \"extra_rss_mib\": %.2f}%s\n", r.peakMiB, r.extraMiB, (j + 1 < m.results.size()) ? "," : "");
+        }
+
+        std::fprintf(out, "    ]}%s\n", (i + 1 < matrices.size()) ? "," : "");
+    }
+
+    std::fprintf(out, "  ]\n");
+    std::fprintf(out, "}\n");
+}
+
+void printSummary(const double streamGBs, const MatrixResults &m)
+{
+    std::fprintf(stderr, "%s: %lld x %lld, nnz = %lld, format = %s\n", m.name.c_str(), m.rows, m.cols, m.nnz, m.format.c_str());
+    for (const Result &r : m.results)
+    {
+        double gbs = r.bytes / (r.msMin * 1e6);
+        std::fprintf(stderr, "  %-10s %10.3f ms %8.3f GFLOPS %8.2f GB/s (%5.1f%% STREAM) peak %8.1f MiB (+%.1f)\n",
+                     r.op.c_str(), r.msMin, r.flops / (r.msMin * 1e6), gbs, 100.0 * gbs / streamGBs, r.peakMiB, r.extraMiB);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+
+        if (key == "--gen")
+            opt.gens = value;
+        else if (key == "--ops")
+            opt.ops = value;
+        else if (key == "--scale")
+            opt.scale = std::atoi(value.c_str());
+        else if (key == "--degree")
+            opt.degree = std::atoi(value.c_str());
+        else if (key == "--reps")
+            opt.reps = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--threads")
+            opt.threads = std::atoi(value.c_str());
+        else if (key == "--seed")
+            opt.seed = std::strtoull(value.c_str(), nullptr, 10);
+        else if (key == "--stream-mib")
+            opt.streamMiB = std::max(1, std::atoi(value.c_str()));
+        else if (key == "--reorder")
+            opt.reorder = value;
+        else if (key == "--json")
+            opt.json = value;
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    if (opt.threads > 0)
+    {
+        gemm::utils::setNumThreads(opt.threads);
+    }
+
+    double streamGBs = streamTriad(opt.streamMiB, opt.reps);
+    std::fprintf(stderr, "threads = %d, STREAM triad = %.2f GB/s\n", gemm::utils::numThreads(), streamGBs);
+
+    std::vector<MatrixResults> matrices;
+    for (const char *name : {"rmat", "banded", "uniform", "blockdiag"})
+    {
+        if (selected(opt.gens, name))
+        {
+            matrices.push_back(benchMatrix(name, opt));
+            printSummary(streamGBs, matrices.back());
+        }
+    }
+
+    std::FILE *out = opt.json.empty() ? stdout : std::fopen(opt.json.c_str(), "w");
+    if (out == nullptr)
+    {
+        std::fprintf(stderr, "cannot write %s\n", opt.json.c_str());
+        return 1;
+    }
+    writeJson(out, opt, streamGBs, matrices);
+    if (out != stdout)
+    {
+        std::fclose(out);
+    }
+
+    return 0;
+}
@@ -1,7 +1,10 @@
 #include "gemm.h"
+#include "gemm_thread.h"
 #include "gemm_utils.h"
 
 #include <algorithm>
+#include <utility> // pair
+#include <vector>  // vector
 
 namespace gemm
 {
@@ -157,12 +160,47 @@ namespace gemm
         }
     }
 
-    float _globalBlockBuffer[BlockDim * BlockDim];
-    Matrix _globalBlockTmp = Matrix(_globalBlockBuffer, BlockDim, BlockDim, BlockDim);
+    // __MatrixMatMulTile computes the C block (i, j) over the reduction blocks [pBegin, pEnd):
+    // bC = sum_p bA(i, p) * bB(p, j)
+    void __MatrixMatMulTile(const Matrix &A, const Matrix &B, Matrix &C, const int i, const int j, const int pBegin, const int pEnd)
+    {
+        // block buffer is private to the calling thread
+        alignas(utils::CacheLineSize) float blockBuffer[BlockDim * BlockDim];
+        Matrix blockTmp = Matrix(blockBuffer, BlockDim, BlockDim, BlockDim);
 
-    void MatrixMatMulOpt(const Matrix &A, const Matrix &B, Matrix &C)
+        Matrix bC = Matrix(C.data + (i * C.stride + j) * BlockDim, BlockDim, BlockDim, C.stride);
+        MatrixFill(bC, 0.0);
+
+        for (int p = pBegin; p < pEnd; p++)
+        {
+            const Matrix bA = Matrix(A.data + (i * A.stride + p) * BlockDim, BlockDim, BlockDim, A.stride);
+            const Matrix bB = Matrix(B.data + (p * B.stride + j) * BlockDim, BlockDim, BlockDim, B.stride);
+
+            __MatrixMatMulBlockDim(bA, bB, blockTmp);
+            MatrixMatAdd(bC, blockTmp, bC);
+        }
+    }
+
+    // __splitKFactor returns how many slices the reduction dimension is split into.
+    // Splitting only pays off when there are fewer C blocks than threads.
+    int __splitKFactor(const int blockM, const int blockN, const int blockK)
+    {
+        int threads = utils::numThreads();
+        int tiles = blockM * blockK;
+
+        if (threads <= 1 || tiles == 0 || tiles >= threads || blockN < 2)
+        {
+            return 1;
+        }
+
+        return std::min((threads + tiles - 1) / tiles, blockN);
+    }
+
+    // MatrixMatMulSplitK splits the reduction dimension into `split` slices.
+    // Every slice computes partial C blocks into a private buffer (slice 0 uses C itself),
+    // then the partial results are summed into C in parallel over rows.
+    void MatrixMatMulSplitK(const Matrix &A, const Matrix &B, Matrix &C, int split)
     {
-        // opt: divide block
         int M = A.M;
         int N = A.N;
         int K = B.N;
@@ -170,30 +208,73 @@ namespace gemm
         int blockM = M / BlockDim;
         int blockN = N / BlockDim;
         int blockK = K / BlockDim;
+        int tiles = blockM * blockK;
 
-        int aStride = A.stride;
-        int bStride = B.stride;
-        int cStride = C.stride;
+        split = std::max(1, std::min(split, blockN));
 
-        MatrixFill(C, 0.0);
-
-        for (int i = 0; i < blockM; i++)
+        std::vector<float *> partialBuffers(split - 1);
+        std::vector<Matrix> partials;
+        partials.push_back(C);
+        for (int s = 1; s < split; s++)
         {
-            for (int p = 0; p < blockN; p++)
+            partialBuffers[s - 1] = utils::allocMatrix(blockM * BlockDim, blockK * BlockDim);
+            partials.push_back(Matrix(partialBuffers[s - 1], blockM * BlockDim, blockK * BlockDim, blockK * BlockDim));
+        }
+
+        // work item = (slice, C block)
+        utils::parallelFor(0, split * tiles, 1, [&](const long long begin, const long long end) {
+            for (long long t = begin; t < end; t++)
             {
-                const Matrix bA = Matrix(A.data + (i * A.stride + p) * BlockDim, BlockDim, BlockDim, A.stride);
-                for (int j = 0; j < blockK; j++)
-                {
-                    const Matrix bB = Matrix(B.data + (p * B.stride + j) * BlockDim, BlockDim, BlockDim, B.stride);
-                    Matrix bC = Matrix(C.data + (i * C.stride + j) * BlockDim, BlockDim, BlockDim, C.stride);
+                int s = t / tiles;
+                int tile = t % tiles;
 
-                    __MatrixMatMulBlockDim(bA, bB, _globalBlockTmp);
-                    MatrixMatAdd(bC, _globalBlockTmp, bC);
-                }
+                int pBegin = blockN * s / split;
+                int pEnd = blockN * (s + 1) / split;
+                __MatrixMatMulTile(A, B, partials[s], tile / blockK, tile % blockK, pBegin, pEnd);
             }
+        });
+
+        if (split > 1)
+        {
+            int rows = blockM * BlockDim;
+            int cols = blockK * BlockDim;
+
+            utils::parallelFor(0, rows, 1, [&](const long long begin, const long long end) {
+                for (long long i = begin; i < end; i++)
+                {
+                    float *c = C.data + i * C.stride;
+                    for (int s = 1; s < split; s++)
+                    {
+                        const float *partial = partials[s].data + i * partials[s].stride;
+                        for (int j = 0; j < cols; j++)
+                        {
+                            c[j] += partial[j];
+                        }
+                    }
+                }
+            });
+        }
+
+        for (float *buffer : partialBuffers)
+        {
+            utils::freeMatrix(buffer);
         }
     }
 
+    void MatrixMatMulOpt(const Matrix &A, const Matrix &B, Matrix &C)
+    {
+        // opt: divide block, parallel over C blocks, split-K when C has too few blocks to occupy all threads
+        int M = A.M;
+        int N = A.N;
+        int K = B.N;
+
+        int blockM = M / BlockDim;
+        int blockN = N / BlockDim;
+        int blockK = K / BlockDim;
+
+        MatrixMatMulSplitK(A, B, C, __splitKFactor(blockM, blockN, blockK));
+    }
+
     void MatrixMatMulStrassen(const Matrix &A, const Matrix &B, Matrix &C, int depth)
     {
         int M = A.M;
@@ -226,20 +307,16 @@ namespace gemm
         Matrix C21 = Matrix(C.data + halfM * C.stride, halfM, halfK, C.stride);
         Matrix C22 = Matrix(C.data + halfM * C.stride + halfK, halfM, halfK, C.stride);
 
-        int aSize = halfM * halfN;
-        int bSize = halfN * halfK;
-        int cSize = halfM * halfK;
-
-        float *_tmpA = new float[aSize];
-        float *_tmpB = new float[bSize];
+        float *_tmpA = utils::allocMatrix(halfM, halfN);
+        float *_tmpB = utils::allocMatrix(halfN, halfK);
         Matrix tmpA = Matrix(_tmpA, halfM, halfN, halfN);
         Matrix tmpB = Matrix(_tmpB, halfN, halfK, halfK);
 
-        float *_tmpM1 = new float[cSize];
-        float *_tmpM2 = new float[cSize];
-        float *_tmpM3 = new float[cSize];
-        float *_tmpM4 = new float[cSize];
-        float *_tmpM5 = new float[cSize];
+        float *_tmpM1 = utils::allocMatrix(halfM, halfK);
+        float *_tmpM2 = utils::allocMatrix(halfM, halfK);
+        float *_tmpM3 = utils::allocMatrix(halfM, halfK);
+        float *_tmpM4 = utils::allocMatrix(halfM, halfK);
+        float *_tmpM5 = utils::allocMatrix(halfM, halfK);
 
         Matrix M1 = Matrix(_tmpM1, halfM, halfK, halfK);
         Matrix M4 = Matrix(_tmpM2, halfM, halfK, halfK);
@@ -312,13 +389,134 @@ namespace gemm
             MatrixMatAdd(C22, M6, C22);
         }
 
-        delete[] _tmpA;
-        delete[] _tmpB;
-        delete[] _tmpM1;
-        delete[] _tmpM2;
-        delete[] _tmpM3;
-        delete[] _tmpM4;
-        delete[] _tmpM5;
+        utils::freeMatrix(_tmpA);
+        utils::freeMatrix(_tmpB);
+        utils::freeMatrix(_tmpM1);
+        utils::freeMatrix(_tmpM2);
+        utils::freeMatrix(_tmpM3);
+        utils::freeMatrix(_tmpM4);
+        utils::freeMatrix(_tmpM5);
+    }
+
+    // __MatrixSyrkTile computes the tile C[i0:i0+mi][j0:j0+nj] = A[i0:i0+mi] * A[j0:j0+nj]ᵀ.
+    // On a diagonal tile (i0 == j0) only the `uplo` half is computed and stored.
+    void __MatrixSyrkTile(const Matrix &A, Matrix &C, const int i0, const int j0, const int mi, const int nj, const Triangle uplo)
+    {
+        // tiles are private to the calling thread
+        alignas(utils::CacheLineSize) float cTile[BlockDim * BlockDim];
+        alignas(utils::CacheLineSize) float packT[BlockDim * BlockDim]; // packT[p][j] = A[j0 + j][p0 + p]
+
+        const int N = A.N;
+        const float *a = A.data;
+        int aStride = A.stride;
+
+        const bool diagonal = (i0 == j0);
+
+        std::fill_n(cTile, BlockDim * BlockDim, 0.0f);
+
+        for (int p0 = 0; p0 < N; p0 += BlockDim)
+        {
+            const int kp = std::min(BlockDim, N - p0);
+
+            // the rows of A in the role of Aᵀ, packed per block so the inner loop is contiguous
+            for (int j = 0; j < nj; j++)
+            {
+                for (int p = 0; p < kp; p++)
+                {
+                    packT[p * BlockDim + j] = a[(j0 + j) * aStride + p0 + p];
+                }
+            }
+
+            for (int i = 0; i < mi; i++) // loop 1
+            {
+                int jBegin = 0;
+                int jEnd = nj;
+                if (diagonal)
+                {
+                    jBegin = (uplo == Upper) ? i : 0;
+                    jEnd = (uplo == Lower) ? i + 1 : nj;
+                }
+
+                float *cRow = cTile + i * BlockDim;
+                const float *aRow = a + (i0 + i) * aStride + p0;
+
+                for (int p = 0; p < kp; p++) // loop 2
+                {
+                    const float aElement = aRow[p];
+                    const float *bRow = packT + p * BlockDim;
+
+                    for (int j = jBegin; j < jEnd; j++) // loop 3
+                    {
+                        cRow[j] += aElement * bRow[j];
+                    }
+                }
+            }
+        }
+
+        for (int i = 0; i < mi; i++)
+        {
+            int jBegin = 0;
+            int jEnd = nj;
+            if (diagonal)
+            {
+                jBegin = (uplo == Upper) ? i : 0;
+                jEnd = (uplo == Lower) ? i + 1 : nj;
+            }
+            std::copy(cTile + i * BlockDim + jBegin, cTile + i * BlockDim + jEnd, C.data + (i0 + i) * C.stride + j0 + jBegin);
+        }
+    }
+
+    void MatrixSyrk(const Matrix &A, Matrix &C, const Triangle uplo, const bool mirror)
+    {
+        const int M = A.M;
+        const int blocks = (M + BlockDim - 1) / BlockDim;
+
+        // every tile of the triangle costs about the same, so dynamic scheduling of single tiles balances the work
+        std::vector<std::pair<int, int>> tiles;
+        tiles.reserve(blocks * (blocks + 1) / 2);
+        for (int bi = 0; bi < blocks; bi++)
+        {
+            for (int bj = 0; bj <= bi; bj++)
+            {
+                tiles.push_back((uplo == Lower) ? std::make_pair(bi, bj) : std::make_pair(bj, bi));
+            }
+        }
+
+        utils::parallelFor(0, tiles.size(), 1, [&](const long long begin, const long long end) {
+            for (long long t = begin; t < end; t++)
+            {
+                const int i0 = tiles[t].first * BlockDim;
+                const int j0 = tiles[t].second * BlockDim;
+                __MatrixSyrkTile(A, C, i0, j0, std::min(BlockDim, M - i0), std::min(BlockDim, M - j0), uplo);
+            }
+        });
+
+        if (mirror)
+        {
+            // copy the computed triangle to the other one, row i of the missing half reads column i of the computed half
+            float *c = C.data;
+            int cStride = C.stride;
+
+            utils::parallelFor(0, M, BlockDim, [&](const long long begin, const long long end) {
+                for (long long i = begin; i < end; i++)
+                {
+                    if (uplo == Lower)
+                    {
+                        for (long long j = i + 1; j < M; j++)
+                        {
+                            c[i * cStride + j] = c[j * cStride + i];
+                        }
+                    }
+                    else
+                    {
+                        for (long long j = 0; j < i; j++)
+                        {
+                            c[i * cStride + j] = c[j * cStride + i];
+                        }
+                    }
+                }
+            });
+        }
     }
 
     // -------------------------------------------------------------------------------------------------------------------------------------------------
@@ -370,4 +568,28 @@ namespace gemm
         MatrixMatMulStrassen(mA, mB, mC, 0);
     }
 
-} // namespace gemm
\ No newline at end of file
+    void generalMatSyrk(const float *A, float *C, const int M, const int N, const Triangle uplo, const bool mirror)
+    {
+        const Matrix mA = Matrix((float *)A, M, N, N);
+        Matrix mC = Matrix(C, M, M, M);
+
+        MatrixSyrk(mA, mC, uplo, mirror);
+    }
+
+    void generalMatMulSplitK(const float *A, const float *B, float *C, const int M, const int N, const int K, const int split)
+    {
+        const Matrix mA = Matrix((float *)A, M, N, N);
+        const Matrix mB = Matrix((float *)B, N, K, K);
+        Matrix mC = Matrix(C, M, K, K);
+
+        if (split > 0)
+        {
+            MatrixMatMulSplitK(mA, mB, mC, split);
+        }
+        else
+        {
+            MatrixMatMulOpt(mA, mB, mC);
+        }
+    }
+
+} // namespace gemm
@@ -3,6 +3,13 @@
 
 namespace gemm
 {
+    // Triangle selects which half of a symmetric matrix is computed.
+    enum Triangle
+    {
+        Lower, // C[i][j], j <= i
+        Upper, // C[i][j], j >= i
+    };
+
     // generalMatAdd is the funciton of general matrix addition
     // input    : A[M][N], B[M][N]
     // function : C = A+B
@@ -22,17 +29,32 @@ namespace gemm
     void generalMatMulTrival(const float *A, const float *B, float *C, const int M, const int N, const int K);
 
     // generalMatMulOpt is the naive version of general matrix multiplication with soft optimization.
+    // It runs in parallel over C blocks and switches to split-K when C has fewer blocks than threads.
     // input    : A[M][N], B[N][K]
     // function : C = A*B
     // output   : C[M][K]
     void generalMatMulOpt(const float *A, const float *B, float *C, const int M, const int N, const int K);
 
+    // generalMatMulSplitK is generalMatMulOpt with the reduction dimension N split into `split` slices,
+    // computed in private buffers and summed afterwards. split <= 0 picks the factor automatically.
+    // input    : A[M][N], B[N][K]
+    // function : C = A*B
+    // output   : C[M][K]
+    void generalMatMulSplitK(const float *A, const float *B, float *C, const int M, const int N, const int K, const int split = 0);
+
     // generalMatMulStrassen implements Strassen Algorithm of general matrix multiplication with soft optimization.
     // input    : A[M][N], B[N][K]
     // function : C = A*B
     // output   : C[M][K]
     void generalMatMulStrassen(const float *A, const float *B, float *C, const int M, const int N, const int K);
 
+    // generalMatSyrk computes the Gram matrix C = A*Aᵀ (symmetric rank-k update) without transposing A.
+    // Only the `uplo` triangle of C is written, the other one is left untouched unless mirror is set.
+    // input    : A[M][N]
+    // function : C = A*Aᵀ
+    // output   : C[M][M]
+    void generalMatSyrk(const float *A, float *C, const int M, const int N, const Triangle uplo = Lower, const bool mirror = false);
+
 } // namespace gemm
 
 #endif // __LAB1_GEMM_H__
\ No newline at end of file
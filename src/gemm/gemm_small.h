@@ -0,0 +1,103 @@
+#ifndef __LAB1_GEMM_SMALL_H__
+#define __LAB1_GEMM_SMALL_H__
+
+// small dense kernels for blocks of a few rows, fully unrolled when the dimension is a template argument.
+// All blocks are row-major and contiguous.
+
+namespace gemm
+{
+    // smallMatMulAcc accumulates the product of two D x D blocks.
+    // input    : A[D][D], B[D][D], C[D][D]
+    // function : C += A*B
+    // output   : C[D][D]
+    template <int D>
+    inline void smallMatMulAcc(const float *A, const float *B, float *C)
+    {
+        for (int i = 0; i < D; i++)
+        {
+            for (int p = 0; p < D; p++)
+            {
+                const float aElement = A[i * D + p];
+                for (int j = 0; j < D; j++)
+                {
+                    C[i * D + j] += aElement * B[p * D + j];
+                }
+            }
+        }
+    }
+
+    // smallMatVecAcc accumulates the product of a D x D block and a vector.
+    // input    : A[D][D], x[D], y[D]
+    // function : y += A*x
+    // output   : y[D]
+    template <int D>
+    inline void smallMatVecAcc(const float *A, const float *x, float *y)
+    {
+        for (int i = 0; i < D; i++)
+        {
+            float dot = 0.0;
+            for (int p = 0; p < D; p++)
+            {
+                dot += A[i * D + p] * x[p];
+            }
+            y[i] += dot;
+        }
+    }
+
+    // runtime dimension versions, dispatching to the unrolled kernels for the common block sizes
+
+    inline void smallMatMulAcc(const float *A, const float *B, float *C, const int D)
+    {
+        switch (D)
+        {
+        case 2:
+            return smallMatMulAcc<2>(A, B, C);
+        case 3:
+            return smallMatMulAcc<3>(A, B, C);
+        case 4:
+            return smallMatMulAcc<4>(A, B, C);
+        case 8:
+            return smallMatMulAcc<8>(A, B, C);
+        }
+
+        for (int i = 0; i < D; i++)
+        {
+            for (int p = 0; p < D; p++)
+            {
+                const float aElement = A[i * D + p];
+                for (int j = 0; j < D; j++)
+                {
+                    C[i * D + j] += aElement * B[p * D + j];
+                }
+            }
+        }
+    }
+
+    inline void smallMatVecAcc(const float *A, const float *x, float *y, const int D)
+    {
+        switch (D)
+        {
+        case 2:
+            return smallMatVecAcc<2>(A, x, y);
+        case 3:
+            return smallMatVecAcc<3>(A, x, y);
+        case 4:
+            return smallMatVecAcc<4>(A, x, y);
+        case 8:
+            return smallMatVecAcc<8>(A, x, y);
+        }
+
+        for (int i = 0; i < D; i++)
+        {
+            float dot = 0.0;
+            for (int p = 0; p < D; p++)
+            {
+                dot += A[i * D + p] * x[p];
+            }
+            y[i] += dot;
+        }
+    }
+
+} // namespace gemm
+
+#endif // __LAB1_GEMM_SMALL_H__
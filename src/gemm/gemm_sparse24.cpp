@@ -0,0 +1,276 @@
+#include "gemm_sparse24.h"
+
+#include "gemm_thread.h" // parallelFor
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // min, fill_n
+#include <cmath>     // fabs
+#include <cstring>   // memset
+#include <stdexcept> // invalid_argument
+#include <utility>   // swap
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace gemm
+{
+    // one SIMD register of C
+#if defined(__AVX512F__)
+    typedef __m512 Vec24;
+    const int VecWidth24 = 16;
+    inline Vec24 __vzero() { return _mm512_setzero_ps(); }
+    inline Vec24 __vset(const float x) { return _mm512_set1_ps(x); }
+    inline Vec24 __vload(const float *p) { return _mm512_loadu_ps(p); }
+    inline void __vstore(float *p, const Vec24 v) { _mm512_storeu_ps(p, v); }
+    inline Vec24 __vfma(const Vec24 a, const Vec24 b, const Vec24 c) { return _mm512_fmadd_ps(a, b, c); }
+#elif defined(__AVX2__)
+    typedef __m256 Vec24;
+    const int VecWidth24 = 8;
+    inline Vec24 __vzero() { return _mm256_setzero_ps(); }
+    inline Vec24 __vset(const float x) { return _mm256_set1_ps(x); }
+    inline Vec24 __vload(const float *p) { return _mm256_loadu_ps(p); }
+    inline void __vstore(float *p, const Vec24 v) { _mm256_storeu_ps(p, v); }
+    inline Vec24 __vfma(const Vec24 a, const Vec24 b, const Vec24 c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+    typedef float Vec24;
+    const int VecWidth24 = 1;
+    inline Vec24 __vzero() { return 0.0f; }
+    inline Vec24 __vset(const float x) { return x; }
+    inline Vec24 __vload(const float *p) { return *p; }
+    inline void __vstore(float *p, const Vec24 v) { *p = v; }
+    inline Vec24 __vfma(const Vec24 a, const Vec24 b, const Vec24 c) { return a * b + c; }
+#endif
+
+    // micro tile of C: Tile24Rows x Tile24Cols, all in registers
+    const int Tile24Rows = 4;
+    const int Tile24Vecs = (VecWidth24 == 16) ? 4 : 2;
+    const int Tile24Cols = Tile24Vecs * VecWidth24;
+
+    // block of C handled by one task, and groups of four rows of B per pass (that slice of B stays in L1)
+    const int Block24Rows = 64;
+    const int Block24Cols = 256;
+    const int Block24Groups = 32;
+
+    // __positions returns the nibble of group g: position of the first kept element in bits 0-1, of the second in bits 2-3
+    inline unsigned __positions(const unsigned char *indices, const int g)
+    {
+        return (indices[g >> 1] >> ((g & 1) * 4)) & 0xF;
+    }
+
+    // __tile24 computes rows [0, MR) x columns [0, Tile24Cols) of C over the groups [g0, g1),
+    // values, indices, B and C point at the first row / column of the tile
+    template <int MR>
+    inline void __tile24(const Matrix24 &A, const int row, const int g0, const int g1, const float *B, const long long ldb, float *C, const long long ldc, const bool accumulate)
+    {
+        const long long valueStride = A.N / 2;
+        const float *values = A.values + row * valueStride;
+        const unsigned char *indices = A.indices + (long long)row * A.indexStride;
+
+        Vec24 acc[MR][Tile24Vecs];
+        for (int r = 0; r < MR; r++)
+        {
+            for (int v = 0; v < Tile24Vecs; v++)
+            {
+                acc[r][v] = accumulate ? __vload(C + r * ldc + v * VecWidth24) : __vzero();
+            }
+        }
+
+        for (int g = g0; g < g1; g++)
+        {
+            const float *group = B + 4LL * g * ldb;
+            for (int r = 0; r < MR; r++)
+            {
+                const unsigned positions = __positions(indices + r * A.indexStride, g);
+                const float *b0 = group + (positions & 3) * ldb;
+                const float *b1 = group + (positions >> 2) * ldb;
+                const Vec24 a0 = __vset(values[r * valueStride + 2 * g]);
+                const Vec24 a1 = __vset(values[r * valueStride + 2 * g + 1]);
+
+                for (int v = 0; v < Tile24Vecs; v++)
+                {
+                    acc[r][v] = __vfma(a0, __vload(b0 + v * VecWidth24), acc[r][v]);
+                    acc[r][v] = __vfma(a1, __vload(b1 + v * VecWidth24), acc[r][v]);
+                }
+            }
+        }
+
+        for (int r = 0; r < MR; r++)
+        {
+            for (int v = 0; v < Tile24Vecs; v++)
+            {
+                __vstore(C + r * ldc + v * VecWidth24, acc[r][v]);
+            }
+        }
+    }
+
+    // __edge24 computes the columns [j0, j1) of rows [i0, i1) that do not fill a tile
+    void __edge24(const Matrix24 &A, const int i0, const int i1, const int j0, const int j1, const float *B, const int K, float *C)
+    {
+        const int groups = A.N / 4;
+        for (int i = i0; i < i1; i++)
+        {
+            float *c = C + (long long)i * K;
+            std::fill_n(c + j0, j1 - j0, 0.0f);
+
+            const float *values = A.values + (long long)i * (A.N / 2);
+            const unsigned char *indices = A.indices + (long long)i * A.indexStride;
+            for (int g = 0; g < groups; g++)
+            {
+                const unsigned positions = __positions(indices, g);
+                const float *b0 = B + (4LL * g + (positions & 3)) * K;
+                const float *b1 = B + (4LL * g + (positions >> 2)) * K;
+                for (int j = j0; j < j1; j++)
+                {
+                    c[j] += values[2 * g] * b0[j] + values[2 * g + 1] * b1[j];
+                }
+            }
+        }
+    }
+
+    Matrix24 compress24(const float *A, const int M, const int N)
+    {
+        if (M < 0 || N < 0 || N % 4 != 0)
+        {
+            throw std::invalid_argument("compress24: N must be a multiple of 4");
+        }
+
+        Matrix24 compressed;
+        compressed.M = M;
+        compressed.N = N;
+        compressed.indexStride = (N / 4 + 1) / 2;
+        compressed.values = utils::allocArray<float>(std::max<long long>(1, (long long)M * (N / 2)));
+        compressed.indices = utils::allocArray<unsigned char>(std::max<long long>(1, (long long)M * compressed.indexStride));
+        std::memset(compressed.indices, 0, (size_t)M * compressed.indexStride); // also the unused nibble of an odd group count
+
+        utils::parallelFor(0, M, 16, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                const float *a = A + i * N;
+                float *values = compressed.values + i * (N / 2);
+                unsigned char *indices = compressed.indices + i * compressed.indexStride;
+
+                for (int g = 0; g < N / 4; g++)
+                {
+                    // the two largest magnitudes, the lower position wins ties
+                    int first = 0, second = 1;
+                    if (std::fabs(a[4 * g + 1]) > std::fabs(a[4 * g]))
+                    {
+                        std::swap(first, second);
+                    }
+                    for (int p = 2; p < 4; p++)
+                    {
+                        if (std::fabs(a[4 * g + p]) > std::fabs(a[4 * g + first]))
+                        {
+                            second = first;
+                            first = p;
+                        }
+                        else if (std::fabs(a[4 * g + p]) > std::fabs(a[4 * g + second]))
+                        {
+                            second = p;
+                        }
+                    }
+                    const int low = std::min(first, second);
+                    const int high = std::max(first, second);
+
+                    values[2 * g] = a[4 * g + low];
+                    values[2 * g + 1] = a[4 * g + high];
+                    indices[g >> 1] |= (unsigned char)((low | (high << 2)) << ((g & 1) * 4));
+                }
+            }
+        });
+
+        return compressed;
+    }
+
+    void decompress24(const Matrix24 &A, float *dense)
+    {
+        for (int i = 0; i < A.M; i++)
+        {
+            float *d = dense + (long long)i * A.N;
+            const float *values = A.values + (long long)i * (A.N / 2);
+            const unsigned char *indices = A.indices + (long long)i * A.indexStride;
+
+            std::fill_n(d, A.N, 0.0f);
+            for (int g = 0; g < A.N / 4; g++)
+            {
+                const unsigned positions = __positions(indices, g);
+                d[4 * g + (positions & 3)] = values[2 * g];
+                d[4 * g + (positions >> 2)] = values[2 * g + 1];
+            }
+        }
+    }
+
+    void freeMatrix24(Matrix24 &A)
+    {
+        utils::alignedFree(A.values);
+        utils::alignedFree(A.indices);
+        A = Matrix24();
+    }
+
+    void generalMatMul24(const Matrix24 &A, const float *B, float *C, const int K)
+    {
+        const int M = A.M;
+        const int groups = A.N / 4;
+        if (M <= 0 || K <= 0)
+        {
+            return;
+        }
+        if (groups == 0)
+        {
+            for (int i = 0; i < M; i++)
+            {
+                std::fill_n(C + (long long)i * K, K, 0.0f);
+            }
+            return;
+        }
+
+        const int blocksM = (M + Block24Rows - 1) / Block24Rows;
+        const int blocksK = (K + Block24Cols - 1) / Block24Cols;
+        const int fullK = K / Tile24Cols * Tile24Cols; // columns covered by whole tiles
+
+        utils::parallelFor(0, (long long)blocksM * blocksK, 1, [&](const long long begin, const long long end) {
+            for (long long t = begin; t < end; t++)
+            {
+                const int i0 = (t / blocksK) * Block24Rows;
+                const int i1 = std::min(M, i0 + Block24Rows);
+                const int j0 = (t % blocksK) * Block24Cols;
+                const int j1 = std::min(K, j0 + Block24Cols);
+                const int tileEnd = std::max(j0, std::min(j1, fullK));
+
+                for (int j = j0; j < tileEnd; j += Tile24Cols)
+                {
+                    for (int g0 = 0; g0 < groups; g0 += Block24Groups)
+                    {
+                        const int g1 = std::min(groups, g0 + Block24Groups);
+                        const bool accumulate = g0 > 0;
+
+                        int i = i0;
+                        for (; i + Tile24Rows <= i1; i += Tile24Rows)
+                        {
+                            __tile24<Tile24Rows>(A, i, g0, g1, B + j, K, C + (long long)i * K + j, K, accumulate);
+                        }
+                        switch (i1 - i)
+                        {
+                        case 3:
+                            __tile24<3>(A, i, g0, g1, B + j, K, C + (long long)i * K + j, K, accumulate);
+                            break;
+                        case 2:
+                            __tile24<2>(A, i, g0, g1, B + j, K, C + (long long)i * K + j, K, accumulate);
+                            break;
+                        case 1:
+                            __tile24<1>(A, i, g0, g1, B + j, K, C + (long long)i * K + j, K, accumulate);
+                            break;
+                        }
+                    }
+                }
+
+                if (tileEnd < j1)
+                {
+                    __edge24(A, i0, i1, tileEnd, j1, B, K, C);
+                }
+            }
+        });
+    }
+
+} // namespace gemm
@@ -0,0 +1,46 @@
+#ifndef __LAB1_GEMM_SPARSE24_H__
+#define __LAB1_GEMM_SPARSE24_H__
+
+namespace gemm
+{
+    // Matrix24 is a 2:4 structured sparse matrix A[M][N] (N a multiple of 4): every group of four consecutive
+    // elements of a row keeps two of them, stored as their values and their 2-bit positions in the group.
+    // The compressed matrix takes 17/32 of the dense bytes: 8.5 bytes instead of 16 for every group of four.
+    struct Matrix24
+    {
+        int M = 0;
+        int N = 0;
+        float *values = nullptr;          // [M][N / 2], the kept elements of group g at 2g and 2g + 1, in column order
+        unsigned char *indices = nullptr; // [M][indexStride], group g in the nibble g % 2 of byte g / 2:
+                                          // position of value 2g in bits 0-1, of value 2g + 1 in bits 2-3
+        int indexStride = 0;              // bytes per row, (N / 4 + 1) / 2, the unused high nibble of an odd
+                                          // group count is zero (compress24 clears it)
+    };
+
+    // compress24 keeps the two largest magnitudes of every group of four (the exact matrix when A is 2:4 sparse,
+    // magnitude pruning otherwise), release the result with freeMatrix24.
+    // input    : A[M][N]
+    // output   : compressed A
+    // throws std::invalid_argument when N is not a multiple of 4
+    Matrix24 compress24(const float *A, const int M, const int N);
+
+    // decompress24 writes the dense matrix, pruned elements are zero.
+    // input    : compressed A[M][N]
+    // output   : dense[M][N]
+    void decompress24(const Matrix24 &A, float *dense);
+
+    void freeMatrix24(Matrix24 &A);
+
+    // generalMatMul24 multiplies a 2:4 sparse matrix with a dense one, doing only the kept half of the products.
+    // C is computed in tiles of 4 rows x 4 SIMD vectors with AVX-512 (2 vectors with AVX2 or without SIMD)
+    // held in registers: for every kept element of a row its value is broadcast and multiplied with the one
+    // row of B it selects, so A is read in its compressed form and only the selected rows of B are loaded.
+    // Tiles of B stay in L1 across the rows of a block, blocks of C run in parallel. Any M and K.
+    // input    : A[M][N] compressed, B[N][K]
+    // function : C = A*B
+    // output   : C[M][K]
+    void generalMatMul24(const Matrix24 &A, const float *B, float *C, const int K);
+
+} // namespace gemm
+
+#endif // __LAB1_GEMM_SPARSE24_H__
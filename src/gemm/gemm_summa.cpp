@@ -0,0 +1,518 @@
+#include "gemm_summa.h"
+
+#include "gemm.h"        // generalMatMulOpt
+#include "gemm_thread.h" // parallelFor, numThreads, setNumThreads, pinCurrentThread
+#include "gemm_utils.h"  // allocMatrix, freeMatrix
+
+#include <algorithm>   // max, min, sort, unique
+#include <atomic>      // atomic
+#include <cerrno>      // errno, EINTR
+#include <climits>     // INT_MAX
+#include <cstdint>     // uint32_t, uint64_t
+#include <cstring>     // memcpy, strerror
+#include <new>         // placement new
+#include <stdexcept>   // invalid_argument, runtime_error
+
+#include <fcntl.h>    // O_CREAT, O_RDWR
+#include <signal.h>   // kill, SIGKILL
+#include <sys/mman.h> // mmap, munmap, shm_open, shm_unlink
+#include <sys/stat.h> // fstat
+#include <sys/wait.h> // waitpid
+#include <unistd.h>   // fork, _exit, ftruncate, close, getpid, usleep
+
+#if defined(__linux__)
+#include <linux/futex.h> // FUTEX_WAIT, FUTEX_WAKE
+#include <sys/syscall.h> // SYS_futex
+#endif
+
+namespace gemm
+{
+    // panels and the reduction bounds follow the blocks of generalMatMulOpt
+    const int SummaBlock = 64;
+
+    // polls of a counter before a process sleeps on it
+    const int SummaSpin = 256;
+
+    const uint32_t SummaMagic = 0x414d4d53; // "SMMA"
+
+    // Slot is the state of one panel buffer, it is shared by the processes of a grid row or column
+    struct alignas(utils::CacheLineSize) ShmSummaTransport::Slot
+    {
+        std::atomic<uint32_t> ready;   // step + 1 of the panel in the buffer, 0 = none yet
+        std::atomic<uint32_t> pending; // readers that have not released it
+    };
+
+    // Header starts the segment, it is followed by the slots [rows][2] (PanelRow) and [cols][2] (PanelCol),
+    // then the panel buffers in the same order
+    struct alignas(utils::CacheLineSize) ShmSummaTransport::Header
+    {
+        uint32_t magic;
+        int rows, cols;
+        uint64_t rowPanelFloats, colPanelFloats; // rounded up to whole cache lines
+        uint64_t bytes;
+    };
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free, "futex words");
+
+    // __waitFor returns once word == value
+    void __waitFor(std::atomic<uint32_t> &word, const uint32_t value)
+    {
+        for (int spin = 0;; spin++)
+        {
+            const uint32_t current = word.load(std::memory_order_acquire);
+            if (current == value)
+            {
+                return;
+            }
+            if (spin < SummaSpin)
+            {
+                continue;
+            }
+#if defined(__linux__)
+            syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAIT, current, nullptr, nullptr, 0); // shared, not FUTEX_PRIVATE
+#else
+            sched_yield();
+#endif
+        }
+    }
+
+    void __wakeAll(std::atomic<uint32_t> &word)
+    {
+#if defined(__linux__)
+        syscall(SYS_futex, (uint32_t *)&word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+#endif
+    }
+
+    uint64_t __cacheLines(const uint64_t floats)
+    {
+        const uint64_t perLine = utils::CacheLineSize / sizeof(float);
+        return (floats + perLine - 1) / perLine * perLine;
+    }
+
+    // __blockBounds splits n (a multiple of SummaBlock) into `parts` ranges of whole blocks
+    std::vector<int> __blockBounds(const int n, const int parts)
+    {
+        const long long blocks = n / SummaBlock;
+        std::vector<int> bounds(parts + 1);
+        for (int i = 0; i <= parts; i++)
+        {
+            bounds[i] = SummaBlock * (blocks * i / parts);
+        }
+        return bounds;
+    }
+
+    // __owner returns the range of bounds containing x
+    int __owner(const std::vector<int> &bounds, const int x)
+    {
+        return std::upper_bound(bounds.begin(), bounds.end(), x) - bounds.begin() - 1;
+    }
+
+    SummaLayout summaLayout(const int M, const int N, const int K, const int processes, const int panel)
+    {
+        for (const int d : {M, N, K})
+        {
+            if (d <= 0 || d % SummaBlock != 0)
+            {
+                throw std::invalid_argument("summaLayout: M, N and K must be positive multiples of 64");
+            }
+        }
+        if (processes < 1)
+        {
+            throw std::invalid_argument("summaLayout: at least one process is required");
+        }
+
+        SummaLayout layout;
+        layout.M = M;
+        layout.N = N;
+        layout.K = K;
+
+        layout.rows = 1;
+        for (int d = 1; d * d <= processes; d++)
+        {
+            if (processes % d == 0)
+            {
+                layout.rows = d;
+            }
+        }
+        layout.cols = processes / layout.rows;
+
+        layout.rowBounds = __blockBounds(M, layout.rows);
+        layout.colBounds = __blockBounds(K, layout.cols);
+        layout.aBounds = __blockBounds(N, layout.cols);
+        layout.bBounds = __blockBounds(N, layout.rows);
+
+        // every panel lies inside one A owner range and one B owner range
+        std::vector<int> cuts(layout.aBounds);
+        cuts.insert(cuts.end(), layout.bBounds.begin(), layout.bBounds.end());
+        std::sort(cuts.begin(), cuts.end());
+        cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+        const int width = std::max(SummaBlock, panel / SummaBlock * SummaBlock);
+        int maxWidth = 0;
+        for (size_t i = 0; i + 1 < cuts.size(); i++)
+        {
+            for (int p = cuts[i]; p < cuts[i + 1]; p += width)
+            {
+                layout.panels.push_back(p);
+                maxWidth = std::max(maxWidth, std::min(width, cuts[i + 1] - p));
+            }
+        }
+        layout.panels.push_back(N);
+
+        int maxRows = 0, maxCols = 0;
+        for (int r = 0; r < layout.rows; r++)
+        {
+            maxRows = std::max(maxRows, layout.rowBounds[r + 1] - layout.rowBounds[r]);
+        }
+        for (int c = 0; c < layout.cols; c++)
+        {
+            maxCols = std::max(maxCols, layout.colBounds[c + 1] - layout.colBounds[c]);
+        }
+        layout.rowPanelFloats = (size_t)maxRows * maxWidth;
+        layout.colPanelFloats = (size_t)maxWidth * maxCols;
+        return layout;
+    }
+
+    ShmSummaTransport::ShmSummaTransport(const std::string &name, const SummaLayout &layout) : name(name), owner(true), rank(0)
+    {
+        const uint64_t rowFloats = __cacheLines(layout.rowPanelFloats);
+        const uint64_t colFloats = __cacheLines(layout.colPanelFloats);
+        const uint64_t slots = 2ULL * (layout.rows + layout.cols);
+        bytes = sizeof(Header) + slots * sizeof(Slot) + 2ULL * (layout.rows * rowFloats + layout.cols * colFloats) * sizeof(float);
+
+        const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0)
+        {
+            throw std::runtime_error("ShmSummaTransport: cannot create " + name + ": " + std::strerror(errno));
+        }
+        if (ftruncate(fd, bytes) != 0 || (segment = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("ShmSummaTransport: cannot map " + name);
+        }
+        close(fd);
+
+        header = new (segment) Header(); // the rest of the segment is zero: no panel ready, no readers
+        header->rows = layout.rows;
+        header->cols = layout.cols;
+        header->rowPanelFloats = rowFloats;
+        header->colPanelFloats = colFloats;
+        header->bytes = bytes;
+        Slot *slot = (Slot *)(header + 1);
+        for (uint64_t i = 0; i < slots; i++)
+        {
+            new (slot + i) Slot{{0}, {0}};
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SummaMagic;
+    }
+
+    ShmSummaTransport::ShmSummaTransport(const std::string &name, const int rank) : name(name), owner(false), rank(rank)
+    {
+        const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0 || (uint64_t)info.st_size < sizeof(Header))
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            throw std::runtime_error("ShmSummaTransport: cannot open " + name);
+        }
+        bytes = info.st_size;
+        segment = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (segment == MAP_FAILED)
+        {
+            segment = nullptr;
+            throw std::runtime_error("ShmSummaTransport: cannot map " + name);
+        }
+
+        header = (Header *)segment;
+        if (header->magic != SummaMagic || header->bytes != bytes || rank < 0 || rank >= header->rows * header->cols)
+        {
+            munmap(segment, bytes);
+            segment = nullptr;
+            throw std::runtime_error("ShmSummaTransport: " + name + " is not a SUMMA segment for rank " + std::to_string(rank));
+        }
+    }
+
+    ShmSummaTransport::~ShmSummaTransport()
+    {
+        if (segment != nullptr)
+        {
+            munmap(segment, bytes);
+        }
+        if (owner)
+        {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    ShmSummaTransport::Slot *ShmSummaTransport::__slot(const PanelAxis axis, const int step)
+    {
+        Slot *slots = (Slot *)(header + 1);
+        if (axis == PanelRow)
+        {
+            return slots + 2 * (rank / header->cols) + step % 2;
+        }
+        return slots + 2 * header->rows + 2 * (rank % header->cols) + step % 2;
+    }
+
+    float *ShmSummaTransport::__panel(const PanelAxis axis, const int step)
+    {
+        float *panels = (float *)((Slot *)(header + 1) + 2 * (header->rows + header->cols));
+        if (axis == PanelRow)
+        {
+            return panels + (2 * (rank / header->cols) + step % 2) * header->rowPanelFloats;
+        }
+        panels += 2 * header->rows * header->rowPanelFloats;
+        return panels + (2 * (rank % header->cols) + step % 2) * header->colPanelFloats;
+    }
+
+    void ShmSummaTransport::Publish(const PanelAxis axis, const int step, const float *data, const int rows, const int width, const int stride)
+    {
+        const uint64_t capacity = (axis == PanelRow) ? header->rowPanelFloats : header->colPanelFloats;
+        if ((uint64_t)rows * width > capacity)
+        {
+            throw std::invalid_argument("ShmSummaTransport: panel larger than the layout");
+        }
+
+        Slot *slot = __slot(axis, step);
+        __waitFor(slot->pending, 0); // the readers of step - 2 are done with the buffer
+
+        float *panel = __panel(axis, step);
+        for (int i = 0; i < rows; i++)
+        {
+            std::memcpy(panel + (long long)i * width, data + (long long)i * stride, width * sizeof(float));
+        }
+
+        slot->pending.store((axis == PanelRow) ? header->cols : header->rows, std::memory_order_relaxed);
+        slot->ready.store(step + 1, std::memory_order_release);
+        __wakeAll(slot->ready);
+    }
+
+    const float *ShmSummaTransport::Receive(const PanelAxis axis, const int step)
+    {
+        __waitFor(__slot(axis, step)->ready, step + 1);
+        return __panel(axis, step);
+    }
+
+    void ShmSummaTransport::Release(const PanelAxis axis, const int step)
+    {
+        Slot *slot = __slot(axis, step);
+        if (slot->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            __wakeAll(slot->pending);
+        }
+    }
+
+    void summaWorker(const SummaLayout &layout, SummaTransport &transport, const int rank, const float *localA, const float *localB, float *localC)
+    {
+        const int r = rank / layout.cols;
+        const int c = rank % layout.cols;
+        const int rows = layout.rowBounds[r + 1] - layout.rowBounds[r];
+        const int cols = layout.colBounds[c + 1] - layout.colBounds[c];
+        const int aCols = layout.aBounds[c + 1] - layout.aBounds[c];
+        const int steps = layout.panels.size() - 1;
+
+        auto publish = [&](const int s) {
+            const int p0 = layout.panels[s];
+            const int width = layout.panels[s + 1] - p0;
+            if (__owner(layout.aBounds, p0) == c)
+            {
+                transport.Publish(PanelRow, s, localA + (p0 - layout.aBounds[c]), rows, width, aCols);
+            }
+            if (__owner(layout.bBounds, p0) == r)
+            {
+                transport.Publish(PanelCol, s, localB + (long long)(p0 - layout.bBounds[r]) * cols, width, cols, cols);
+            }
+        };
+
+        float *product = (rows > 0 && cols > 0 && steps > 1) ? utils::allocMatrix(rows, cols) : nullptr;
+
+        publish(0);
+        for (int s = 0; s < steps; s++)
+        {
+            if (s + 1 < steps)
+            {
+                publish(s + 1); // look-ahead: the next panels travel while this one is multiplied
+            }
+
+            const float *aPanel = transport.Receive(PanelRow, s);
+            const float *bPanel = transport.Receive(PanelCol, s);
+            const int width = layout.panels[s + 1] - layout.panels[s];
+
+            if (rows > 0 && cols > 0)
+            {
+                if (s == 0)
+                {
+                    generalMatMulOpt(aPanel, bPanel, localC, rows, width, cols);
+                }
+                else
+                {
+                    generalMatMulOpt(aPanel, bPanel, product, rows, width, cols);
+                    utils::parallelFor(0, rows, 16, [&](const long long begin, const long long end) {
+                        for (long long i = begin; i < end; i++)
+                        {
+                            float *dst = localC + i * cols;
+                            const float *src = product + i * cols;
+                            for (int j = 0; j < cols; j++)
+                            {
+                                dst[j] += src[j];
+                            }
+                        }
+                    });
+                }
+            }
+
+            transport.Release(PanelRow, s);
+            transport.Release(PanelCol, s);
+        }
+
+        if (product != nullptr)
+        {
+            utils::freeMatrix(product);
+        }
+    }
+
+    // __copyTile copies rows x cols floats between matrices of the given strides
+    void __copyTile(float *dst, const long long dstStride, const float *src, const long long srcStride, const int rows, const int cols)
+    {
+        for (int i = 0; i < rows; i++)
+        {
+            std::memcpy(dst + i * dstStride, src + i * srcStride, cols * sizeof(float));
+        }
+    }
+
+    // __summaProcess is the body of a forked worker, it returns the exit status
+    int __summaProcess(const SummaLayout &layout, const std::string &name, const int rank, const float *A, const float *B, float *result, const int threads, const bool pin)
+    {
+        try
+        {
+            if (pin)
+            {
+                utils::pinCurrentThread(rank * threads, threads); // the pool workers inherit the slice
+            }
+            utils::setNumThreads(threads);
+
+            ShmSummaTransport transport(name, rank);
+
+            const int r = rank / layout.cols;
+            const int c = rank % layout.cols;
+            const int rows = layout.rowBounds[r + 1] - layout.rowBounds[r];
+            const int cols = layout.colBounds[c + 1] - layout.colBounds[c];
+            const int aCols = layout.aBounds[c + 1] - layout.aBounds[c];
+            const int bRows = layout.bBounds[r + 1] - layout.bBounds[r];
+
+            // scatter: the process keeps private copies of its tiles
+            std::vector<float> localA((size_t)rows * aCols), localB((size_t)bRows * cols), localC((size_t)rows * cols);
+            __copyTile(localA.data(), aCols, A + (long long)layout.rowBounds[r] * layout.N + layout.aBounds[c], layout.N, rows, aCols);
+            __copyTile(localB.data(), cols, B + (long long)layout.bBounds[r] * layout.K + layout.colBounds[c], layout.K, bRows, cols);
+
+            summaWorker(layout, transport, rank, localA.data(), localB.data(), localC.data());
+
+            // gather
+            __copyTile(result + (long long)layout.rowBounds[r] * layout.K + layout.colBounds[c], layout.K, localC.data(), cols, rows, cols);
+            return 0;
+        }
+        catch (...)
+        {
+            return 1;
+        }
+    }
+
+    void generalMatMulSumma(const float *A, const float *B, float *C, const int M, const int N, const int K, const SummaOptions &options)
+    {
+        const SummaLayout layout = summaLayout(M, N, K, options.processes, options.panel);
+        const int processes = layout.rows * layout.cols;
+        const int threads = (options.threadsPerProcess > 0) ? options.threadsPerProcess : std::max(1, utils::numThreads() / processes);
+
+        // the workers write their C tiles into a shared anonymous mapping
+        const size_t resultBytes = (size_t)M * K * sizeof(float);
+        void *result = mmap(nullptr, resultBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (result == MAP_FAILED)
+        {
+            throw std::runtime_error("generalMatMulSumma: cannot map the result");
+        }
+
+        static std::atomic<int> sequence(0);
+        const std::string name = "/gemm_summa." + std::to_string(getpid()) + "." + std::to_string(sequence++);
+
+        std::vector<pid_t> workers;
+        bool failed = false;
+        try
+        {
+            ShmSummaTransport transport(name, layout);
+
+            for (int rank = 0; rank < processes; rank++)
+            {
+                const pid_t pid = fork();
+                if (pid == 0)
+                {
+                    _exit(__summaProcess(layout, name, rank, A, B, (float *)result, threads, options.pin));
+                }
+                if (pid < 0)
+                {
+                    failed = true;
+                    break;
+                }
+                workers.push_back(pid);
+            }
+
+            // a failed worker leaves the others waiting for its panels, so they are killed;
+            // only the workers are polled, other children of the caller are not reaped
+            std::vector<bool> done(workers.size(), false);
+            size_t running = workers.size();
+            if (failed)
+            {
+                for (const pid_t pid : workers)
+                {
+                    kill(pid, SIGKILL);
+                }
+            }
+            while (running > 0)
+            {
+                for (size_t i = 0; i < workers.size(); i++)
+                {
+                    int status = 0;
+                    if (done[i] || waitpid(workers[i], &status, WNOHANG) != workers[i])
+                    {
+                        continue;
+                    }
+                    done[i] = true;
+                    running--;
+                    if (!failed && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+                    {
+                        failed = true;
+                        for (const pid_t pid : workers)
+                        {
+                            kill(pid, SIGKILL);
+                        }
+                    }
+                }
+                if (running > 0)
+                {
+                    usleep(200);
+                }
+            }
+        }
+        catch (...)
+        {
+            munmap(result, resultBytes);
+            throw;
+        }
+
+        if (!failed)
+        {
+            std::memcpy(C, result, resultBytes);
+        }
+        munmap(result, resultBytes);
+        if (failed)
+        {
+            throw std::runtime_error("generalMatMulSumma: a worker process failed");
+        }
+    }
+
+} // namespace gemm
@@ -0,0 +1,117 @@
+#ifndef __LAB1_GEMM_SUMMA_H__
+#define __LAB1_GEMM_SUMMA_H__
+
+#include <cstddef> // size_t
+#include <string>  // string
+#include <vector>  // vector
+
+namespace gemm
+{
+    // SummaLayout is the 2D block distribution of C[M][K] = A[M][N] * B[N][K] over a rows x cols process grid,
+    // process (r, c) has rank r * cols + c. Every bound is a multiple of 64 (generalMatMulOpt blocks).
+    struct SummaLayout
+    {
+        int M, N, K;
+        int rows, cols;
+        std::vector<int> rowBounds; // rows of A and C owned by grid row r: [rowBounds[r], rowBounds[r + 1])
+        std::vector<int> colBounds; // columns of B and C owned by grid column c
+        std::vector<int> aBounds;   // columns of A (reduction dimension) owned by grid column c
+        std::vector<int> bBounds;   // rows of B (reduction dimension) owned by grid row r
+        std::vector<int> panels;    // reduction range of step s: [panels[s], panels[s + 1]), one A owner and one B owner each
+        size_t rowPanelFloats;      // largest A panel, broadcast along a grid row
+        size_t colPanelFloats;      // largest B panel, broadcast along a grid column
+    };
+
+    // summaLayout splits M, N and K (multiples of 64) over a near-square grid of `processes`,
+    // panels are at most `panel` wide (rounded down to a multiple of 64).
+    // throws std::invalid_argument on bad dimensions or counts
+    SummaLayout summaLayout(const int M, const int N, const int K, const int processes, const int panel);
+
+    enum PanelAxis
+    {
+        PanelRow, // A panel, from its owner to every process of the grid row
+        PanelCol, // B panel, from its owner to every process of the grid column
+    };
+
+    // SummaTransport moves the panels of one process, summaWorker only talks to the grid through it.
+    // Publish of step s + 1 may come before the Release of step s (look-ahead), a transport keeps
+    // at least two steps per axis in flight and lets Publish of step s wait until step s - 2 is released.
+    class SummaTransport
+    {
+    public:
+        virtual ~SummaTransport() {}
+
+        // Publish sends the rows x width block at data (row stride `stride`) as the panel of `step` on `axis`,
+        // called by the owner of the panel only
+        virtual void Publish(const PanelAxis axis, const int step, const float *data, const int rows, const int width, const int stride) = 0;
+
+        // Receive waits for the panel of `step` on `axis`, a dense rows x width matrix valid until Release
+        virtual const float *Receive(const PanelAxis axis, const int step) = 0;
+
+        virtual void Release(const PanelAxis axis, const int step) = 0;
+    };
+
+    // ShmSummaTransport exchanges panels through a POSIX shared memory segment with two panel buffers
+    // per grid row and column (double buffering), readiness and release are counters in the segment
+    // that processes wait on with futexes. The creator owns the segment name and unlinks it,
+    // the other processes attach by name and rank.
+    class ShmSummaTransport : public SummaTransport
+    {
+    private:
+        std::string name;
+        bool owner;
+        int rank;
+        void *segment = nullptr;
+        size_t bytes = 0;
+
+        struct Header;
+        struct Slot;
+        Header *header = nullptr;
+        Slot *__slot(const PanelAxis axis, const int step);
+        float *__panel(const PanelAxis axis, const int step);
+
+    public:
+        // Create makes the segment `name` ("/..." as for shm_open) sized for layout, throws std::runtime_error
+        ShmSummaTransport(const std::string &name, const SummaLayout &layout);
+
+        // Attach maps the existing segment `name` as process `rank`, throws std::runtime_error
+        ShmSummaTransport(const std::string &name, const int rank);
+
+        ~ShmSummaTransport();
+
+        ShmSummaTransport(const ShmSummaTransport &) = delete;
+        ShmSummaTransport &operator=(const ShmSummaTransport &) = delete;
+
+        void Publish(const PanelAxis axis, const int step, const float *data, const int rows, const int width, const int stride) override;
+        const float *Receive(const PanelAxis axis, const int step) override;
+        void Release(const PanelAxis axis, const int step) override;
+    };
+
+    // summaWorker runs the SUMMA steps of process `rank`: for every panel the owners publish their A columns
+    // along the grid row and B rows along the grid column (the next step is published before the current one
+    // is computed), then every process adds Apanel * Bpanel to its C tile with generalMatMulOpt.
+    // input    : tiles of rank, A[rowBounds][aBounds] and B[bBounds][colBounds], row-major and dense
+    // function : C tile = sum over panels of Apanel * Bpanel
+    // output   : C[rowBounds][colBounds] tile of rank
+    void summaWorker(const SummaLayout &layout, SummaTransport &transport, const int rank, const float *localA, const float *localB, float *localC);
+
+    struct SummaOptions
+    {
+        int processes = 4;         // worker processes, grid rows x cols with rows <= cols as close as possible
+        int panel = 256;           // width of the broadcast panels
+        int threadsPerProcess = 0; // gemm threads of every worker, 0 = numThreads() / processes (at least 1)
+        bool pin = false;          // confine worker p to its slice of the CPUs of the affinity mask
+    };
+
+    // generalMatMulSumma is the multi-process version of generalMatMulOpt: it forks options.processes workers,
+    // each copies its A and B tiles, runs summaWorker over a ShmSummaTransport and writes its C tile back
+    // through shared memory. M, N and K must be multiples of 64.
+    // input    : A[M][N], B[N][K]
+    // function : C = A*B
+    // output   : C[M][K]
+    // throws std::invalid_argument on bad dimensions, std::runtime_error when a worker fails
+    void generalMatMulSumma(const float *A, const float *B, float *C, const int M, const int N, const int K, const SummaOptions &options = SummaOptions());
+
+} // namespace gemm
+
+#endif // __LAB1_GEMM_SUMMA_H__
@@ -0,0 +1,374 @@
+#include "gemm_thread.h"
+
+#include "gemm_utils.h" // initPool
+
+#include <algorithm>          // max, min
+#include <atomic>             // atomic
+#include <condition_variable> // condition_variable
+#include <cstdlib>            // getenv, atoi
+#include <exception>          // exception_ptr, current_exception, rethrow_exception
+#include <mutex>              // mutex, unique_lock
+#include <new>                // placement new
+#include <thread>             // thread, hardware_concurrency
+#include <vector>             // vector
+
+#if defined(__linux__)
+#include <pthread.h> // pthread_setaffinity_np, pthread_atfork
+#include <sched.h>   // sched_getaffinity, cpu_set_t
+#endif
+
+namespace gemm::utils
+{
+    // __allowedCpus returns the CPUs of the process affinity mask, read once before any thread is pinned
+    const std::vector<int> &__allowedCpus()
+    {
+        static const std::vector<int> cpus = [] {
+            std::vector<int> list;
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            {
+                for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+                {
+                    if (CPU_ISSET(cpu, &set))
+                    {
+                        list.push_back(cpu);
+                    }
+                }
+            }
+#endif
+            return list;
+        }();
+        return cpus;
+    }
+
+    bool pinCurrentThread(const int index, const int count)
+    {
+        const std::vector<int> &cpus = __allowedCpus();
+        if (cpus.empty())
+        {
+            return false;
+        }
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int k = 0; k < std::max(1, std::min<int>(count, cpus.size())); k++)
+        {
+            CPU_SET(cpus[(index + k) % cpus.size()], &set);
+        }
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // ThreadPool keeps nthreads - 1 workers alive, the calling thread acts as worker 0.
+    class ThreadPool
+    {
+    private:
+        std::vector<std::thread> workers;
+
+        std::mutex mutex;
+        std::condition_variable wakeCond; // workers wait for a new generation
+        std::condition_variable doneCond; // caller waits for pending == 0
+
+        const std::function<void(const int, const int)> *task = nullptr;
+        std::exception_ptr error; // first exception thrown by a worker in the running region
+        unsigned long long generation = 0;
+        int pending = 0;
+        int nthreads = 1;
+        bool stopping = false;
+        bool pinned = false; // worker tid runs on CPU tid of the affinity mask
+
+        std::mutex runMutex; // one parallel region at a time
+
+        void workerLoop(const int tid, unsigned long long seen)
+        {
+            if (pinned)
+            {
+                pinCurrentThread(tid);
+            }
+
+            while (true)
+            {
+                const std::function<void(const int, const int)> *myTask = nullptr;
+                int myThreads = 0;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wakeCond.wait(lock, [&] { return stopping || generation != seen; });
+                    if (stopping)
+                    {
+                        return;
+                    }
+                    seen = generation;
+                    myTask = task;
+                    myThreads = nthreads;
+                }
+
+                std::exception_ptr myError;
+                insideTask = true;
+                try
+                {
+                    (*myTask)(tid, myThreads);
+                }
+                catch (...)
+                {
+                    myError = std::current_exception();
+                }
+                insideTask = false;
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (myError != nullptr && error == nullptr)
+                    {
+                        error = myError; // the caller rethrows the first one
+                    }
+                    pending--;
+                    if (pending == 0)
+                    {
+                        doneCond.notify_one();
+                    }
+                }
+            }
+        }
+
+        void start(const int n)
+        {
+            nthreads = std::max(1, n);
+            stopping = false;
+            for (int tid = 1; tid < nthreads; tid++)
+            {
+                workers.emplace_back(&ThreadPool::workerLoop, this, tid, generation);
+            }
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wakeCond.notify_all();
+            for (auto &t : workers)
+            {
+                t.join();
+            }
+            workers.clear();
+        }
+
+        // RegionGuard ends the parallel region of run: waits for the workers, then clears the region state
+        // and hands out the first exception of a worker
+        struct RegionGuard
+        {
+            ThreadPool &pool;
+            std::exception_ptr &workerError;
+
+            RegionGuard(ThreadPool &pool, std::exception_ptr &workerError) : pool(pool), workerError(workerError) {}
+
+            ~RegionGuard()
+            {
+                insideTask = false;
+                std::unique_lock<std::mutex> lock(pool.mutex);
+                pool.doneCond.wait(lock, [&] { return pool.pending == 0; });
+                pool.task = nullptr;
+                workerError = pool.error;
+                pool.error = nullptr;
+            }
+        };
+
+    public:
+        static thread_local bool insideTask;
+        static thread_local bool forkLockedRun; // beforeFork of this thread took runMutex
+
+        ThreadPool(const int n, const bool pin);
+
+        ~ThreadPool()
+        {
+            stop();
+        }
+
+        int size() const
+        {
+            return nthreads;
+        }
+
+        void resize(const int n)
+        {
+            std::lock_guard<std::mutex> run(runMutex);
+            stop();
+            start(n);
+        }
+
+        void setPinned(const bool pin)
+        {
+            std::lock_guard<std::mutex> run(runMutex);
+            stop();
+            pinned = pin;
+            start(nthreads);
+        }
+
+        // fork: the parent waits for the running parallel region, the child has none of the workers
+        // and restarts with one unpinned thread, setNumThreads creates new ones.
+        // A fork from inside a task cannot wait for its own region: the region keeps running in the parent,
+        // the child is a copy of the forking worker alone and must exec or _exit before the task returns.
+        void beforeFork()
+        {
+            forkLockedRun = !insideTask;
+            if (forkLockedRun)
+            {
+                runMutex.lock();
+            }
+        }
+
+        void afterForkParent()
+        {
+            if (forkLockedRun)
+            {
+                runMutex.unlock();
+            }
+        }
+
+        void afterForkChild()
+        {
+            insideTask = false; // the new pool of the child is free, its regions run on it
+            new (&workers) std::vector<std::thread>(); // the handles of the parent workers are abandoned, not joined
+            new (&mutex) std::mutex();
+            new (&wakeCond) std::condition_variable();
+            new (&doneCond) std::condition_variable();
+            new (&runMutex) std::mutex();
+            task = nullptr;
+            error = nullptr;
+            pending = 0;
+            nthreads = 1;
+            stopping = false;
+            pinned = false;
+        }
+
+        void run(const std::function<void(const int, const int)> &f)
+        {
+            if (insideTask || nthreads == 1)
+            {
+                f(0, 1); // nested region or single thread, run inline
+                return;
+            }
+
+            std::lock_guard<std::mutex> run(runMutex);
+            std::exception_ptr workerError;
+            {
+                // the workers use f until pending == 0: wait for them also when f throws in this thread
+                RegionGuard guard(*this, workerError);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    task = &f;
+                    error = nullptr;
+                    pending = nthreads - 1;
+                    generation++;
+                }
+                wakeCond.notify_all();
+
+                insideTask = true;
+                f(0, nthreads);
+            }
+
+            if (workerError != nullptr)
+            {
+                std::rethrow_exception(workerError);
+            }
+        }
+    };
+
+    thread_local bool ThreadPool::insideTask = false;
+    thread_local bool ThreadPool::forkLockedRun = false;
+
+    ThreadPool &globalThreadPool();
+
+    ThreadPool::ThreadPool(const int n, const bool pin)
+    {
+        pinned = pin;
+#if defined(__linux__)
+        // prepare handlers run in reverse order of registration: the allocator registers first, so a running
+        // region, whose tasks allocate, has finished before the allocator lock is taken
+        initPool();
+        pthread_atfork([] { globalThreadPool().beforeFork(); },
+                       [] { globalThreadPool().afterForkParent(); },
+                       [] { globalThreadPool().afterForkChild(); });
+#endif
+        start(n);
+    }
+
+    int defaultThreads()
+    {
+        const char *env = std::getenv("GEMM_NUM_THREADS");
+        if (env != nullptr && std::atoi(env) > 0)
+        {
+            return std::atoi(env);
+        }
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    bool defaultPinning()
+    {
+        const char *env = std::getenv("GEMM_PIN_THREADS");
+        return env != nullptr && std::atoi(env) == 1;
+    }
+
+    ThreadPool &globalThreadPool()
+    {
+        static ThreadPool pool(defaultThreads(), defaultPinning());
+        return pool;
+    }
+
+    int numThreads()
+    {
+        if (ThreadPool::insideTask)
+        {
+            return 1; // nested parallel regions run inline
+        }
+        return globalThreadPool().size();
+    }
+
+    void setNumThreads(const int n)
+    {
+        globalThreadPool().resize(n);
+    }
+
+    void setThreadPinning(const bool pin)
+    {
+        globalThreadPool().setPinned(pin);
+    }
+
+    void parallelRun(const std::function<void(const int tid, const int nthreads)> &task)
+    {
+        globalThreadPool().run(task);
+    }
+
+    void parallelFor(const long long begin, const long long end, const long long grain, const std::function<void(const long long chunkBegin, const long long chunkEnd)> &body)
+    {
+        if (end <= begin)
+        {
+            return;
+        }
+
+        const long long step = std::max(1LL, grain);
+        if (end - begin <= step)
+        {
+            body(begin, end);
+            return;
+        }
+
+        std::atomic<long long> next(begin);
+        parallelRun([&](const int, const int) {
+            while (true)
+            {
+                long long chunkBegin = next.fetch_add(step);
+                if (chunkBegin >= end)
+                {
+                    break;
+                }
+                body(chunkBegin, std::min(end, chunkBegin + step));
+            }
+        });
+    }
+
+} // namespace gemm::utils
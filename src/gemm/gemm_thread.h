@@ -0,0 +1,37 @@
+#ifndef __LAB1_GEMM_THREAD_H__
+#define __LAB1_GEMM_THREAD_H__
+
+#include <functional> // function
+
+namespace gemm::utils
+{
+    // numThreads returns the number of workers of the shared thread pool, 1 when called from inside a running task.
+    // default: environment variable GEMM_NUM_THREADS, otherwise hardware concurrency
+    int numThreads();
+
+    // setNumThreads resizes the shared thread pool, n < 1 is treated as 1.
+    // A child process created by fork starts with a pool of one unpinned thread.
+    void setNumThreads(const int n);
+
+    // setThreadPinning restarts the shared thread pool with worker tid pinned to CPU tid of the process affinity mask
+    // (modulo its size) or unpinned. Worker 0 is whichever thread calls parallelRun, pin it with pinCurrentThread(0).
+    // default: environment variable GEMM_PIN_THREADS=1, otherwise unpinned. Pinning is a no-op outside Linux.
+    void setThreadPinning(const bool pin);
+
+    // pinCurrentThread pins the calling thread to CPUs [index, index + count) of the process affinity mask
+    // (modulo its size), threads it creates afterwards inherit the set. Returns false when it is not supported or fails.
+    bool pinCurrentThread(const int index, const int count = 1);
+
+    // parallelRun calls task(tid, nthreads) once on every worker and waits for all of them.
+    // Calls from inside a running task are executed by the calling worker alone (tid = 0, nthreads = 1).
+    // An exception thrown by task is rethrown after every worker has finished, the one of the calling thread
+    // first, otherwise the first one of a worker; the others are dropped.
+    void parallelRun(const std::function<void(const int tid, const int nthreads)> &task);
+
+    // parallelFor splits [begin, end) into chunks of `grain` items which are handed out dynamically,
+    // body(chunkBegin, chunkEnd) is called for every chunk.
+    void parallelFor(const long long begin, const long long end, const long long grain, const std::function<void(const long long chunkBegin, const long long chunkEnd)> &body);
+
+} // namespace gemm::utils
+
+#endif // __LAB1_GEMM_THREAD_H__
@@ -1,9 +1,21 @@
 #include "gemm_utils.h"
 
-#include <cmath>    // fabs
-#include <cstdio>   // printf
-#include <iostream> // cout
-#include <random>   // default_random_engine, uniform_real_distribution
+#include <atomic>        // atomic
+#include <cmath>         // fabs
+#include <cstdint>       // uintptr_t
+#include <cstdio>        // printf
+#include <cstdlib>       // aligned_alloc, free
+#include <iostream>      // cout
+#include <mutex>         // mutex, lock_guard
+#include <new>           // bad_alloc, placement new
+#include <random>        // default_random_engine, uniform_real_distribution
+#include <unordered_map> // unordered_map
+#include <vector>        // vector
+
+#if defined(__linux__)
+#include <pthread.h>  // pthread_atfork
+#include <sys/mman.h> // mmap, munmap, madvise
+#endif
 
 namespace gemm::utils
 {
@@ -71,4 +83,245 @@ namespace gemm::utils
         return true;
     }
 
+    // -------------------------------------------------------------------------------------------------------------------------------------------------
+    // aligned allocator
+    // -------------------------------------------------------------------------------------------------------------------------------------------------
+
+    enum BlockKind
+    {
+        BlockHeap,        // aligned_alloc
+        BlockHugeTLB,     // mmap with explicit huge pages
+        BlockTransparent, // mmap with madvise(MADV_HUGEPAGE)
+    };
+
+    // BlockHeader lives in the first cache line of every block, the user buffer follows it.
+    struct BlockHeader
+    {
+        size_t classBytes; // size class, including the header
+        int kind;
+    };
+
+    static_assert(sizeof(BlockHeader) <= CacheLineSize, "BlockHeader must fit in one cache line");
+
+    struct BlockPool
+    {
+        std::mutex mutex;
+        std::unordered_map<size_t, std::vector<BlockHeader *>> freeBlocks; // size class -> free blocks
+        size_t pooledBytes = 0;
+        size_t limitBytes = size_t(1) << 30;
+        std::atomic<bool> hugeTLBAvailable{true}; // cleared on the first failed MAP_HUGETLB
+    };
+
+    BlockPool &globalPool();
+
+    // fork: the parent waits for the allocations in progress, the child is left with a fresh lock
+    void beforeForkPool()
+    {
+        globalPool().mutex.lock();
+    }
+
+    void afterForkParentPool()
+    {
+        globalPool().mutex.unlock();
+    }
+
+    void afterForkChildPool()
+    {
+        new (&globalPool().mutex) std::mutex(); // held by the parent thread that forked
+    }
+
+    BlockPool &globalPool()
+    {
+        static BlockPool *pool = [] {
+            BlockPool *created = new BlockPool(); // never destroyed, buffers may be freed during static destruction
+#if defined(__linux__)
+            pthread_atfork(beforeForkPool, afterForkParentPool, afterForkChildPool);
+#endif
+            return created;
+        }();
+        return *pool;
+    }
+
+    void initPool()
+    {
+        globalPool();
+    }
+
+    // small blocks round up to a power of two, huge blocks round up to a multiple of HugePageSize
+    size_t sizeClass(const size_t bytes)
+    {
+        size_t total = bytes + CacheLineSize;
+        if (total >= HugePageSize)
+        {
+            return (total + HugePageSize - 1) / HugePageSize * HugePageSize;
+        }
+
+        size_t classBytes = 4 * CacheLineSize;
+        while (classBytes < total)
+        {
+            classBytes <<= 1;
+        }
+        return classBytes;
+    }
+
+    BlockHeader *systemAlloc(BlockPool &pool, const size_t classBytes)
+    {
+#if defined(__linux__)
+        if (classBytes >= HugePageSize)
+        {
+            if (pool.hugeTLBAvailable)
+            {
+                void *p = mmap(nullptr, classBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    BlockHeader *header = static_cast<BlockHeader *>(p);
+                    header->kind = BlockHugeTLB;
+                    return header;
+                }
+                pool.hugeTLBAvailable = false;
+            }
+
+            // over-map by one huge page and trim, so the block starts at a 2 MiB boundary
+            size_t mapped = classBytes + HugePageSize;
+            void *p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                throw std::bad_alloc();
+            }
+
+            uintptr_t raw = reinterpret_cast<uintptr_t>(p);
+            uintptr_t aligned = (raw + HugePageSize - 1) / HugePageSize * HugePageSize;
+            if (aligned > raw)
+            {
+                munmap(p, aligned - raw);
+            }
+            if (raw + mapped > aligned + classBytes)
+            {
+                munmap(reinterpret_cast<void *>(aligned + classBytes), raw + mapped - aligned - classBytes);
+            }
+            madvise(reinterpret_cast<void *>(aligned), classBytes, MADV_HUGEPAGE);
+
+            BlockHeader *header = reinterpret_cast<BlockHeader *>(aligned);
+            header->kind = BlockTransparent;
+            return header;
+        }
+#endif
+
+#if defined(_WIN32) && defined(_MSC_VER)
+        void *p = _aligned_malloc(classBytes, CacheLineSize);
+#else
+        void *p = std::aligned_alloc(CacheLineSize, classBytes);
+#endif
+        if (p == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        BlockHeader *header = static_cast<BlockHeader *>(p);
+        header->kind = BlockHeap;
+        return header;
+    }
+
+    void systemFree(BlockHeader *header)
+    {
+#if defined(__linux__)
+        if (header->kind != BlockHeap)
+        {
+            munmap(header, header->classBytes);
+            return;
+        }
+#endif
+
+#if defined(_WIN32) && defined(_MSC_VER)
+        _aligned_free(header);
+#else
+        std::free(header);
+#endif
+    }
+
+    void *alignedAlloc(const size_t bytes)
+    {
+        BlockPool &pool = globalPool();
+        size_t classBytes = sizeClass(bytes);
+
+        BlockHeader *header = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+
+            auto it = pool.freeBlocks.find(classBytes);
+            if (it != pool.freeBlocks.end() && !it->second.empty())
+            {
+                header = it->second.back(); // reuse
+                it->second.pop_back();
+                pool.pooledBytes -= classBytes;
+            }
+        }
+
+        if (header == nullptr)
+        {
+            header = systemAlloc(pool, classBytes);
+            header->classBytes = classBytes;
+        }
+
+        return reinterpret_cast<char *>(header) + CacheLineSize;
+    }
+
+    void alignedFree(void *ptr)
+    {
+        if (ptr == nullptr)
+        {
+            return;
+        }
+
+        BlockPool &pool = globalPool();
+        BlockHeader *header = reinterpret_cast<BlockHeader *>(static_cast<char *>(ptr) - CacheLineSize);
+
+        {
+            std::lock_guard<std::mutex> lock(pool.mutex);
+
+            if (pool.pooledBytes + header->classBytes <= pool.limitBytes)
+            {
+                pool.freeBlocks[header->classBytes].push_back(header);
+                pool.pooledBytes += header->classBytes;
+                return;
+            }
+        }
+
+        systemFree(header);
+    }
+
+    void releasePool()
+    {
+        BlockPool &pool = globalPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+
+        for (auto &kv : pool.freeBlocks)
+        {
+            for (BlockHeader *header : kv.second)
+            {
+                systemFree(header);
+            }
+        }
+        pool.freeBlocks.clear();
+        pool.pooledBytes = 0;
+    }
+
+    void setPoolLimit(const size_t bytes)
+    {
+        BlockPool &pool = globalPool();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+
+        pool.limitBytes = bytes;
+    }
+
+    float *allocMatrix(const int M, const int N)
+    {
+        return allocArray<float>(size_t(M) * size_t(N));
+    }
+
+    void freeMatrix(float *matrix)
+    {
+        alignedFree(matrix);
+    }
+
 } // namespace gemm::utils
@@ -1,8 +1,16 @@
 #ifndef __LAB1_GEMM_UTILS_H__
 #define __LAB1_GEMM_UTILS_H__
 
+#include <cstddef> // size_t
+
 namespace gemm::utils
 {
+    // alignment of every buffer returned by the allocator, one cache line
+    constexpr size_t CacheLineSize = 64;
+
+    // buffers not smaller than HugePageSize are backed by 2 MiB huge pages when possible
+    constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
     void printMatrix(const float *matrix, const int M, const int N, const int pretty = 8);
 
     void randomFillMatrix(float *matrix, const int M, const int N, const float a = 0.0, const float b = 1.0);
@@ -11,6 +19,36 @@ namespace gemm::utils
 
     bool checkSameMatrix(const float *expected, const float *got, const int M, const int N);
 
+    // alignedAlloc returns a CacheLineSize aligned buffer of at least `bytes` bytes.
+    // Large buffers request explicit (hugetlbfs) or transparent 2 MiB huge pages.
+    // Freed buffers are kept in a pool and handed out again for the same size class.
+    void *alignedAlloc(const size_t bytes);
+
+    // alignedFree returns a buffer from alignedAlloc to the pool, nullptr is ignored.
+    void alignedFree(void *ptr);
+
+    // initPool creates the pool. Its lock is held across fork, so the child inherits the pooled buffers
+    // in a consistent state; the thread pool calls initPool before it registers its own fork handlers.
+    void initPool();
+
+    // releasePool gives every pooled buffer back to the operating system.
+    void releasePool();
+
+    // setPoolLimit sets the maximum bytes kept in the pool, default 1 GiB.
+    void setPoolLimit(const size_t bytes);
+
+    // allocMatrix returns an aligned buffer for matrix[M][N], release it with freeMatrix.
+    float *allocMatrix(const int M, const int N);
+
+    void freeMatrix(float *matrix);
+
+    // allocArray is the typed version of alignedAlloc for trivially copyable T, release it with alignedFree.
+    template <typename T>
+    T *allocArray(const size_t n)
+    {
+        return static_cast<T *>(alignedAlloc(n * sizeof(T)));
+    }
+
 } // namespace gemm::utils
 
-#endif // __LAB1_GEMM_UTILS_H__
\ No newline at end of file
+#endif // __LAB1_GEMM_UTILS_H__
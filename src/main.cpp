@@ -1,13 +1,41 @@
-#include "gemm.h"       // gemm namespace
-#include "gemm_utils.h" // randomFillMatrix, printMatrix
-#include "sparseCSR.h"  // sparse namespace
-#include "use_timer.h"  // ABTMS, ABTME
+#include "gemm.h"             // gemm namespace
+#include "gemm_service.h"     // GemmServer, GemmClient
+#include "gemm_summa.h"       // generalMatMulSumma
+#include "gemm_thread.h"      // parallelRun, numThreads, setNumThreads
+#include "gemm_utils.h"       // randomFillMatrix, printMatrix, allocMatrix
+#include "sparseBSR.h"        // SparseBSR
+#include "sparseCSR.h"        // sparse namespace
+#include "sparseDispatch.h"   // MulWith, MulWithDense
+#include "sparseDynamic.h"    // DynamicSparseCSR
+#include "sparseExpr.h"       // operator+, operator-, operator*
+#include "sparseGenerators.h" // GenerateUniform, GenerateRMAT
+#include "sparseIO.h"         // SaveBinary, LoadBinary
+#include "sparseKernels.h"    // SpMV, SpMM, SDDMM
+#include "sparseMasked.h"     // MaskedMul
+#include "sparseReorder.h"    // Reorder
+#include "sparseSELL.h"       // SparseSELL
+#include "sparseSolver.h"     // SparseSolver
+#include "use_timer.h"        // ABTMS, ABTME
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>      // open, O_TMPFILE
+#include <sys/mman.h>   // memfd_create
+#include <sys/socket.h> // socket, sendmsg, recv, SCM_RIGHTS
+#include <sys/un.h>     // sockaddr_un
+#include <unistd.h>     // close, ftruncate
+
 void printSplitLine()
 {
     std::printf("================================================================================================\n");
@@ -44,11 +72,11 @@ void TestGemm()
     std::printf("general matrix multiplication: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
     printSplitLine();
 
-    float *A = new float[M * N];
-    float *B = new float[N * K];
-    float *CTrival = new float[M * K];
-    float *COpt = new float[M * K];
-    float *CStrassen = new float[M * K];
+    float *A = gemm::utils::allocMatrix(M, N);
+    float *B = gemm::utils::allocMatrix(N, K);
+    float *CTrival = gemm::utils::allocMatrix(M, K);
+    float *COpt = gemm::utils::allocMatrix(M, K);
+    float *CStrassen = gemm::utils::allocMatrix(M, K);
 
     gemm::utils::randomFillMatrix(A, M, N);
     gemm::utils::randomFillMatrix(B, N, K);
@@ -84,11 +112,1171 @@ void TestGemm()
     gemm::utils::printMatrix(CTrival, M, K);
     printSplitLine();
 
-    delete[] A;
-    delete[] B;
-    delete[] CTrival;
-    delete[] COpt;
-    delete[] CStrassen;
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(CTrival);
+    gemm::utils::freeMatrix(COpt);
+    gemm::utils::freeMatrix(CStrassen);
+
+    printMessageLine("done");
+}
+
+void TestGemmSyrk()
+{
+    int M = 1024;
+    int N = 1024;
+
+    printSplitLine();
+    std::printf("symmetric rank-k update: A[%d][%d] * A^T[%d][%d] = C[%d][%d]\n", M, N, N, M, M, M);
+    printSplitLine();
+
+    float *A = gemm::utils::allocMatrix(M, N);
+    float *AT = gemm::utils::allocMatrix(N, M);
+    float *COpt = gemm::utils::allocMatrix(M, M);
+    float *CSyrk = gemm::utils::allocMatrix(M, M);
+
+    gemm::utils::randomFillMatrix(A, M, N);
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("transpose + generalMatMulOpt");
+    for (int i = 0; i < M; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            AT[j * M + i] = A[i * N + j];
+        }
+    }
+    gemm::generalMatMulOpt(A, AT, COpt, M, N, M);
+    ABTME("transpose + generalMatMulOpt");
+
+    ABTMS("generalMatSyrk");
+    gemm::generalMatSyrk(A, CSyrk, M, N, gemm::Lower, true);
+    ABTME("generalMatSyrk");
+    if (false == gemm::utils::checkSameMatrix(COpt, CSyrk, M, M))
+    {
+        printMessageLine("Wrong Answer: generalMatSyrk check failed");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(AT);
+    gemm::utils::freeMatrix(COpt);
+    gemm::utils::freeMatrix(CSyrk);
+
+    printMessageLine("done");
+}
+
+void TestGemmSplitK()
+{
+    int M = 64;
+    int N = 4096;
+    int K = 64;
+
+    printSplitLine();
+    std::printf("split-K general matrix multiplication: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    float *A = gemm::utils::allocMatrix(M, N);
+    float *B = gemm::utils::allocMatrix(N, K);
+    float *CTrival = gemm::utils::allocMatrix(M, K);
+    float *CSplit = gemm::utils::allocMatrix(M, K);
+
+    gemm::utils::randomFillMatrix(A, M, N);
+    gemm::utils::randomFillMatrix(B, N, K);
+    gemm::generalMatMulTrival(A, B, CTrival, M, N, K);
+
+    // one C block: generalMatMulOpt splits N as soon as there is more than one thread
+    const int threads = gemm::utils::numThreads();
+    gemm::utils::setNumThreads(std::max(threads, 4));
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("generalMatMulOpt");
+    gemm::generalMatMulOpt(A, B, CSplit, M, N, K);
+    ABTME("generalMatMulOpt");
+    if (false == gemm::utils::checkSameMatrix(CTrival, CSplit, M, K))
+    {
+        printMessageLine("Wrong Answer: generalMatMulOpt split-K check failed");
+    }
+
+    // 7 slices of the 64 blocks of N, the slices differ in size
+    ABTMS("generalMatMulSplitK");
+    gemm::generalMatMulSplitK(A, B, CSplit, M, N, K, 7);
+    ABTME("generalMatMulSplitK");
+    if (false == gemm::utils::checkSameMatrix(CTrival, CSplit, M, K))
+    {
+        printMessageLine("Wrong Answer: generalMatMulSplitK check failed");
+    }
+
+    gemm::utils::setNumThreads(threads);
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(CTrival);
+    gemm::utils::freeMatrix(CSplit);
+
+    printMessageLine("done");
+}
+
+void TestGemmSumma()
+{
+    int M = 256;
+    int N = 320;
+    int K = 192;
+
+    printSplitLine();
+    std::printf("multi-process SUMMA: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    float *A = gemm::utils::allocMatrix(M, N);
+    float *B = gemm::utils::allocMatrix(N, K);
+    float *CTrival = gemm::utils::allocMatrix(M, K);
+    float *CSumma = gemm::utils::allocMatrix(M, K);
+
+    gemm::utils::randomFillMatrix(A, M, N);
+    gemm::utils::randomFillMatrix(B, N, K);
+    gemm::generalMatMulTrival(A, B, CTrival, M, N, K);
+
+    printMessageLine("Used Real Time");
+
+    // 2 x 2 grid, the last panel is narrower than the others
+    gemm::SummaOptions options;
+    options.processes = 4;
+    options.panel = 128;
+
+    ABTMS("generalMatMulSumma");
+    gemm::generalMatMulSumma(A, B, CSumma, M, N, K, options);
+    ABTME("generalMatMulSumma");
+    if (false == gemm::utils::checkSameMatrix(CTrival, CSumma, M, K))
+    {
+        printMessageLine("Wrong Answer: generalMatMulSumma check failed");
+    }
+
+    // the workers are forked from inside a task of the thread pool
+    std::fill_n(CSumma, M * K, 0.0f);
+    gemm::utils::parallelRun([&](const int tid, const int) {
+        if (tid == 0)
+        {
+            gemm::generalMatMulSumma(A, B, CSumma, M, N, K, options);
+        }
+    });
+    if (false == gemm::utils::checkSameMatrix(CTrival, CSumma, M, K))
+    {
+        printMessageLine("Wrong Answer: generalMatMulSumma inside a parallel region check failed");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(CTrival);
+    gemm::utils::freeMatrix(CSumma);
+
+    printMessageLine("done");
+}
+
+// cooToDense sums the entries into a zeroed matrix[M][N], the dense reference of the CSR built from them
+float *cooToDense(const std::vector<sparse::ElementCOO> &array, const int M, const int N)
+{
+    float *dense = gemm::utils::allocMatrix(M, N);
+    std::fill_n(dense, M * N, 0.0f);
+    for (const sparse::ElementCOO &e : array)
+    {
+        dense[e.row * N + e.col] += e.val;
+    }
+    return dense;
+}
+
+// checkSparse compares the CSR matrix with the dense one and prints a message when they differ
+void checkSparse(const float *expected, const sparse::SparseCSR &got, const std::string &name)
+{
+    bool same = true;
+    const int *rowStart = got.RowStart();
+    for (int i = 0; i < got.Rows() && same; i++)
+    {
+        for (int k = rowStart[i] + 1; k < rowStart[i + 1]; k++)
+        {
+            same = same && got.ColIdx()[k - 1] < got.ColIdx()[k]; // sorted, no duplicates
+        }
+    }
+    if (same == false || rowStart[0] != 0 || rowStart[got.Rows()] != got.Nnz())
+    {
+        printMessageLine("Wrong Answer: " + name + " is not a valid CSR matrix");
+        return;
+    }
+
+    float *dense = cooToDense(got.ToCOO(), got.Rows(), got.Cols());
+    if (false == gemm::utils::checkSameMatrix(expected, dense, got.Rows(), got.Cols()))
+    {
+        printMessageLine("Wrong Answer: " + name + " check failed");
+    }
+    gemm::utils::freeMatrix(dense);
+}
+
+// raggedRows returns the entries of a matrix[M][N] whose row i holds i % (maxRow + 1) entries at spread columns,
+// so every remainder of the row lengths modulo the SIMD width occurs
+std::vector<sparse::ElementCOO> raggedRows(const int M, const int N, const int maxRow)
+{
+    std::vector<sparse::ElementCOO> array;
+    for (int i = 0; i < M; i++)
+    {
+        const int length = std::min(i % (maxRow + 1), N);
+        for (int k = 0; k < length; k++)
+        {
+            array.push_back(sparse::ElementCOO{i, (int)((i * 7 + (long long)k * N / length) % N), 0.5f + (i + k) % 7 * 0.25f});
+        }
+    }
+    return array;
+}
+
+void TestSparseMul()
+{
+    int M = 300;
+    int N = 200;
+    int K = 250;
+
+    printSplitLine();
+    std::printf("sparse matrix multiplication: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    std::vector<sparse::ElementCOO> arrayB = sparse::GenerateUniform(N, K, 8, 2);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sB(N, K, arrayB.size(), arrayB.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *B = cooToDense(arrayB, N, K);
+    float *AB = gemm::utils::allocMatrix(M, K);
+    gemm::generalMatMulTrival(A, B, AB, M, N, K);
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SparseCSR Mul");
+    sparse::SparseCSR sAB = sA.Mul(sB);
+    ABTME("SparseCSR Mul");
+    checkSparse(AB, sAB, "Mul");
+
+    // long rows go to the dense accumulator
+    std::vector<sparse::ElementCOO> arrayD = sparse::GenerateUniform(N, 64, 32, 3);
+    sparse::SparseCSR sD(N, 64, arrayD.size(), arrayD.data());
+    float *D = cooToDense(arrayD, N, 64);
+    float *AD = gemm::utils::allocMatrix(M, 64);
+    gemm::generalMatMulTrival(A, D, AD, M, N, 64);
+    checkSparse(AD, sA.Mul(sD), "Mul with dense accumulator rows");
+
+    bool thrown = false;
+    try
+    {
+        sA.Mul(sA);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    if (thrown == false)
+    {
+        printMessageLine("Wrong Answer: Mul accepted mismatched shapes");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(AB);
+    gemm::utils::freeMatrix(D);
+    gemm::utils::freeMatrix(AD);
+
+    printMessageLine("done");
+}
+
+void TestSparseKernels()
+{
+    int M = 300;
+    int N = 200;
+    int K = 37;
+
+    printSplitLine();
+    std::printf("sparse times dense: A[%d][%d] * x[%d], A[%d][%d] * B[%d][%d]\n", M, N, N, M, N, N, K);
+    printSplitLine();
+
+    // row lengths 0 to 40 cover the gather tails of AVX2 and AVX-512, K is not a multiple of the vector width either
+    std::vector<sparse::ElementCOO> arrayA = raggedRows(M, N, 40);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    float *A = cooToDense(arrayA, M, N);
+
+    const int bStride = K + 3;
+    const int cStride = K + 5;
+    float *x = gemm::utils::allocMatrix(N, 1);
+    float *y = gemm::utils::allocMatrix(M, 1);
+    float *yExpected = gemm::utils::allocMatrix(M, 1);
+    float *B = gemm::utils::allocMatrix(N, bStride);
+    float *C = gemm::utils::allocMatrix(M, cStride);
+    float *BDense = gemm::utils::allocMatrix(N, K);
+    float *CDense = gemm::utils::allocMatrix(M, K);
+    float *CExpected = gemm::utils::allocMatrix(M, K);
+    gemm::utils::randomFillMatrix(x, N, 1);
+    gemm::utils::randomFillMatrix(y, M, 1);
+    gemm::utils::randomFillMatrix(B, N, bStride);
+    gemm::utils::randomFillMatrix(C, M, cStride);
+
+    // alpha * A * x + beta * y with alpha = 1.5, beta = 0.5
+    gemm::generalMatMulTrival(A, x, yExpected, M, N, 1);
+    for (int i = 0; i < M; i++)
+    {
+        yExpected[i] = 1.5f * yExpected[i] + 0.5f * y[i];
+    }
+    for (int i = 0; i < N; i++)
+    {
+        std::copy_n(B + i * bStride, K, BDense + i * K);
+    }
+    gemm::generalMatMulTrival(A, BDense, CExpected, M, N, K);
+    for (int i = 0; i < M; i++)
+    {
+        for (int j = 0; j < K; j++)
+        {
+            CExpected[i * K + j] = 1.5f * CExpected[i * K + j] + 0.5f * C[i * cStride + j];
+        }
+    }
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SpMV");
+    sparse::SpMV(sA, x, y, 1.5f, 0.5f);
+    ABTME("SpMV");
+    if (false == gemm::utils::checkSameMatrix(yExpected, y, M, 1))
+    {
+        printMessageLine("Wrong Answer: SpMV check failed");
+    }
+
+    ABTMS("SpMM");
+    sparse::SpMM(sA, B, C, K, bStride, cStride, 1.5f, 0.5f);
+    ABTME("SpMM");
+    for (int i = 0; i < M; i++)
+    {
+        std::copy_n(C + i * cStride, K, CDense + i * K);
+    }
+    if (false == gemm::utils::checkSameMatrix(CExpected, CDense, M, K))
+    {
+        printMessageLine("Wrong Answer: SpMM check failed");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(x);
+    gemm::utils::freeMatrix(y);
+    gemm::utils::freeMatrix(yExpected);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(C);
+    gemm::utils::freeMatrix(BDense);
+    gemm::utils::freeMatrix(CDense);
+    gemm::utils::freeMatrix(CExpected);
+
+    printMessageLine("done");
+}
+
+void TestSparseFormats()
+{
+    int M = 151;
+    int N = 103;
+    int K = 130;
+
+    printSplitLine();
+    std::printf("SELL-C-sigma and BSR formats: A[%d][%d] * x[%d], A[%d][%d] * B[%d][%d]\n", M, N, N, M, N, N, K);
+    printSplitLine();
+
+    // M is not a multiple of C, the last chunk has padding rows; row lengths 0 to 40 pad the chunks unevenly
+    std::vector<sparse::ElementCOO> arrayA = raggedRows(M, N, 40);
+    std::vector<sparse::ElementCOO> arrayB = sparse::GenerateUniform(N, K, 6, 2);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sB(N, K, arrayB.size(), arrayB.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *B = cooToDense(arrayB, N, K);
+    float *AB = gemm::utils::allocMatrix(M, K);
+    float *x = gemm::utils::allocMatrix(N, 1);
+    float *y = gemm::utils::allocMatrix(M, 1);
+    float *y0 = gemm::utils::allocMatrix(M, 1);
+    float *yExpected = gemm::utils::allocMatrix(M, 1);
+    gemm::generalMatMulTrival(A, B, AB, M, N, K);
+    gemm::utils::randomFillMatrix(x, N, 1);
+    gemm::utils::randomFillMatrix(y0, M, 1);
+    gemm::generalMatMulTrival(A, x, yExpected, M, N, 1);
+    for (int i = 0; i < M; i++)
+    {
+        yExpected[i] = 1.5f * yExpected[i] + 0.5f * y0[i];
+    }
+
+    printMessageLine("Used Real Time");
+
+    // the SIMD chunk height and one without SIMD kernel
+    for (int C : {sparse::SparseSELL::DefaultC(), 3})
+    {
+        const std::string name = "SparseSELL C = " + std::to_string(C);
+
+        ABTMS(name.c_str());
+        sparse::SparseSELL sell(sA, C, 32);
+        ABTME(name.c_str());
+        checkSparse(A, sell.ToCSR(), name + " ToCSR");
+
+        std::copy_n(y0, M, y);
+        sell.SpMV(x, y, 1.5f, 0.5f);
+        if (false == gemm::utils::checkSameMatrix(yExpected, y, M, 1))
+        {
+            printMessageLine("Wrong Answer: " + name + " SpMV check failed");
+        }
+    }
+
+    // no dimension is a multiple of D: the edge blocks are partial
+    for (int D : {4, 5})
+    {
+        const std::string name = "SparseBSR D = " + std::to_string(D);
+
+        ABTMS(name.c_str());
+        sparse::SparseBSR bsrA(sA, D);
+        sparse::SparseBSR bsrB(sB, D);
+        ABTME(name.c_str());
+        checkSparse(A, bsrA.ToCSR(), name + " ToCSR");
+
+        std::copy_n(y0, M, y);
+        bsrA.SpMV(x, y, 1.5f, 0.5f);
+        if (false == gemm::utils::checkSameMatrix(yExpected, y, M, 1))
+        {
+            printMessageLine("Wrong Answer: " + name + " SpMV check failed");
+        }
+
+        checkSparse(AB, bsrA.Mul(bsrB).ToCSR(), name + " Mul");
+    }
+
+    bool thrown = false;
+    try
+    {
+        sparse::SparseBSR(sA, 4).Mul(sparse::SparseBSR(sB, 5));
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    if (thrown == false)
+    {
+        printMessageLine("Wrong Answer: SparseBSR Mul accepted different block sizes");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(AB);
+    gemm::utils::freeMatrix(x);
+    gemm::utils::freeMatrix(y);
+    gemm::utils::freeMatrix(y0);
+    gemm::utils::freeMatrix(yExpected);
+
+    printMessageLine("done");
+}
+
+void TestSparseCOO()
+{
+    int M = 300;
+    int N = 200;
+
+    printSplitLine();
+    std::printf("sparse matrix construction from COO: A[%d][%d]\n", M, N);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+
+    // every entry of A twice, in reverse order: the constructor sorts and sums the duplicates
+    std::vector<sparse::ElementCOO> arrayDup(arrayA.rbegin(), arrayA.rend());
+    arrayDup.insert(arrayDup.end(), arrayA.begin(), arrayA.end());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *ADup = cooToDense(arrayDup, M, N);
+    float *AT = gemm::utils::allocMatrix(N, M);
+    for (int i = 0; i < M; i++)
+    {
+        for (int j = 0; j < N; j++)
+        {
+            AT[j * M + i] = A[i * N + j];
+        }
+    }
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SparseCSR from COO");
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sDup(M, N, arrayDup.size(), arrayDup.data());
+    ABTME("SparseCSR from COO");
+    checkSparse(A, sA, "SparseCSR from COO");
+    checkSparse(ADup, sDup, "SparseCSR from COO with duplicates");
+
+    ABTMS("SparseCSR Transpose");
+    sparse::SparseCSR sAT = sA.Transpose();
+    ABTME("SparseCSR Transpose");
+    checkSparse(AT, sAT, "Transpose");
+
+    // sorted input skips the radix sort
+    std::vector<sparse::ElementCOO> sorted = sA.ToCOO();
+    checkSparse(A, sparse::SparseCSR(M, N, sorted.size(), sorted.data(), true), "SparseCSR from sorted COO");
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(ADup);
+    gemm::utils::freeMatrix(AT);
+
+    printMessageLine("done");
+}
+
+void TestSparseBinary()
+{
+    int M = 300;
+    int N = 200;
+
+    printSplitLine();
+    std::printf("binary CSR file round trip: A[%d][%d]\n", M, N);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    float *A = cooToDense(arrayA, M, N);
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SaveBinary + LoadBinary");
+    const std::string path = "sparse_check.bin";
+    sparse::SaveBinary(sA, path);
+    sparse::SparseCSR sLoaded = sparse::LoadBinary(path);
+    ABTME("SaveBinary + LoadBinary");
+    checkSparse(A, sLoaded, "SaveBinary + LoadBinary");
+    std::remove(path.c_str());
+
+    gemm::utils::freeMatrix(A);
+
+    printMessageLine("done");
+}
+
+void TestSparseCombination()
+{
+    int M = 300;
+    int N = 200;
+
+    printSplitLine();
+    std::printf("sparse linear combinations: A[%d][%d]\n", M, N);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    std::vector<sparse::ElementCOO> arrayC = sparse::GenerateUniform(M, N, 16, 3);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sC(M, N, arrayC.size(), arrayC.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *C = cooToDense(arrayC, M, N);
+    float *ApC = gemm::utils::allocMatrix(M, N);
+    float *AmC = gemm::utils::allocMatrix(M, N);
+    float *expr = gemm::utils::allocMatrix(M, N);
+    gemm::generalMatAdd(A, C, ApC, M, N);
+    gemm::generalMatSub(A, C, AmC, M, N);
+    for (int i = 0; i < M * N; i++)
+    {
+        expr[i] = A[i] + C[i] - 2.0f * A[i];
+    }
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SparseCSR Add, Sub");
+    sparse::SparseCSR sApC = sA.Add(sC);
+    sparse::SparseCSR sAmC = sA.Sub(sC);
+    ABTME("SparseCSR Add, Sub");
+    checkSparse(ApC, sApC, "Add");
+    checkSparse(AmC, sAmC, "Sub");
+
+    ABTMS("SparseCSR A + C - 2 * A");
+    sparse::SparseCSR sExpr = sA + sC - 2.0f * sA;
+    ABTME("SparseCSR A + C - 2 * A");
+    checkSparse(expr, sExpr, "A + C - 2 * A");
+
+    // temporaries are kept by the expression
+    auto lazy = sA.Transpose().Transpose() + sC - 2.0f * sparse::SparseCSR(sA);
+    checkSparse(expr, lazy.Eval(), "A + C - 2 * A over temporaries");
+
+    // 3 terms take the k-way merge, 12 the row accumulator
+    for (int n : {3, 12})
+    {
+        std::vector<std::vector<sparse::ElementCOO>> arrays;
+        std::vector<sparse::SparseCSR> terms;
+        std::vector<const sparse::SparseCSR *> pointers;
+        std::vector<float> alpha;
+        float *expected = gemm::utils::allocMatrix(M, N);
+        std::fill_n(expected, M * N, 0.0f);
+        for (int k = 0; k < n; k++)
+        {
+            arrays.push_back(sparse::GenerateUniform(M, N, 4, 10 + k));
+            terms.emplace_back(M, N, arrays[k].size(), arrays[k].data());
+            alpha.push_back(0.5f * k - 1.0f);
+            for (const sparse::ElementCOO &e : arrays[k])
+            {
+                expected[e.row * N + e.col] += alpha[k] * e.val;
+            }
+        }
+        for (const sparse::SparseCSR &term : terms)
+        {
+            pointers.push_back(&term);
+        }
+
+        checkSparse(expected, sparse::SparseCSR::LinearCombination(pointers.data(), alpha.data(), n), "LinearCombination of " + std::to_string(n));
+        gemm::utils::freeMatrix(expected);
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(C);
+    gemm::utils::freeMatrix(ApC);
+    gemm::utils::freeMatrix(AmC);
+    gemm::utils::freeMatrix(expr);
+
+    printMessageLine("done");
+}
+
+void TestSparseMulTrans()
+{
+    int M = 300;
+    int N = 200;
+    int K = 250;
+
+    printSplitLine();
+    std::printf("transposed sparse multiplication: op(A)[%d][%d] * op(B)[%d][%d]\n", M, N, N, K);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    std::vector<sparse::ElementCOO> arrayB = sparse::GenerateUniform(N, K, 8, 2);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sB(N, K, arrayB.size(), arrayB.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *B = cooToDense(arrayB, N, K);
+    float *AB = gemm::utils::allocMatrix(M, K);
+    gemm::generalMatMulTrival(A, B, AB, M, N, K);
+
+    // op(X) * op(Y) == A * B for every MulTrans, the transposed operands are stored transposed
+    sparse::SparseCSR sAT = sA.Transpose();
+    sparse::SparseCSR sBT = sB.Transpose();
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("SparseCSR Mul MulTT");
+    sparse::SparseCSR sTT = sAT.Mul(sBT, sparse::MulTT);
+    ABTME("SparseCSR Mul MulTT");
+    checkSparse(AB, sA.Mul(sB, sparse::MulNN), "Mul MulNN");
+    checkSparse(AB, sAT.Mul(sB, sparse::MulTN), "Mul MulTN");
+    checkSparse(AB, sA.Mul(sBT, sparse::MulNT), "Mul MulNT");
+    checkSparse(AB, sTT, "Mul MulTT");
+
+    // views passed by the caller
+    sparse::SparseCSR::CSCView viewAT(sAT);
+    sparse::SparseCSR::CSCView viewBT(sBT);
+    checkSparse(AB, sAT.Mul(sBT, sparse::MulTT, &viewAT, &viewBT), "Mul MulTT with views");
+
+    // a view follows the storage of its matrix: moved along, not shared by a copy
+    sparse::SparseCSR sATMoved(std::move(sAT));
+    checkSparse(AB, sATMoved.Mul(sB, sparse::MulTN, &viewAT), "Mul MulTN with the view of a moved matrix");
+    sparse::SparseCSR sATCopy(sATMoved);
+    bool thrown = false;
+    try
+    {
+        sATCopy.Mul(sB, sparse::MulTN, &viewAT);
+    }
+    catch (const std::invalid_argument &)
+    {
+        thrown = true;
+    }
+    if (thrown == false)
+    {
+        printMessageLine("Wrong Answer: Mul accepted the view of another matrix");
+    }
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(AB);
+
+    printMessageLine("done");
+}
+
+void TestSparseReorder()
+{
+    int n = 512;
+
+    printSplitLine();
+    std::printf("symmetric reordering: A[%d][%d]\n", n, n);
+    printSplitLine();
+
+    // a power-law graph with isolated vertices and a matrix with a nonsymmetric pattern
+    std::vector<std::vector<sparse::ElementCOO>> arrays = {sparse::GenerateRMAT(9, 4, 5), sparse::GenerateUniform(n, n, 6, 6)};
+    const char *methodNames[] = {"RCM", "degree", "cluster"};
+
+    float *x = gemm::utils::allocMatrix(n, 1);
+    float *xNew = gemm::utils::allocMatrix(n, 1);
+    float *y = gemm::utils::allocMatrix(n, 1);
+    float *yNew = gemm::utils::allocMatrix(n, 1);
+    float *yBack = gemm::utils::allocMatrix(n, 1);
+    float *expected = gemm::utils::allocMatrix(n, n);
+    gemm::utils::randomFillMatrix(x, n, 1);
+
+    printMessageLine("Used Real Time");
+
+    for (const std::vector<sparse::ElementCOO> &array : arrays)
+    {
+        sparse::SparseCSR sA(n, n, array.size(), array.data());
+        float *A = cooToDense(array, n, n);
+        sparse::SpMV(sA, x, y);
+
+        for (sparse::ReorderMethod method : {sparse::ReorderRCM, sparse::ReorderDegree, sparse::ReorderCluster})
+        {
+            const std::string name = std::string("Reorder ") + methodNames[method];
+
+            ABTMS(name.c_str());
+            sparse::ReorderedCSR reordered = sparse::Reorder(sA, method);
+            ABTME(name.c_str());
+
+            const sparse::Permutation &p = reordered.permutation;
+            std::vector<bool> seen(n, false);
+            bool valid = p.Size() == n && (int)p.inverse.size() == n;
+            for (int i = 0; i < n && valid; i++)
+            {
+                valid = p.perm[i] >= 0 && p.perm[i] < n && seen[p.perm[i]] == false && p.inverse[p.perm[i]] == i;
+                seen[p.perm[i]] = true;
+            }
+            if (valid == false)
+            {
+                printMessageLine("Wrong Answer: " + name + " is not a permutation");
+                continue;
+            }
+
+            // B[i][j] == A[perm[i]][perm[j]]
+            for (int i = 0; i < n; i++)
+            {
+                for (int j = 0; j < n; j++)
+                {
+                    expected[i * n + j] = A[p.perm[i] * n + p.perm[j]];
+                }
+            }
+            checkSparse(expected, reordered.matrix, name);
+
+            // y = A * x through the reordered matrix
+            sparse::PermuteVector(p, x, xNew);
+            sparse::SpMV(reordered.matrix, xNew, yNew);
+            sparse::UnpermuteVector(p, yNew, yBack);
+            if (false == gemm::utils::checkSameMatrix(y, yBack, n, 1))
+            {
+                printMessageLine("Wrong Answer: " + name + " SpMV in the new order check failed");
+            }
+        }
+
+        gemm::utils::freeMatrix(A);
+    }
+
+    gemm::utils::freeMatrix(x);
+    gemm::utils::freeMatrix(xNew);
+    gemm::utils::freeMatrix(y);
+    gemm::utils::freeMatrix(yNew);
+    gemm::utils::freeMatrix(yBack);
+    gemm::utils::freeMatrix(expected);
+
+    printMessageLine("done");
+}
+
+void TestSparseMasked()
+{
+    int M = 300;
+    int N = 200;
+    int K = 250;
+
+    printSplitLine();
+    std::printf("masked sparse multiplication: A[%d][%d] * B[%d][%d] on the pattern of Mask[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    std::vector<sparse::ElementCOO> arrayB = sparse::GenerateUniform(N, K, 8, 2);
+    std::vector<sparse::ElementCOO> arrayMask = sparse::GenerateUniform(M, K, 40, 3);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sB(N, K, arrayB.size(), arrayB.data());
+    sparse::SparseCSR sMask(M, K, arrayMask.size(), arrayMask.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *B = cooToDense(arrayB, N, K);
+    float *AB = gemm::utils::allocMatrix(M, K);
+    float *structural = gemm::utils::allocMatrix(M, K);
+    float *complement = gemm::utils::allocMatrix(M, K);
+    gemm::generalMatMulTrival(A, B, AB, M, N, K);
+
+    std::vector<bool> inMask(M * K, false);
+    for (const sparse::ElementCOO &e : arrayMask)
+    {
+        inMask[e.row * K + e.col] = true;
+    }
+    for (int i = 0; i < M * K; i++)
+    {
+        structural[i] = inMask[i] ? AB[i] : 0.0f;
+        complement[i] = inMask[i] ? 0.0f : AB[i];
+    }
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("MaskedMul MaskedDot");
+    sparse::SparseCSR sDot = sparse::MaskedMul(sA, sB, sMask, sparse::MaskStructural, sparse::MaskedDot);
+    ABTME("MaskedMul MaskedDot");
+    checkSparse(structural, sDot, "MaskedMul structural MaskedDot");
+
+    ABTMS("MaskedMul MaskedGustavson");
+    sparse::SparseCSR sGustavson = sparse::MaskedMul(sA, sB, sMask, sparse::MaskStructural, sparse::MaskedGustavson);
+    ABTME("MaskedMul MaskedGustavson");
+    checkSparse(structural, sGustavson, "MaskedMul structural MaskedGustavson");
+    checkSparse(structural, sparse::MaskedMul(sA, sB, sMask, sparse::MaskStructural, sparse::MaskedAuto), "MaskedMul structural MaskedAuto");
+
+    checkSparse(complement, sparse::MaskedMul(sA, sB, sMask, sparse::MaskComplement, sparse::MaskedGustavson), "MaskedMul complement MaskedGustavson");
+    checkSparse(complement, sparse::MaskedMul(sA, sB, sMask, sparse::MaskComplement, sparse::MaskedAuto), "MaskedMul complement MaskedAuto");
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(AB);
+    gemm::utils::freeMatrix(structural);
+    gemm::utils::freeMatrix(complement);
+
+    printMessageLine("done");
+}
+
+void TestSparseDispatch()
+{
+    int M = 300;
+    int N = 200;
+    int K = 250;
+
+    printSplitLine();
+    std::printf("sparse or dense multiplication paths: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    std::vector<sparse::ElementCOO> arrayB = sparse::GenerateUniform(N, K, 8, 2);
+    sparse::SparseCSR sA(M, N, arrayA.size(), arrayA.data());
+    sparse::SparseCSR sB(N, K, arrayB.size(), arrayB.data());
+
+    float *A = cooToDense(arrayA, M, N);
+    float *B = cooToDense(arrayB, N, K);
+    float *AB = gemm::utils::allocMatrix(M, K);
+    float *C = gemm::utils::allocMatrix(M, K);
+    gemm::generalMatMulTrival(A, B, AB, M, N, K);
+
+    // [A A] * [B; -B] == 0 exactly for small integer values: Gustavson stores the cancelled entries as zeros
+    std::vector<sparse::ElementCOO> arrayA2, arrayB2;
+    for (const sparse::ElementCOO &e : arrayA)
+    {
+        const float val = 1.0f + e.col % 3;
+        arrayA2.push_back(sparse::ElementCOO{e.row, e.col, val});
+        arrayA2.push_back(sparse::ElementCOO{e.row, e.col + N, val});
+    }
+    for (const sparse::ElementCOO &e : arrayB)
+    {
+        const float val = 1.0f + e.row % 5;
+        arrayB2.push_back(sparse::ElementCOO{e.row, e.col, val});
+        arrayB2.push_back(sparse::ElementCOO{e.row + N, e.col, -val});
+    }
+    sparse::SparseCSR sA2(M, 2 * N, arrayA2.size(), arrayA2.data());
+    sparse::SparseCSR sB2(2 * N, K, arrayB2.size(), arrayB2.data());
+
+    printMessageLine("Used Real Time");
+
+    const char *names[] = {"MulPathSparse", "MulPathSparseDense", "MulPathDense"};
+    long long nnz[3];
+    for (sparse::MulPath path : {sparse::MulPathSparse, sparse::MulPathSparseDense, sparse::MulPathDense})
+    {
+        const std::string name = names[path];
+
+        ABTMS(name.c_str());
+        sparse::SparseCSR sAB = sparse::MulWith(sA, sB, path);
+        ABTME(name.c_str());
+        checkSparse(AB, sAB, "MulWith " + name);
+        nnz[path] = sAB.Nnz();
+
+        sparse::MulWithDense(sA, sB, C, K, path);
+        if (false == gemm::utils::checkSameMatrix(AB, C, M, K))
+        {
+            printMessageLine("Wrong Answer: MulWithDense " + name + " check failed");
+        }
+
+        if (sparse::MulWith(sA2, sB2, path).Nnz() != 0)
+        {
+            printMessageLine("Wrong Answer: MulWith " + name + " keeps cancelled entries");
+        }
+    }
+    if (nnz[sparse::MulPathSparse] != nnz[sparse::MulPathSparseDense] || nnz[sparse::MulPathSparse] != nnz[sparse::MulPathDense])
+    {
+        printMessageLine("Wrong Answer: MulWith patterns differ between the paths");
+    }
+    checkSparse(AB, sparse::MulAuto(sA, sB), "MulAuto");
+
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(AB);
+    gemm::utils::freeMatrix(C);
+
+    printMessageLine("done");
+}
+
+void TestSparseDynamic()
+{
+    int M = 200;
+    int N = 150;
+    int updates = 20000;
+
+    printSplitLine();
+    std::printf("dynamic sparse matrix against std::map: A[%d][%d], %d random updates\n", M, N, updates);
+    printSplitLine();
+
+    std::vector<sparse::ElementCOO> arrayA = sparse::GenerateUniform(M, N, 8, 1);
+    sparse::DynamicSparseCSR dA(sparse::SparseCSR(M, N, arrayA.size(), arrayA.data()));
+    dA.SetCompactThreshold(256); // many background compactions during the updates
+
+    std::map<std::pair<int, int>, float> reference;
+    for (const sparse::ElementCOO &e : arrayA)
+    {
+        reference[{e.row, e.col}] += e.val;
+    }
+
+    std::default_random_engine engine(7);
+    std::uniform_int_distribution<int> rowDist(0, M - 1);
+    std::uniform_int_distribution<int> colDist(0, N - 1);
+    std::uniform_real_distribution<float> valDist(-1.0f, 1.0f);
+
+    printMessageLine("Used Real Time");
+
+    ABTMS("DynamicSparseCSR Set, Erase, Get");
+    bool same = true;
+    for (int u = 0; u < updates && same; u++)
+    {
+        const int row = rowDist(engine);
+        const int col = colDist(engine);
+        if (u % 3 == 2)
+        {
+            dA.Erase(row, col);
+            reference.erase({row, col});
+        }
+        else
+        {
+            const float val = valDist(engine);
+            dA.Set(row, col, val);
+            reference[{row, col}] = val;
+        }
+
+        const int r = rowDist(engine);
+        const int c = colDist(engine);
+        auto it = reference.find({r, c});
+        same = dA.Contains(r, c) == (it != reference.end()) && dA.Get(r, c) == ((it != reference.end()) ? it->second : 0.0f);
+        same = same && dA.Nnz() == (long long)reference.size();
+    }
+    ABTME("DynamicSparseCSR Set, Erase, Get");
+    if (same == false)
+    {
+        printMessageLine("Wrong Answer: DynamicSparseCSR differs from std::map");
+    }
+
+    float *expected = gemm::utils::allocMatrix(M, N);
+    std::fill_n(expected, M * N, 0.0f);
+    for (const auto &e : reference)
+    {
+        expected[e.first.first * N + e.first.second] = e.second;
+    }
+
+    // SpMV corrects the base with the logs, Snapshot merges them
+    float *x = gemm::utils::allocMatrix(N, 1);
+    float *y = gemm::utils::allocMatrix(M, 1);
+    float *yExpected = gemm::utils::allocMatrix(M, 1);
+    gemm::utils::randomFillMatrix(x, N, 1);
+    dA.SpMV(x, y);
+    gemm::generalMatMulTrival(expected, x, yExpected, M, N, 1);
+    if (false == gemm::utils::checkSameMatrix(yExpected, y, M, 1))
+    {
+        printMessageLine("Wrong Answer: DynamicSparseCSR SpMV check failed");
+    }
+    checkSparse(expected, dA.Snapshot(), "DynamicSparseCSR Snapshot");
+
+    bool thrown = false;
+    try
+    {
+        dA.Set(M, 0, 1.0f);
+    }
+    catch (const std::out_of_range &)
+    {
+        thrown = true;
+    }
+    if (thrown == false)
+    {
+        printMessageLine("Wrong Answer: DynamicSparseCSR accepted an index out of range");
+    }
+
+    gemm::utils::freeMatrix(expected);
+    gemm::utils::freeMatrix(x);
+    gemm::utils::freeMatrix(y);
+    gemm::utils::freeMatrix(yExpected);
+
+    printMessageLine("done");
+}
+
+// gridOperator returns the 5-point operator of a g x g grid: 4 on the diagonal, -1 - c to the left and above,
+// -1 + c to the right and below. c = 0 is the SPD Laplacian, c != 0 adds a nonsymmetric convection term.
+std::vector<sparse::ElementCOO> gridOperator(const int g, const float c)
+{
+    std::vector<sparse::ElementCOO> array;
+    for (int i = 0; i < g; i++)
+    {
+        for (int j = 0; j < g; j++)
+        {
+            const int row = i * g + j;
+            array.push_back(sparse::ElementCOO{row, row, 4.0f});
+            if (j > 0)
+            {
+                array.push_back(sparse::ElementCOO{row, row - 1, -1.0f - c});
+            }
+            if (j < g - 1)
+            {
+                array.push_back(sparse::ElementCOO{row, row + 1, -1.0f + c});
+            }
+            if (i > 0)
+            {
+                array.push_back(sparse::ElementCOO{row, row - g, -1.0f - c});
+            }
+            if (i < g - 1)
+            {
+                array.push_back(sparse::ElementCOO{row, row + g, -1.0f + c});
+            }
+        }
+    }
+    return array;
+}
+
+void TestSparseSolver()
+{
+    int g = 24;
+    int n = g * g;
+
+    printSplitLine();
+    std::printf("preconditioned CG and BiCGSTAB: A[%d][%d] 5-point grid operators\n", n, n);
+    printSplitLine();
+
+    float *xTrue = gemm::utils::allocMatrix(n, 1);
+    float *b = gemm::utils::allocMatrix(n, 1);
+    float *x = gemm::utils::allocMatrix(n, 1);
+    gemm::utils::randomFillMatrix(xTrue, n, 1);
+
+    const char *preconditionerNames[] = {"None", "Jacobi", "ILU0"};
+
+    printMessageLine("Used Real Time");
+
+    // CG on the SPD Laplacian, BiCGSTAB on it and on the nonsymmetric operator
+    for (float c : {0.0f, 0.4f})
+    {
+        std::vector<sparse::ElementCOO> array = gridOperator(g, c);
+        sparse::SparseCSR sA(n, n, array.size(), array.data());
+        sparse::SpMV(sA, xTrue, b);
+
+        for (sparse::SolverPreconditioner preconditioner : {sparse::PreconditionerNone, sparse::PreconditionerJacobi, sparse::PreconditionerILU0})
+        {
+            sparse::SolverOptions options;
+            options.tolerance = 1e-5;
+            options.preconditioner = preconditioner;
+            sparse::SparseSolver solver(sA, options);
+
+            for (int method = (c == 0.0f) ? 0 : 1; method < 2; method++)
+            {
+                const std::string name = std::string(method == 0 ? "CG " : "BiCGSTAB ") + preconditionerNames[preconditioner] + (c == 0.0f ? " SPD" : " nonsymmetric");
+
+                std::fill_n(x, n, 0.0f);
+                ABTMS(name.c_str());
+                sparse::SolverResult result = (method == 0) ? solver.CG(b, x) : solver.BiCGSTAB(b, x);
+                ABTME(name.c_str());
+
+                // true residual ||b - A*x|| / ||b|| in double
+                double rr = 0.0, bb = 0.0;
+                for (int i = 0; i < n; i++)
+                {
+                    double ax = 0.0;
+                    for (int k = sA.RowStart()[i]; k < sA.RowStart()[i + 1]; k++)
+                    {
+                        ax += (double)sA.Values()[k] * x[sA.ColIdx()[k]];
+                    }
+                    rr += (b[i] - ax) * (b[i] - ax);
+                    bb += (double)b[i] * b[i];
+                }
+                const double residual = std::sqrt(rr / bb);
+                std::printf("%s: %d iterations, residual %.3e\n", name.c_str(), result.iterations, residual);
+
+                if (result.converged == false || residual > options.tolerance)
+                {
+                    printMessageLine("Wrong Answer: " + name + " did not converge");
+                }
+            }
+        }
+    }
+
+    gemm::utils::freeMatrix(xTrue);
+    gemm::utils::freeMatrix(b);
+    gemm::utils::freeMatrix(x);
+
+    printMessageLine("done");
+}
+
+void TestSparseSDDMM()
+{
+    int M = 300;
+    int N = 200;
+    int K = 37;
+
+    printSplitLine();
+    std::printf("sampled dense-dense: (A[%d][%d] * B[%d][%d]^T) o S[%d][%d]\n", M, K, N, K, M, N);
+    printSplitLine();
+
+    // row lengths 0 to 40 cover the groups of 4 and their tails, K is not a multiple of the vector width either
+    std::vector<sparse::ElementCOO> arrayS = raggedRows(M, N, 40);
+    float *S = cooToDense(arrayS, M, N);
+
+    const int aStride = K + 3;
+    const int bStride = K + 5;
+    float *A = gemm::utils::allocMatrix(M, aStride);
+    float *B = gemm::utils::allocMatrix(N, bStride);
+    float *ADense = gemm::utils::allocMatrix(M, K);
+    float *BTrans = gemm::utils::allocMatrix(K, N);
+    float *AB = gemm::utils::allocMatrix(M, N);
+    float *expected = gemm::utils::allocMatrix(M, N);
+    gemm::utils::randomFillMatrix(A, M, aStride);
+    gemm::utils::randomFillMatrix(B, N, bStride);
+
+    for (int i = 0; i < M; i++)
+    {
+        std::copy_n(A + i * aStride, K, ADense + i * K);
+    }
+    for (int j = 0; j < N; j++)
+    {
+        for (int p = 0; p < K; p++)
+        {
+            BTrans[p * N + j] = B[j * bStride + p];
+        }
+    }
+    gemm::generalMatMulTrival(ADense, BTrans, AB, M, K, N);
+
+    printMessageLine("Used Real Time");
+
+    // beta = 0 overwrites the values of S, beta != 0 scales them into the result
+    for (float beta : {0.0f, 0.5f})
+    {
+        const std::string name = (beta == 0.0f) ? "SDDMM" : "SDDMM beta";
+
+        sparse::SparseCSR sS(M, N, arrayS.size(), arrayS.data());
+        for (int i = 0; i < M * N; i++)
+        {
+            expected[i] = (S[i] != 0.0f) ? 1.5f * AB[i] + beta * S[i] : 0.0f;
+        }
+
+        ABTMS(name.c_str());
+        sparse::SDDMM(sS, A, B, K, aStride, bStride, 1.5f, beta);
+        ABTME(name.c_str());
+        checkSparse(expected, sS, name);
+    }
+
+    gemm::utils::freeMatrix(S);
+    gemm::utils::freeMatrix(A);
+    gemm::utils::freeMatrix(B);
+    gemm::utils::freeMatrix(ADense);
+    gemm::utils::freeMatrix(BTrans);
+    gemm::utils::freeMatrix(AB);
+    gemm::utils::freeMatrix(expected);
 
     printMessageLine("done");
 }
@@ -137,6 +1325,15 @@ void TestSparse1()
 
     auto sum = m1.Add(m2);
     std::cout << sum;
+
+    float *d1 = cooToDense(array1, 5, 5);
+    float *d2 = cooToDense(array2, 5, 5);
+    float *dSum = gemm::utils::allocMatrix(5, 5);
+    gemm::generalMatAdd(d1, d2, dSum, 5, 5);
+    checkSparse(dSum, sum, "Add");
+    gemm::utils::freeMatrix(d1);
+    gemm::utils::freeMatrix(d2);
+    gemm::utils::freeMatrix(dSum);
 }
 
 void TestSparse2()
@@ -179,13 +1376,154 @@ void TestSparse2()
 
     auto prod = m1.Mul(m2);
     std::cout << prod;
+
+    float *d1 = cooToDense(array1, 3, 4);
+    float *d2 = cooToDense(array2, 4, 2);
+    float *dProd = gemm::utils::allocMatrix(3, 2);
+    gemm::generalMatMulTrival(d1, d2, dProd, 3, 4, 2);
+    checkSparse(dProd, prod, "Mul");
+    gemm::utils::freeMatrix(d1);
+    gemm::utils::freeMatrix(d2);
+    gemm::utils::freeMatrix(dProd);
+}
+
+// registerFd sends OpRegister for fd on a new connection to the server, like GemmClient::Allocate
+// but without creating or sealing the memfd, and returns the status of the response
+int registerFd(const std::string &socketPath, const int fd, const uint64_t bytes)
+{
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock < 0 || connect(sock, (sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (sock >= 0)
+        {
+            close(sock);
+        }
+        return -1;
+    }
+
+    gemm::service::Request request;
+    std::memset(&request, 0, sizeof(request));
+    request.magic = gemm::service::ProtocolMagic;
+    request.op = gemm::service::OpRegister;
+    request.id = 1;
+    request.bytes = bytes;
+
+    iovec data = {&request, sizeof(request)};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_iov = &data;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+    gemm::service::Response response;
+    int status = -1;
+    if (sendmsg(sock, &message, 0) == (ssize_t)sizeof(request) && recv(sock, &response, sizeof(response), 0) == (ssize_t)sizeof(response))
+    {
+        status = response.status;
+    }
+    close(sock);
+    return status;
+}
+
+void TestService()
+{
+    int M = 128;
+    int N = 64;
+    int K = 192;
+
+    printSplitLine();
+    std::printf("gemm service round trip: A[%d][%d] * B[%d][%d] = C[%d][%d]\n", M, N, N, K, M, K);
+    printSplitLine();
+
+    gemm::service::ServerOptions options;
+    options.socketPath = "gemm_service_check.sock";
+    options.pin = false;
+    gemm::service::GemmServer server(options);
+    std::thread io([&server]() { server.Run(); });
+
+    printMessageLine("Used Real Time");
+
+    {
+        // Allocate registers a sealed memfd
+        gemm::service::GemmClient client(options.socketPath);
+        const uint64_t offsetB = (uint64_t)M * N * sizeof(float);
+        const uint64_t offsetC = offsetB + (uint64_t)N * K * sizeof(float);
+        gemm::service::SharedRegion region = client.Allocate(offsetC + (uint64_t)M * K * sizeof(float));
+
+        gemm::utils::randomFillMatrix(region.Floats(), M, N);
+        gemm::utils::randomFillMatrix(region.Floats(offsetB), N, K);
+        float *C = gemm::utils::allocMatrix(M, K);
+        gemm::generalMatMulTrival(region.Floats(), region.Floats(offsetB), C, M, N, K);
+
+        ABTMS("GemmClient Mul");
+        gemm::service::Response response = client.Mul({region.handle, 0}, {region.handle, offsetB}, {region.handle, offsetC}, M, N, K);
+        ABTME("GemmClient Mul");
+        if (response.status != gemm::service::StatusOk)
+        {
+            printMessageLine("Wrong Answer: service Mul failed");
+        }
+        else if (false == gemm::utils::checkSameMatrix(C, region.Floats(offsetC), M, K))
+        {
+            printMessageLine("Wrong Answer: service Mul check failed");
+        }
+        gemm::utils::freeMatrix(C);
+    }
+
+    // a memfd without F_SEAL_SHRINK and a regular file (F_GET_SEALS fails) are refused
+    int unsealed = memfd_create("gemm_service_check", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (unsealed < 0 || ftruncate(unsealed, 4096) != 0 || registerFd(options.socketPath, unsealed, 4096) != gemm::service::StatusBadRequest)
+    {
+        printMessageLine("Wrong Answer: service registered an unsealed memfd");
+    }
+    close(unsealed);
+
+    int file = open(".", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (file < 0 || ftruncate(file, 4096) != 0 || registerFd(options.socketPath, file, 4096) != gemm::service::StatusBadRequest)
+    {
+        printMessageLine("Wrong Answer: service registered a regular file");
+    }
+    close(file);
+
+    server.Stop();
+    io.join();
+
+    printMessageLine("done");
 }
 
 int main()
 {
     TestGemm();
-    // TestSparse1();
-    // TestSparse2();
+    TestGemmSyrk();
+    TestGemmSplitK();
+    TestGemmSumma();
+    TestSparseMul();
+    TestSparseKernels();
+    TestSparseFormats();
+    TestSparseCOO();
+    TestSparseBinary();
+    TestSparseCombination();
+    TestSparseMulTrans();
+    TestSparseReorder();
+    TestSparseMasked();
+    TestSparseDispatch();
+    TestSparseDynamic();
+    TestSparseSolver();
+    TestSparseSDDMM();
+    TestSparse1();
+    TestSparse2();
+    TestService();
 
     return 0;
 }
@@ -0,0 +1,74 @@
+#include "gemm_service.h"
+
+#include "gemm_thread.h" // numThreads
+
+#include <csignal>   // signal, SIGINT, SIGTERM
+#include <cstdio>    // printf, fprintf
+#include <cstdlib>   // atoi
+#include <stdexcept> // runtime_error
+#include <string>    // string
+
+gemm::service::GemmServer *server = nullptr;
+
+void onSignal(int)
+{
+    if (server != nullptr)
+    {
+        server->Stop();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    gemm::service::ServerOptions options;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+
+        if (key == "--socket")
+            options.socketPath = value;
+        else if (key == "--threads")
+            options.threads = std::atoi(value.c_str());
+        else if (key == "--pin")
+            options.pin = std::atoi(value.c_str()) != 0;
+        else if (key == "--batch-window-us")
+            options.batchWindowUs = std::atoi(value.c_str());
+        else if (key == "--max-batch")
+            options.maxBatch = std::atoi(value.c_str());
+        else if (key == "--stats-interval")
+            options.statsIntervalS = std::atoi(value.c_str());
+        else
+        {
+            std::fprintf(stderr, "unknown option %s\n", key.c_str());
+            return 1;
+        }
+    }
+
+    try
+    {
+        gemm::service::GemmServer service(options);
+        server = &service;
+        std::signal(SIGINT, onSignal);
+        std::signal(SIGTERM, onSignal);
+
+        std::fprintf(stderr, "gemm service: listening on %s, threads = %d, pinned = %d, batch window = %d us\n",
+                     options.socketPath.c_str(), gemm::utils::numThreads(), options.pin, options.batchWindowUs);
+        service.Run();
+
+        const gemm::service::Stats stats = service.GetStats();
+        std::printf("gemm service: %llu requests in %llu batches, latency p50 %.1f us p90 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us, %.2f GFLOP/s\n",
+                    (unsigned long long)stats.requests, (unsigned long long)stats.batches,
+                    stats.p50Us, stats.p90Us, stats.p99Us, stats.p999Us, stats.maxUs, stats.gflops);
+
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        server = nullptr;
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,921 @@
+#include "gemm_service.h"
+
+#include "gemm.h"        // generalMatMulOpt
+#include "gemm_thread.h" // parallelFor, numThreads, setNumThreads, setThreadPinning, pinCurrentThread
+
+#include <algorithm> // sort, min, max, fill
+#include <cerrno>    // errno, EINTR, EAGAIN
+#include <chrono>    // steady_clock
+#include <climits>   // INT_MAX
+#include <cstdio>    // printf, fflush
+#include <cstring>   // memset, memcpy, strerror
+#include <stdexcept> // runtime_error
+
+#include <fcntl.h>      // fcntl, F_ADD_SEALS, F_GET_SEALS, O_CLOEXEC, O_NONBLOCK
+#include <poll.h>       // poll
+#include <sys/mman.h>   // mmap, munmap, memfd_create
+#include <sys/socket.h> // socket, sendmsg, recvmsg, SCM_RIGHTS
+#include <sys/stat.h>   // fstat
+#include <sys/un.h>     // sockaddr_un
+#include <unistd.h>     // close, unlink, pipe2, write, ftruncate
+
+namespace gemm::service
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct GemmServer::Region
+    {
+        void *data = nullptr;
+        uint64_t bytes = 0;
+
+        ~Region()
+        {
+            if (data != nullptr)
+            {
+                munmap(data, bytes);
+            }
+        }
+    };
+
+    struct GemmServer::Connection
+    {
+        int fd = -1;
+        std::mutex sendMutex;        // the I/O thread and the executor both respond
+        std::deque<Response> unsent; // responses the socket buffer had no room for, in order
+        bool dropped = false;        // too many unsent responses or a send error, closed by the I/O thread
+        std::map<uint32_t, std::shared_ptr<Region>> regions;
+        uint32_t nextRegion = 1;
+
+        ~Connection()
+        {
+            close(fd);
+        }
+    };
+
+    // Job is a validated multiplication, it keeps its connection and regions alive until it is answered
+    struct GemmServer::Job
+    {
+        std::shared_ptr<Connection> connection;
+        std::shared_ptr<Region> regionA, regionB, regionC;
+        const float *A;
+        const float *B;
+        float *C;
+        int M, N, K;
+        uint64_t id;
+        Clock::time_point received;
+    };
+
+    double __seconds(const Clock::time_point begin, const Clock::time_point end)
+    {
+        return std::chrono::duration<double>(end - begin).count();
+    }
+
+    uint64_t __nanoseconds(const Clock::time_point begin, const Clock::time_point end)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    }
+
+    sockaddr_un __address(const std::string &path)
+    {
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path))
+        {
+            throw std::runtime_error("gemm service: invalid socket path " + path);
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        return address;
+    }
+
+    // __sendMessage sends one datagram, with fd as SCM_RIGHTS when fd >= 0,
+    // on failure errno tells a full socket buffer (EAGAIN with MSG_DONTWAIT in flags) from an error
+    bool __sendMessage(const int sock, const void *data, const size_t bytes, const int fd, const int flags = 0)
+    {
+        iovec iov = {(void *)data, bytes};
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        if (fd >= 0)
+        {
+            std::memset(control, 0, sizeof(control));
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            cmsghdr *header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+        }
+
+        ssize_t sent;
+        do
+        {
+            sent = sendmsg(sock, &message, MSG_NOSIGNAL | flags);
+        } while (sent < 0 && errno == EINTR);
+        return sent == (ssize_t)bytes;
+    }
+
+    // __receiveMessage reads one datagram into data, returns its size (0 = closed, < 0 = error),
+    // a received descriptor is stored in fd (-1 otherwise), oversized datagrams report bytes + 1
+    ssize_t __receiveMessage(const int sock, void *data, const size_t bytes, int &fd)
+    {
+        iovec iov = {data, bytes};
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t received;
+        do
+        {
+            received = recvmsg(sock, &message, MSG_CMSG_CLOEXEC);
+        } while (received < 0 && errno == EINTR);
+
+        fd = -1;
+        if (received >= 0 && !(message.msg_flags & MSG_CTRUNC))
+        {
+            for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+            {
+                if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+                {
+                    std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+                }
+            }
+        }
+        if (received > 0 && (message.msg_flags & MSG_TRUNC))
+        {
+            return bytes + 1;
+        }
+        return received;
+    }
+
+    Response __response(const Request &request, const Status status)
+    {
+        Response response;
+        std::memset(&response, 0, sizeof(response));
+        response.magic = ProtocolMagic;
+        response.op = request.op;
+        response.id = request.id;
+        response.status = status;
+        return response;
+    }
+
+    // __flush sends the unsent responses of a connection until its socket buffer is full,
+    // false when the connection failed; sendMutex must be held
+    bool __flush(GemmServer::Connection &connection)
+    {
+        while (!connection.dropped && !connection.unsent.empty())
+        {
+            if (__sendMessage(connection.fd, &connection.unsent.front(), sizeof(Response), -1, MSG_DONTWAIT))
+            {
+                connection.unsent.pop_front();
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            else
+            {
+                connection.dropped = true; // a client that hung up loses its answers
+            }
+        }
+        return !connection.dropped;
+    }
+
+    // __respond never blocks: a response that does not fit the socket buffer waits in unsent for the I/O thread,
+    // a client that leaves MaxUnsentResponses unread is dropped. Returns true when a response was left unsent.
+    bool __respond(GemmServer::Connection &connection, const Response &response)
+    {
+        std::lock_guard<std::mutex> lock(connection.sendMutex);
+        if (connection.dropped)
+        {
+            return false;
+        }
+        connection.unsent.push_back(response);
+        if (__flush(connection) && connection.unsent.size() > (size_t)MaxUnsentResponses)
+        {
+            connection.dropped = true;
+        }
+        if (connection.dropped)
+        {
+            connection.unsent.clear();
+            shutdown(connection.fd, SHUT_RDWR); // wakes the poll of the I/O thread, which closes it
+            return false;
+        }
+        return !connection.unsent.empty();
+    }
+
+    // __operand resolves an operand of rows x cols floats, nullptr when it is not inside its region
+    float *__operand(const std::map<uint32_t, std::shared_ptr<GemmServer::Region>> &regions, const Operand &operand, const int rows, const int cols, std::shared_ptr<GemmServer::Region> &region)
+    {
+        auto it = regions.find(operand.region);
+        if (it == regions.end())
+        {
+            return nullptr;
+        }
+        region = it->second;
+
+        const uint64_t bytes = (uint64_t)rows * cols * sizeof(float);
+        if (operand.offset % sizeof(float) != 0 || operand.offset > region->bytes || bytes > region->bytes - operand.offset)
+        {
+            return nullptr;
+        }
+        return (float *)((char *)region->data + operand.offset);
+    }
+
+    // __validShape checks the generalMatMulOpt requirements, every operand must be indexable by int
+    bool __validShape(const int M, const int N, const int K)
+    {
+        for (const int d : {M, N, K})
+        {
+            if (d <= 0 || d % MulBlock != 0)
+            {
+                return false;
+            }
+        }
+        return (long long)M * N <= INT_MAX && (long long)N * K <= INT_MAX && (long long)M * K <= INT_MAX;
+    }
+
+    GemmServer::GemmServer(const ServerOptions &options) : options(options)
+    {
+        sockaddr_un address = __address(options.socketPath);
+
+        // a socket file without a listener is left over from a crashed server
+        int probe = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (probe >= 0)
+        {
+            const bool running = connect(probe, (sockaddr *)&address, sizeof(address)) == 0;
+            close(probe);
+            if (running)
+            {
+                throw std::runtime_error("gemm service: a server already listens on " + options.socketPath);
+            }
+        }
+        unlink(options.socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0)
+        {
+            const std::string reason = std::strerror(errno);
+            if (listenFd >= 0)
+            {
+                close(listenFd);
+            }
+            throw std::runtime_error("gemm service: cannot listen on " + options.socketPath + ": " + reason);
+        }
+
+        if (pipe2(wakeFds, O_CLOEXEC | O_NONBLOCK) != 0)
+        {
+            close(listenFd);
+            unlink(options.socketPath.c_str());
+            throw std::runtime_error("gemm service: pipe failed");
+        }
+
+        latencyUs.reserve(StatsWindow);
+
+        if (options.threads > 0)
+        {
+            utils::setNumThreads(options.threads);
+        }
+        utils::setThreadPinning(options.pin);
+    }
+
+    GemmServer::~GemmServer()
+    {
+        Stop();
+        if (executor.joinable())
+        {
+            executor.join();
+        }
+        connections.clear();
+        close(listenFd);
+        close(wakeFds[0]);
+        close(wakeFds[1]);
+        unlink(options.socketPath.c_str());
+    }
+
+    void GemmServer::__wake()
+    {
+        const char byte = 0;
+        ssize_t ignored = write(wakeFds[1], &byte, 1);
+        (void)ignored;
+    }
+
+    void GemmServer::Stop()
+    {
+        stopping = true;
+        __wake();
+    }
+
+    void GemmServer::__accept()
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        std::shared_ptr<Connection> connection = std::make_shared<Connection>();
+        connection->fd = fd;
+        connections.push_back(connection);
+    }
+
+    bool GemmServer::__serve(const std::shared_ptr<Connection> &owner)
+    {
+        Connection &connection = *owner;
+        Request request;
+        int fd = -1;
+        const ssize_t received = __receiveMessage(connection.fd, &request, sizeof(request), fd);
+        if (received <= 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            return false;
+        }
+
+        if (received != sizeof(request) || request.magic != ProtocolMagic)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            std::memset(&request, 0, sizeof(request));
+            __respond(connection, __response(request, StatusBadRequest));
+            return true;
+        }
+
+        if (request.op != OpRegister && fd >= 0)
+        {
+            close(fd);
+        }
+
+        switch (request.op)
+        {
+        case OpRegister:
+        {
+            struct stat info;
+            // without F_SEAL_SHRINK the client could truncate the region under a queued job (SIGBUS),
+            // F_GET_SEALS fails (-1, every bit set) for anything but a memfd
+            const int seals = (fd >= 0) ? fcntl(fd, F_GET_SEALS) : -1;
+            if (fd < 0 || request.bytes == 0 || seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &info) != 0 || (uint64_t)info.st_size < request.bytes)
+            {
+                if (fd >= 0)
+                {
+                    close(fd);
+                }
+                __respond(connection, __response(request, StatusBadRequest));
+                return true;
+            }
+
+            void *data = mmap(nullptr, request.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd); // the mapping keeps the memory
+            if (data == MAP_FAILED)
+            {
+                __respond(connection, __response(request, StatusError));
+                return true;
+            }
+
+            std::shared_ptr<Region> region = std::make_shared<Region>();
+            region->data = data;
+            region->bytes = request.bytes;
+
+            Response response = __response(request, StatusOk);
+            response.region = connection.nextRegion++;
+            connection.regions[response.region] = region;
+            __respond(connection, response);
+            return true;
+        }
+        case OpRelease:
+        {
+            const bool found = connection.regions.erase(request.region) > 0;
+            __respond(connection, __response(request, found ? StatusOk : StatusNoRegion));
+            return true;
+        }
+        case OpMul:
+        {
+            std::shared_ptr<Job> job = std::make_shared<Job>();
+            job->M = request.M;
+            job->N = request.N;
+            job->K = request.K;
+            job->id = request.id;
+            job->received = Clock::now();
+
+            if (!__validShape(request.M, request.N, request.K))
+            {
+                __respond(connection, __response(request, StatusBadRequest));
+                return true;
+            }
+            for (const Operand *operand : {&request.A, &request.B, &request.C})
+            {
+                if (connection.regions.count(operand->region) == 0)
+                {
+                    __respond(connection, __response(request, StatusNoRegion));
+                    return true;
+                }
+            }
+
+            job->A = __operand(connection.regions, request.A, request.M, request.N, job->regionA);
+            job->B = __operand(connection.regions, request.B, request.N, request.K, job->regionB);
+            job->C = __operand(connection.regions, request.C, request.M, request.K, job->regionC);
+            if (job->A == nullptr || job->B == nullptr || job->C == nullptr)
+            {
+                __respond(connection, __response(request, StatusBadRequest));
+                return true;
+            }
+
+            job->connection = owner;
+
+            {
+                std::lock_guard<std::mutex> lock(queueMutex);
+                queue.push_back(job);
+            }
+            queueReady.notify_one();
+            return true;
+        }
+        case OpStats:
+        {
+            Response response = __response(request, StatusOk);
+            response.stats = GetStats();
+            __respond(connection, response);
+            return true;
+        }
+        default:
+            __respond(connection, __response(request, StatusBadRequest));
+            return true;
+        }
+    }
+
+    void GemmServer::__runBatch(std::vector<std::shared_ptr<Job>> &batch)
+    {
+        const Clock::time_point start = Clock::now();
+
+        // a failing multiplication (std::bad_alloc from generalMatMulOpt) answers StatusError,
+        // nothing may escape a pool worker or the executor
+        std::vector<Status> status(batch.size(), StatusOk);
+        auto run = [&](const size_t i) {
+            const Job &job = *batch[i];
+            try
+            {
+                generalMatMulOpt(job.A, job.B, job.C, job.M, job.N, job.K);
+            }
+            catch (const std::exception &)
+            {
+                status[i] = StatusError;
+            }
+        };
+
+        try
+        {
+            if (batch.size() == 1)
+            {
+                run(0);
+            }
+            else
+            {
+                // largest first, the dynamic schedule then fills the tail with the small ones
+                std::sort(batch.begin(), batch.end(), [](const std::shared_ptr<Job> &a, const std::shared_ptr<Job> &b) {
+                    return (double)a->M * a->N * a->K > (double)b->M * b->N * b->K;
+                });
+                utils::parallelFor(0, batch.size(), 1, [&](const long long begin, const long long end) {
+                    for (long long i = begin; i < end; i++)
+                    {
+                        run(i); // inline on this worker
+                    }
+                });
+            }
+        }
+        catch (const std::exception &)
+        {
+            std::fill(status.begin(), status.end(), StatusError);
+        }
+
+        const Clock::time_point finish = Clock::now();
+
+        double batchFlops = 0.0;
+        bool unsent = false;
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            const Job &job = *batch[i];
+            Request request;
+            std::memset(&request, 0, sizeof(request));
+            request.op = OpMul;
+            request.id = job.id;
+
+            Response response = __response(request, status[i]);
+            response.batchSize = batch.size();
+            response.queueNs = __nanoseconds(job.received, start);
+            response.computeNs = __nanoseconds(start, finish);
+            unsent |= __respond(*job.connection, response);
+
+            if (status[i] == StatusOk)
+            {
+                batchFlops += 2.0 * job.M * job.N * job.K;
+            }
+        }
+        if (unsent)
+        {
+            __wake(); // the I/O thread polls for POLLOUT on connections with unsent responses
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        for (const std::shared_ptr<Job> &job : batch)
+        {
+            const double us = __seconds(job->received, finish) * 1e6;
+            if (latencyUs.size() < (size_t)StatsWindow)
+            {
+                latencyUs.push_back(us);
+            }
+            else
+            {
+                latencyUs[completed % StatsWindow] = us;
+            }
+            completed++;
+        }
+        batches++;
+        flops += batchFlops;
+        busySeconds += __seconds(start, finish);
+    }
+
+    void GemmServer::__executorLoop()
+    {
+        if (options.pin)
+        {
+            utils::pinCurrentThread(0); // the executor is worker 0 of every parallel region
+        }
+
+        const int threads = utils::numThreads();
+        const Clock::duration window = std::chrono::microseconds(std::max(0, options.batchWindowUs));
+        const size_t maxBatch = std::max(1, options.maxBatch);
+
+        // a request with at least `threads` C blocks occupies the pool by itself
+        auto large = [&](const Job &job) { return (long long)(job.M / MulBlock) * (job.K / MulBlock) >= threads; };
+
+        while (true)
+        {
+            std::vector<std::shared_ptr<Job>> batch;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [&] { return !queue.empty() || draining; });
+                if (queue.empty())
+                {
+                    return; // draining and nothing left
+                }
+
+                if (large(*queue.front()) || threads == 1)
+                {
+                    batch.push_back(queue.front());
+                    queue.pop_front();
+                }
+                else
+                {
+                    const Clock::time_point deadline = queue.front()->received + window;
+                    while (true)
+                    {
+                        while (!queue.empty() && batch.size() < maxBatch && !large(*queue.front()))
+                        {
+                            batch.push_back(queue.front());
+                            queue.pop_front();
+                        }
+                        // full, a large request is next, enough requests for every worker, or out of time
+                        if (batch.size() >= maxBatch || !queue.empty() || batch.size() >= (size_t)threads || draining)
+                        {
+                            break;
+                        }
+                        if (queueReady.wait_until(lock, deadline) == std::cv_status::timeout && queue.empty())
+                        {
+                            break;
+                        }
+                    }
+                }
+            }
+
+            __runBatch(batch);
+        }
+    }
+
+    void GemmServer::Run()
+    {
+        executor = std::thread(&GemmServer::__executorLoop, this);
+
+        Clock::time_point nextStats = Clock::now() + std::chrono::seconds(options.statsIntervalS);
+        std::vector<pollfd> fds;
+        while (!stopping)
+        {
+            fds.clear();
+            fds.push_back({wakeFds[0], POLLIN, 0});
+            fds.push_back({listenFd, POLLIN, 0});
+            for (const std::shared_ptr<Connection> &connection : connections)
+            {
+                std::lock_guard<std::mutex> lock(connection->sendMutex);
+                fds.push_back({connection->fd, (short)(connection->unsent.empty() ? POLLIN : POLLIN | POLLOUT), 0});
+            }
+
+            int timeoutMs = -1;
+            if (options.statsIntervalS > 0)
+            {
+                timeoutMs = std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(nextStats - Clock::now()).count());
+            }
+
+            if (poll(fds.data(), fds.size(), timeoutMs) < 0 && errno != EINTR)
+            {
+                break;
+            }
+
+            if (options.statsIntervalS > 0 && Clock::now() >= nextStats)
+            {
+                const Stats stats = GetStats();
+                std::printf("gemm service: %llu requests in %llu batches, latency p50 %.1f us p90 %.1f us p99 %.1f us p99.9 %.1f us max %.1f us, %.2f GFLOP/s\n",
+                            (unsigned long long)stats.requests, (unsigned long long)stats.batches,
+                            stats.p50Us, stats.p90Us, stats.p99Us, stats.p999Us, stats.maxUs, stats.gflops);
+                std::fflush(stdout);
+                nextStats = Clock::now() + std::chrono::seconds(options.statsIntervalS);
+            }
+
+            if (fds[0].revents & POLLIN)
+            {
+                char bytes[64];
+                while (read(wakeFds[0], bytes, sizeof(bytes)) > 0)
+                {
+                }
+            }
+
+            // connections accepted or closed below are not part of fds yet
+            std::vector<std::shared_ptr<Connection>> polled(connections);
+            std::vector<std::shared_ptr<Connection>> open;
+            for (size_t i = 0; i < polled.size(); i++)
+            {
+                const short events = fds[i + 2].revents;
+                bool alive = true;
+                if (events & POLLOUT)
+                {
+                    std::lock_guard<std::mutex> lock(polled[i]->sendMutex);
+                    alive = __flush(*polled[i]);
+                }
+                if (alive && (events & POLLIN))
+                {
+                    alive = __serve(polled[i]);
+                }
+                else if (events & (POLLHUP | POLLERR | POLLNVAL))
+                {
+                    alive = false;
+                }
+                {
+                    std::lock_guard<std::mutex> lock(polled[i]->sendMutex);
+                    alive = alive && !polled[i]->dropped;
+                    if (!alive)
+                    {
+                        polled[i]->dropped = true; // later responses of its queued jobs are discarded
+                        polled[i]->unsent.clear();
+                    }
+                }
+                if (alive)
+                {
+                    open.push_back(polled[i]);
+                }
+                // closed: queued jobs keep the connection until they are answered
+            }
+            connections.swap(open);
+
+            if (fds[1].revents & POLLIN)
+            {
+                __accept();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            draining = true;
+        }
+        queueReady.notify_one();
+        executor.join();
+
+        // the last answers go out if the clients have room for them, Run does not wait for slow readers
+        for (const std::shared_ptr<Connection> &connection : connections)
+        {
+            std::lock_guard<std::mutex> lock(connection->sendMutex);
+            __flush(*connection);
+        }
+    }
+
+    Stats GemmServer::GetStats() const
+    {
+        Stats stats;
+        std::memset(&stats, 0, sizeof(stats));
+
+        std::vector<double> sorted;
+        {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats.requests = completed;
+            stats.batches = batches;
+            stats.gflops = (busySeconds > 0.0) ? flops / busySeconds * 1e-9 : 0.0;
+            sorted = latencyUs;
+        }
+        if (sorted.empty())
+        {
+            return stats;
+        }
+
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](const double p) { return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))]; };
+        stats.p50Us = percentile(0.50);
+        stats.p90Us = percentile(0.90);
+        stats.p99Us = percentile(0.99);
+        stats.p999Us = percentile(0.999);
+        stats.maxUs = sorted.back();
+        return stats;
+    }
+
+    GemmClient::GemmClient(const std::string &socketPath)
+    {
+        sockaddr_un address = __address(socketPath);
+        sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (sock < 0 || connect(sock, (sockaddr *)&address, sizeof(address)) != 0)
+        {
+            const std::string reason = std::strerror(errno);
+            if (sock >= 0)
+            {
+                close(sock);
+            }
+            throw std::runtime_error("gemm service: cannot connect to " + socketPath + ": " + reason);
+        }
+    }
+
+    GemmClient::~GemmClient()
+    {
+        close(sock);
+        for (const SharedRegion &region : regions)
+        {
+            munmap(region.data, region.bytes);
+        }
+    }
+
+    void GemmClient::__send(const Request &request, const int fd)
+    {
+        if (!__sendMessage(sock, &request, sizeof(request), fd))
+        {
+            throw std::runtime_error("gemm service: send failed");
+        }
+    }
+
+    Response GemmClient::__receive()
+    {
+        Response response;
+        int fd = -1;
+        const ssize_t received = __receiveMessage(sock, &response, sizeof(response), fd);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (received != sizeof(response) || response.magic != ProtocolMagic)
+        {
+            throw std::runtime_error("gemm service: connection lost");
+        }
+        return response;
+    }
+
+    Response GemmClient::__control(Request request, const int fd)
+    {
+        request.magic = ProtocolMagic;
+        request.id = nextId++;
+        __send(request, fd);
+
+        while (true)
+        {
+            Response response = __receive();
+            if (response.id == request.id)
+            {
+                return response;
+            }
+            early.push_back(response);
+        }
+    }
+
+    SharedRegion GemmClient::Allocate(const uint64_t bytes)
+    {
+        // the server only maps regions that can no longer shrink
+        int fd = memfd_create("gemm_service", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0 || ftruncate(fd, bytes) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) != 0)
+        {
+            if (fd >= 0)
+            {
+                close(fd);
+            }
+            throw std::runtime_error("gemm service: cannot create shared memory");
+        }
+
+        SharedRegion region;
+        region.bytes = bytes;
+        region.data = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (region.data == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("gemm service: cannot map shared memory");
+        }
+
+        Request request;
+        std::memset(&request, 0, sizeof(request));
+        request.op = OpRegister;
+        request.bytes = bytes;
+
+        Response response;
+        try
+        {
+            response = __control(request, fd);
+        }
+        catch (...)
+        {
+            close(fd);
+            munmap(region.data, bytes);
+            throw;
+        }
+        close(fd);
+
+        if (response.status != StatusOk)
+        {
+            munmap(region.data, bytes);
+            throw std::runtime_error("gemm service: the server cannot map shared memory");
+        }
+        region.handle = response.region;
+        regions.push_back(region);
+        return region;
+    }
+
+    void GemmClient::Release(const SharedRegion &region)
+    {
+        Request request;
+        std::memset(&request, 0, sizeof(request));
+        request.op = OpRelease;
+        request.region = region.handle;
+        __control(request, -1);
+
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            if (regions[i].handle == region.handle)
+            {
+                munmap(regions[i].data, regions[i].bytes);
+                regions.erase(regions.begin() + i);
+                break;
+            }
+        }
+    }
+
+    uint64_t GemmClient::Submit(const Operand &A, const Operand &B, const Operand &C, const int M, const int N, const int K)
+    {
+        Request request;
+        std::memset(&request, 0, sizeof(request));
+        request.magic = ProtocolMagic;
+        request.op = OpMul;
+        request.id = nextId++;
+        request.M = M;
+        request.N = N;
+        request.K = K;
+        request.A = A;
+        request.B = B;
+        request.C = C;
+        __send(request, -1);
+        return request.id;
+    }
+
+    Response GemmClient::Receive()
+    {
+        if (!early.empty())
+        {
+            Response response = early.front();
+            early.pop_front();
+            return response;
+        }
+        return __receive();
+    }
+
+    Response GemmClient::Mul(const Operand &A, const Operand &B, const Operand &C, const int M, const int N, const int K)
+    {
+        const uint64_t id = Submit(A, B, C, M, N, K);
+        while (true)
+        {
+            Response response = __receive();
+            if (response.id == id)
+            {
+                return response;
+            }
+            early.push_back(response);
+        }
+    }
+
+    Stats GemmClient::GetStats()
+    {
+        Request request;
+        std::memset(&request, 0, sizeof(request));
+        request.op = OpStats;
+        return __control(request, -1).stats;
+    }
+
+} // namespace gemm::service
@@ -0,0 +1,210 @@
+#ifndef __LAB1_GEMM_SERVICE_H__
+#define __LAB1_GEMM_SERVICE_H__
+
+#include <atomic>             // atomic
+#include <condition_variable> // condition_variable
+#include <cstdint>            // uint32_t, uint64_t
+#include <deque>              // deque
+#include <map>                // map
+#include <memory>             // shared_ptr
+#include <mutex>              // mutex
+#include <string>             // string
+#include <thread>             // thread
+#include <vector>             // vector
+
+namespace gemm::service
+{
+    // Protocol: every message is one SOCK_SEQPACKET datagram holding a Request (client -> server)
+    // or a Response (server -> client). Operands live in shared memory regions (memfd) that the client
+    // registers once, the memfd travels as SCM_RIGHTS ancillary data and both sides map it,
+    // so multiplications move no matrix data through the socket.
+
+    const uint32_t ProtocolMagic = 0x314d5347; // "GSM1"
+
+    // dimensions of a multiplication must be multiples of MulBlock (generalMatMulOpt), clients zero-pad
+    const int MulBlock = 64;
+
+    enum Op : uint32_t
+    {
+        OpRegister = 1, // map the memfd of the ancillary data, bytes = its size, the memfd must carry F_SEAL_SHRINK
+        OpRelease,      // unmap region, multiplications already queued keep it alive
+        OpMul,          // C = A*B
+        OpStats,        // latency percentiles and throughput
+    };
+
+    enum Status : int32_t
+    {
+        StatusOk = 0,
+        StatusBadRequest, // unknown op, bad shape, operand outside or misaligned in its region, unsealed memfd
+        StatusNoRegion,   // unknown region handle
+        StatusError,      // mapping or running the request failed on the server (out of memory)
+    };
+
+    // Operand is a dense row-major matrix (stride = columns) at byte `offset` of a registered region.
+    struct Operand
+    {
+        uint32_t region;
+        uint64_t offset;
+    };
+
+    struct Request
+    {
+        uint32_t magic;
+        uint32_t op;
+        uint64_t id;     // chosen by the client, echoed by the response
+        int32_t M, N, K; // OpMul: A[M][N], B[N][K], C[M][K]
+        Operand A, B, C; // OpMul
+        uint64_t bytes;  // OpRegister
+        uint32_t region; // OpRelease
+    };
+
+    struct Stats
+    {
+        uint64_t requests;   // multiplications completed since the start
+        uint64_t batches;    // executions of the pool they were grouped into
+        double p50Us, p90Us, p99Us, p999Us, maxUs; // latency from receipt to completion, last StatsWindow requests
+        double gflops;       // 2*M*N*K of the completed requests over the busy time of the executor
+    };
+
+    struct Response
+    {
+        uint32_t magic;
+        uint32_t op;
+        uint64_t id;
+        int32_t status;
+        uint32_t region;     // OpRegister: handle of the new region
+        uint32_t batchSize;  // OpMul: requests run together with this one
+        uint64_t queueNs;    // OpMul: receipt to start of its batch
+        uint64_t computeNs;  // OpMul: run time of its batch
+        Stats stats;         // OpStats
+    };
+
+    // latencies kept for the percentiles of Stats
+    const int StatsWindow = 1 << 16;
+
+    // responses the server holds for a client that does not read them before it drops the connection
+    const int MaxUnsentResponses = 4096;
+
+    struct ServerOptions
+    {
+        std::string socketPath = "/tmp/gemm_service.sock";
+        int threads = 0;         // size of the shared pool, 0 keeps the gemm default
+        bool pin = true;         // pin pool worker t (and the executor as worker 0) to CPU t
+        int batchWindowUs = 200; // a batch of small requests waits at most this long for more
+        int maxBatch = 64;       // requests per batch
+        int statsIntervalS = 0;  // print Stats to stdout every interval, 0 = only on exit
+    };
+
+    // GemmServer serves multiplication requests of local processes over a Unix domain socket.
+    // Run makes the calling thread the I/O thread (poll over the listening socket and the connections)
+    // and starts one executor thread that owns the shared gemm thread pool.
+    // The executor takes the queue in arrival order: a request big enough to occupy every worker
+    // (at least numThreads() C blocks) runs alone on the full pool; consecutive small ones are grouped,
+    // waiting up to batchWindowUs for the batch to fill, and run side by side, one request per worker.
+    class GemmServer
+    {
+    public:
+        struct Region;
+        struct Connection;
+        struct Job;
+
+    private:
+        ServerOptions options;
+        int listenFd = -1;
+        int wakeFds[2] = {-1, -1}; // self-pipe, Stop wakes poll with it
+
+        std::vector<std::shared_ptr<Connection>> connections;
+
+        std::mutex queueMutex;
+        std::condition_variable queueReady;
+        std::deque<std::shared_ptr<Job>> queue;
+        bool draining = false;
+        std::thread executor;
+
+        mutable std::mutex statsMutex;
+        std::vector<double> latencyUs; // ring of the last StatsWindow latencies
+        uint64_t completed = 0;
+        uint64_t batches = 0;
+        double flops = 0.0;
+        double busySeconds = 0.0;
+
+        std::atomic<bool> stopping{false};
+
+        void __wake(); // makes poll of Run return
+        void __accept();
+        bool __serve(const std::shared_ptr<Connection> &connection); // false when the connection is closed
+        void __executorLoop();
+        void __runBatch(std::vector<std::shared_ptr<Job>> &batch);
+
+    public:
+        // binds options.socketPath, throws std::runtime_error when it fails or a server already listens there
+        explicit GemmServer(const ServerOptions &options);
+        ~GemmServer();
+
+        GemmServer(const GemmServer &) = delete;
+        GemmServer &operator=(const GemmServer &) = delete;
+
+        // Run serves until Stop, queued multiplications are finished before it returns
+        void Run();
+
+        // Stop makes Run return, async-signal-safe
+        void Stop();
+
+        Stats GetStats() const;
+    };
+
+    // SharedRegion is a memfd region mapped by the client and registered with the server.
+    struct SharedRegion
+    {
+        uint32_t handle = 0;
+        void *data = nullptr;
+        uint64_t bytes = 0;
+
+        float *Floats(const uint64_t offset = 0) const { return (float *)((char *)data + offset); }
+    };
+
+    // GemmClient is the connection of one client thread to a GemmServer.
+    // Submit can keep several multiplications in flight, their responses arrive in completion order.
+    class GemmClient
+    {
+    private:
+        int sock = -1;
+        uint64_t nextId = 1;
+        std::vector<SharedRegion> regions;
+        std::deque<Response> early; // multiplication responses read while waiting for a control response
+
+        void __send(const Request &request, const int fd);
+        Response __receive();
+        Response __control(Request request, const int fd); // sends, waits for the response of the same id
+
+    public:
+        // connects to socketPath, throws std::runtime_error on failure
+        explicit GemmClient(const std::string &socketPath);
+        ~GemmClient(); // unmaps the regions and disconnects, the server releases them
+
+        GemmClient(const GemmClient &) = delete;
+        GemmClient &operator=(const GemmClient &) = delete;
+
+        // Allocate creates a zero-filled shared region of `bytes` and registers it, throws std::runtime_error
+        SharedRegion Allocate(const uint64_t bytes);
+
+        void Release(const SharedRegion &region);
+
+        // Submit queues C = A*B and returns its id, dimensions must be multiples of MulBlock
+        // input    : A[M][N], B[N][K] in registered regions
+        // function : C = A*B on the server
+        // output   : request id, C[M][K] once Receive returns its response
+        uint64_t Submit(const Operand &A, const Operand &B, const Operand &C, const int M, const int N, const int K);
+
+        // Receive waits for the response of the next completed multiplication
+        Response Receive();
+
+        // Mul is Submit waiting for its own response, responses of other requests in flight are kept for Receive
+        Response Mul(const Operand &A, const Operand &B, const Operand &C, const int M, const int N, const int K);
+
+        Stats GetStats();
+    };
+
+} // namespace gemm::service
+
+#endif // __LAB1_GEMM_SERVICE_H__
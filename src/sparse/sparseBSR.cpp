@@ -0,0 +1,371 @@
+#include "sparseBSR.h"
+
+#include "sparseUtils.h" // balancedPartition
+
+#include "gemm_small.h"  // smallMatMulAcc, smallMatVecAcc
+#include "gemm_thread.h" // parallelFor, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::sort, std::fill_n, std::copy_n
+#include <stdexcept> // std::invalid_argument
+#include <utility>   // std::move, std::swap
+#include <vector>    // std::vector
+
+namespace sparse
+{
+    long long SparseBSR::CountBlocks(const SparseCSR &A, const int D)
+    {
+        const int *rowStart = A.RowStart();
+        const int *colIdx = A.ColIdx();
+
+        int blockCols = (A.Cols() + D - 1) / D;
+        std::vector<int> marker(blockCols, -1);
+
+        long long blocks = 0;
+        for (int i = 0; i < A.Rows(); i++)
+        {
+            int blockRow = i / D;
+            for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            {
+                if (marker[colIdx[k] / D] != blockRow)
+                {
+                    marker[colIdx[k] / D] = blockRow;
+                    blocks++;
+                }
+            }
+        }
+        return blocks;
+    }
+
+    SparseBSR::SparseBSR()
+    {
+        this->rows = 0;
+        this->cols = 0;
+        this->D = 1;
+        this->blockRows = 0;
+        this->blockCols = 0;
+        this->nnzb = 0;
+
+        this->rowStart = nullptr;
+        this->colIdx = nullptr;
+        this->values = nullptr;
+    }
+
+    SparseBSR::SparseBSR(const int rows, const int cols, const int D, const int nnzb)
+    {
+        this->rows = rows;
+        this->cols = cols;
+        this->D = D;
+        this->blockRows = (rows + D - 1) / D;
+        this->blockCols = (cols + D - 1) / D;
+        this->nnzb = nnzb;
+
+        this->rowStart = gemm::utils::allocArray<int>(blockRows + 1);
+        this->colIdx = gemm::utils::allocArray<int>(nnzb);
+        this->values = gemm::utils::allocArray<float>((long long)nnzb * D * D);
+    }
+
+    // O(nnz + nnzb * D * D)
+    SparseBSR::SparseBSR(const SparseCSR &A, const int D) : SparseBSR()
+    {
+        const int *aRowStart = A.RowStart();
+        const int *aColIdx = A.ColIdx();
+        const float *aValues = A.Values();
+
+        const int blockRows = (A.Rows() + D - 1) / D;
+        const int blockCols = (A.Cols() + D - 1) / D;
+
+        // block columns of every block row
+        std::vector<std::vector<int>> blockColsOfRow(blockRows);
+        gemm::utils::parallelFor(0, blockRows, 64, [&](const long long begin, const long long end) {
+            std::vector<int> marker(blockCols, -1);
+            for (long long bi = begin; bi < end; bi++)
+            {
+                for (int i = bi * D; i < std::min(A.Rows(), int(bi + 1) * D); i++)
+                {
+                    for (int k = aRowStart[i]; k < aRowStart[i + 1]; k++)
+                    {
+                        int bj = aColIdx[k] / D;
+                        if (marker[bj] != bi)
+                        {
+                            marker[bj] = bi;
+                            blockColsOfRow[bi].push_back(bj);
+                        }
+                    }
+                }
+                std::sort(blockColsOfRow[bi].begin(), blockColsOfRow[bi].end());
+            }
+        });
+
+        int nnzb = 0;
+        for (auto &blockRow : blockColsOfRow)
+        {
+            nnzb += blockRow.size();
+        }
+
+        *this = SparseBSR(A.Rows(), A.Cols(), D, nnzb); // allocate memory
+
+        this->rowStart[0] = 0;
+        for (int bi = 0; bi < blockRows; bi++)
+        {
+            this->rowStart[bi + 1] = this->rowStart[bi] + blockColsOfRow[bi].size();
+        }
+
+        gemm::utils::parallelFor(0, blockRows, 64, [&](const long long begin, const long long end) {
+            std::vector<int> slot(blockCols, -1); // block column -> block index, only valid inside the block row
+            for (long long bi = begin; bi < end; bi++)
+            {
+                for (int k = this->rowStart[bi]; k < this->rowStart[bi + 1]; k++)
+                {
+                    int bj = blockColsOfRow[bi][k - this->rowStart[bi]];
+                    this->colIdx[k] = bj;
+                    slot[bj] = k;
+                    std::fill_n(this->values + (long long)k * D * D, D * D, 0.0f);
+                }
+
+                for (int i = bi * D; i < std::min(A.Rows(), int(bi + 1) * D); i++)
+                {
+                    for (int k = aRowStart[i]; k < aRowStart[i + 1]; k++)
+                    {
+                        int bj = aColIdx[k] / D;
+                        float *block = this->values + (long long)slot[bj] * D * D;
+                        block[(i - bi * D) * D + aColIdx[k] - bj * D] = aValues[k];
+                    }
+                }
+            }
+        });
+    }
+
+    SparseBSR::SparseBSR(const int rows, const int cols, const int nnz, const ElementCOO *array, const int D)
+        : SparseBSR(SparseCSR(rows, cols, nnz, array), D)
+    {
+    }
+
+    SparseBSR::~SparseBSR()
+    {
+        gemm::utils::alignedFree(rowStart);
+        gemm::utils::alignedFree(colIdx);
+        gemm::utils::alignedFree(values);
+    }
+
+    SparseBSR::SparseBSR(SparseBSR &&x) : SparseBSR()
+    {
+        *this = std::move(x);
+    }
+
+    SparseBSR &SparseBSR::operator=(SparseBSR &&x)
+    {
+        // prevent from moving myself
+        if (&x == this)
+        {
+            return *this;
+        }
+
+        std::swap(this->rows, x.rows);
+        std::swap(this->cols, x.cols);
+        std::swap(this->D, x.D);
+        std::swap(this->blockRows, x.blockRows);
+        std::swap(this->blockCols, x.blockCols);
+        std::swap(this->nnzb, x.nnzb);
+
+        std::swap(this->rowStart, x.rowStart); // move, x frees the old buffers
+        std::swap(this->colIdx, x.colIdx);
+        std::swap(this->values, x.values);
+
+        return *this;
+    }
+
+    // O(nnzb * D * D)
+    SparseCSR SparseBSR::ToCSR() const
+    {
+        std::vector<ElementCOO> array;
+
+        for (int bi = 0; bi < blockRows; bi++)
+        {
+            for (int r = 0; r < D && bi * D + r < rows; r++)
+            {
+                for (int k = rowStart[bi]; k < rowStart[bi + 1]; k++)
+                {
+                    const float *block = values + (long long)k * D * D;
+                    for (int c = 0; c < D && colIdx[k] * D + c < cols; c++)
+                    {
+                        if (block[r * D + c] != 0.0)
+                        {
+                            array.push_back(ElementCOO{bi * D + r, colIdx[k] * D + c, block[r * D + c]});
+                        }
+                    }
+                }
+            }
+        }
+
+        return SparseCSR(rows, cols, array.size(), array.data(), true);
+    }
+
+    // __bsrSpMV runs the block rows [begin, end), D is a template argument for the common block sizes, 0 = runtime D
+    template <int TD>
+    void __bsrSpMV(const int *rowStart, const int *colIdx, const float *values, const int D, const int rows, const float *x, float *y, const float alpha, const float beta, const int begin, const int end)
+    {
+        float acc[TD > 0 ? TD : 1];
+        std::vector<float> accRuntime(TD > 0 ? 0 : D);
+        float *tmp = (TD > 0) ? acc : accRuntime.data();
+
+        for (int bi = begin; bi < end; bi++)
+        {
+            std::fill_n(tmp, D, 0.0f);
+
+            for (int k = rowStart[bi]; k < rowStart[bi + 1]; k++)
+            {
+                const float *block = values + (long long)k * D * D;
+                const float *xBlock = x + (long long)colIdx[k] * D;
+                if (TD > 0)
+                {
+                    gemm::smallMatVecAcc<TD>(block, xBlock, tmp);
+                }
+                else
+                {
+                    gemm::smallMatVecAcc(block, xBlock, tmp, D);
+                }
+            }
+
+            for (int r = 0; r < D && bi * D + r < rows; r++)
+            {
+                float &yi = y[bi * D + r];
+                yi = (beta == 0.0f) ? alpha * tmp[r] : alpha * tmp[r] + beta * yi;
+            }
+        }
+    }
+
+    void SparseBSR::SpMV(const float *x, float *y, const float alpha, const float beta) const
+    {
+        // x is padded to whole blocks when cols is not a multiple of D
+        float *xPad = nullptr;
+        if (cols % D != 0)
+        {
+            xPad = gemm::utils::allocArray<float>((long long)blockCols * D);
+            std::copy_n(x, cols, xPad);
+            std::fill_n(xPad + cols, (long long)blockCols * D - cols, 0.0f);
+            x = xPad;
+        }
+
+        std::vector<int> bounds = utils::balancedPartition(rowStart, blockRows, gemm::utils::numThreads() * 4);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            int rowBegin = bounds[begin];
+            int rowEnd = bounds[end];
+
+            switch (D)
+            {
+            case 2:
+                __bsrSpMV<2>(rowStart, colIdx, values, D, rows, x, y, alpha, beta, rowBegin, rowEnd);
+                break;
+            case 3:
+                __bsrSpMV<3>(rowStart, colIdx, values, D, rows, x, y, alpha, beta, rowBegin, rowEnd);
+                break;
+            case 4:
+                __bsrSpMV<4>(rowStart, colIdx, values, D, rows, x, y, alpha, beta, rowBegin, rowEnd);
+                break;
+            default:
+                __bsrSpMV<0>(rowStart, colIdx, values, D, rows, x, y, alpha, beta, rowBegin, rowEnd);
+                break;
+            }
+        });
+
+        gemm::utils::alignedFree(xPad);
+    }
+
+    // C = AB, Gustavson's algorithm over block rows, block products use gemm::smallMatMulAcc
+    // symbolic phase counts the blocks of every block row, numeric phase fills the preallocated arrays
+    SparseBSR SparseBSR::Mul(const SparseBSR &b) const
+    {
+        if (this->cols != b.rows || this->D != b.D)
+        {
+            throw std::invalid_argument("sparse: BSR Mul shapes or block sizes do not match");
+        }
+
+        const SparseBSR &a = *this;
+        const int DD = D * D;
+
+        SparseBSR c;
+        c.rows = a.rows;
+        c.cols = b.cols;
+        c.D = D;
+        c.blockRows = a.blockRows;
+        c.blockCols = b.blockCols;
+        c.rowStart = gemm::utils::allocArray<int>(c.blockRows + 1);
+
+        // symbolic phase: rowStart[bi + 1] saves the block count of block row bi
+        c.rowStart[0] = 0;
+        gemm::utils::parallelFor(0, a.blockRows, 16, [&](const long long begin, const long long end) {
+            std::vector<int> marker(b.blockCols, -1);
+            for (long long bi = begin; bi < end; bi++)
+            {
+                int count = 0;
+                for (int k = a.rowStart[bi]; k < a.rowStart[bi + 1]; k++)
+                {
+                    int bk = a.colIdx[k];
+                    for (int t = b.rowStart[bk]; t < b.rowStart[bk + 1]; t++)
+                    {
+                        if (marker[b.colIdx[t]] != bi)
+                        {
+                            marker[b.colIdx[t]] = bi;
+                            count++;
+                        }
+                    }
+                }
+                c.rowStart[bi + 1] = count;
+            }
+        });
+
+        for (int bi = 0; bi < c.blockRows; bi++)
+        {
+            c.rowStart[bi + 1] += c.rowStart[bi];
+        }
+
+        c.nnzb = c.rowStart[c.blockRows];
+        c.colIdx = gemm::utils::allocArray<int>(c.nnzb);
+        c.values = gemm::utils::allocArray<float>((long long)c.nnzb * DD);
+
+        // numeric phase
+        gemm::utils::parallelFor(0, a.blockRows, 16, [&](const long long begin, const long long end) {
+            std::vector<int> slot(b.blockCols, -1); // block column -> output block, valid for the current block row
+            for (long long bi = begin; bi < end; bi++)
+            {
+                int *cols = c.colIdx + c.rowStart[bi];
+                int count = 0;
+                for (int k = a.rowStart[bi]; k < a.rowStart[bi + 1]; k++)
+                {
+                    int bk = a.colIdx[k];
+                    for (int t = b.rowStart[bk]; t < b.rowStart[bk + 1]; t++)
+                    {
+                        if (slot[b.colIdx[t]] < c.rowStart[bi])
+                        {
+                            slot[b.colIdx[t]] = c.rowStart[bi]; // mark, fixed below
+                            cols[count++] = b.colIdx[t];
+                        }
+                    }
+                }
+
+                std::sort(cols, cols + count);
+                for (int q = 0; q < count; q++)
+                {
+                    slot[cols[q]] = c.rowStart[bi] + q;
+                    std::fill_n(c.values + (long long)(c.rowStart[bi] + q) * DD, DD, 0.0f);
+                }
+
+                for (int k = a.rowStart[bi]; k < a.rowStart[bi + 1]; k++)
+                {
+                    int bk = a.colIdx[k];
+                    const float *aBlock = a.values + (long long)k * DD;
+                    for (int t = b.rowStart[bk]; t < b.rowStart[bk + 1]; t++)
+                    {
+                        float *cBlock = c.values + (long long)slot[b.colIdx[t]] * DD;
+                        gemm::smallMatMulAcc(aBlock, b.values + (long long)t * DD, cBlock, D);
+                    }
+                }
+            }
+        });
+
+        return c;
+    }
+
+} // namespace sparse
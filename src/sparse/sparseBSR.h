@@ -0,0 +1,60 @@
+#ifndef __SPARSE_BSR_H__
+#define __SPARSE_BSR_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    // SparseBSR is the block sparse row format with square D x D blocks.
+    // Block row i owns the blocks [rowStart[i], rowStart[i + 1]), block k has block column colIdx[k]
+    // and its D * D values stored row-major at values + k * D * D. Rows and columns are padded to multiples of D.
+    class SparseBSR
+    {
+    private:
+        int rows;
+        int cols;
+        int D;
+        int blockRows;
+        int blockCols;
+        int nnzb; // number of stored blocks
+
+        int *rowStart;
+        int *colIdx;
+        float *values;
+
+    public:
+        SparseBSR();
+        SparseBSR(const int rows, const int cols, const int D, const int nnzb);
+        SparseBSR(const SparseCSR &A, const int D);
+        SparseBSR(const int rows, const int cols, const int nnz, const ElementCOO *array, const int D);
+
+        ~SparseBSR();
+
+        SparseBSR(const SparseBSR &x) = delete;
+        SparseBSR &operator=(const SparseBSR &x) = delete;
+
+        SparseBSR(SparseBSR &&x);
+        SparseBSR &operator=(SparseBSR &&x);
+
+        int Rows() const { return rows; }
+        int Cols() const { return cols; }
+        int BlockDim() const { return D; }
+        int Nnzb() const { return nnzb; }
+
+        // ToCSR drops the zero entries inside the blocks
+        SparseCSR ToCSR() const;
+
+        // SpMV computes y = alpha*A*x + beta*y with the gemm small block kernels, y is not read when beta == 0
+        void SpMV(const float *x, float *y, const float alpha = 1.0, const float beta = 0.0) const;
+
+        // Mul computes C = AB block row by block row with the gemm small block kernels, both operands share D.
+        // Throws std::invalid_argument when the shapes or the block sizes do not match.
+        SparseBSR Mul(const SparseBSR &b) const;
+
+        // CountBlocks returns the number of D x D blocks needed to store A
+        static long long CountBlocks(const SparseCSR &A, const int D);
+    };
+
+} // namespace sparse
+
+#endif // __SPARSE_BSR_H__
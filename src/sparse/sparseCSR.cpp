@@ -1,42 +1,70 @@
 #include "sparseCSR.h"
 
-#include <algorithm> // std::fill_n, std::copy, std::sort
-#include <cstring>   // std::memcpy
-#include <utility>   // std::move
-#include <vector>    // std::vector
+#include "sparseUtils.h" // balancedPartition, rowPrefix, radixSortPairs, compressSortedKeys
+
+#include "gemm_thread.h" // parallelRun, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm>   // std::fill_n, std::copy, std::sort, std::min
+#include <atomic>      // std::atomic
+#include <cstdint>     // uint64_t
+#include <cstring>     // std::memcpy
+#include <limits>      // std::numeric_limits
+#include <memory>      // std::unique_ptr
+#include <stdexcept>   // std::overflow_error, std::invalid_argument
+#include <string>      // std::string
+#include <type_traits> // std::true_type, std::false_type
+#include <utility>     // std::move, std::pair
+#include <vector>      // std::vector
 
 namespace sparse
 {
-    std::ostream &operator<<(std::ostream &out, const sparse::SparseCSR &M)
+    // __checkedSize converts n to T, throws std::overflow_error when n does not fit
+    template <typename T>
+    T __checkedSize(const long long n, const char *what)
+    {
+        if (n < 0 || (unsigned long long)n > (unsigned long long)std::numeric_limits<T>::max())
+        {
+            throw std::overflow_error(std::string("sparse: ") + what + " = " + std::to_string(n) + " does not fit the index type");
+        }
+        return T(n);
+    }
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    std::ostream &operator<<(std::ostream &out, const BasicSparseCSR<IndexT, ValueT, ColT> &M)
     {
         const int pretty = 6;
 
         out << "\n";
         out << "sparse matrix\n";
-        out << "rows = " << M.rows << "\n";
-        out << "cols = " << M.cols << "\n";
-        out << "nnzs = " << M.nnz << "\n";
+        out << "rows = " << M.Rows() << "\n";
+        out << "cols = " << M.Cols() << "\n";
+        out << "nnzs = " << M.Nnz() << "\n";
 
         out << "\n";
-        int nnz = (pretty * 2 < M.nnz) ? pretty * 2 : M.nnz;
-        for (int i = 0; i < nnz; i++)
+        IndexT nnz = (pretty * 2 < M.Nnz()) ? pretty * 2 : M.Nnz();
+        for (IndexT row = 0, i = 0; i < nnz; i++)
         {
-            ElementCOO coo = M.array[i];
-            out << "(" << coo.row << ", " << coo.col << ", " << coo.val << ")\n";
+            while (M.RowStart()[row + 1] <= i)
+            {
+                row++;
+            }
+            out << "(" << row << ", " << M.ColIdx()[i] << ", " << M.Values()[i] << ")\n";
         }
 
-        int rows = (pretty < M.rows) ? pretty : M.rows;
-        int cols = (pretty < M.cols) ? pretty : M.cols;
+        int rows = (pretty < M.Rows()) ? pretty : M.Rows();
+        int cols = (pretty < M.Cols()) ? pretty : M.Cols();
 
-        float *buf = new float[rows * cols];
-        std::fill_n(buf, rows * cols, 0.0);
+        std::vector<ValueT> buf(rows * cols, 0.0);
 
-        for (int i = 0; i < M.nnz; i++)
+        for (int row = 0; row < rows; row++)
         {
-            ElementCOO coo = M.array[i];
-            if (coo.row < rows && coo.col < cols)
+            for (IndexT i = M.RowStart()[row]; i < M.RowStart()[row + 1]; i++)
             {
-                buf[coo.row * cols + coo.col] = coo.val;
+                if (M.ColIdx()[i] < cols)
+                {
+                    buf[row * cols + M.ColIdx()[i]] = M.Values()[i];
+                }
             }
         }
 
@@ -51,123 +79,230 @@ namespace sparse
         }
         out << "\n";
 
-        delete[] buf;
-
         return out;
     }
 
-    SparseCSR::SparseCSR()
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR()
     {
         this->rows = 0;
         this->cols = 0;
         this->nnz = 0;
 
         this->rowStart = nullptr;
-        this->array = nullptr;
+        this->colIdx = nullptr;
+        this->values = nullptr;
     }
 
-    SparseCSR::SparseCSR(const int rows, const int cols, const int nnz)
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz)
     {
+        __checkedSize<ColT>(cols, "cols");
+
         this->rows = rows;
         this->cols = cols;
         this->nnz = nnz;
 
-        this->rowStart = new int[rows + 1];
-        this->array = new ElementCOO[nnz];
+        this->rowStart = gemm::utils::allocArray<IndexT>(rows + 1);
+        this->colIdx = gemm::utils::allocArray<ColT>(nnz);
+        this->values = gemm::utils::allocArray<ValueT>(nnz);
     }
 
-    // isArraySorted = true,  O(nnz)
-    // isArraySorted = false, O(nnz * log(nnz))
-    SparseCSR::SparseCSR(const int rows, const int cols, const int nnz, const ElementCOO *array, const bool isArraySorted)
+    // Entries are packed into (row, col) keys and LSD radix sorted in parallel, duplicate entries are summed.
+    // isArraySorted = true,  O(nnz), the sort is skipped
+    // isArraySorted = false, O(nnz * (bits(rows) + bits(cols)) / RadixBits)
+    // When bits(rows) + bits(cols) > 64 the entries are bucketed by row and every row is sorted on its own.
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz, const Element *array, const bool isArraySorted) : BasicSparseCSR()
     {
-        *this = SparseCSR(rows, cols, nnz); // allocate memory
-
-        int *buf = new int[this->rows];
-
-        // buf saves rowSize
-        std::fill_n(buf, this->rows, 0);
-        for (int i = 0; i < this->nnz; i++)
+        if (utils::fitsPackedKey(rows, cols) == false)
         {
-            buf[array[i].row]++;
-        }
+            // counting sort by row, stable
+            IndexT *start = gemm::utils::allocArray<IndexT>(rows + 1);
+            std::fill_n(start, rows + 1, 0);
+            for (IndexT i = 0; i < nnz; i++)
+            {
+                start[array[i].row + 1]++;
+            }
+            for (IndexT row = 0; row < rows; row++)
+            {
+                start[row + 1] += start[row];
+            }
 
-        // calculate rowStart
-        this->rowStart[0] = 0;
-        for (int i = 1; i < this->rows; i++)
-        {
-            this->rowStart[i] = this->rowStart[i - 1] + buf[i - 1];
-        }
-        this->rowStart[this->rows] = this->nnz;
+            Element *bucket = gemm::utils::allocArray<Element>(nnz);
+            std::vector<IndexT> next(start, start + rows);
+            for (IndexT i = 0; i < nnz; i++)
+            {
+                bucket[next[array[i].row]++] = array[i];
+            }
+            std::vector<IndexT>().swap(next);
 
-        // buf saves rowStart of matrix b
-        std::copy_n(this->rowStart, this->rows, buf);
+            // sort every row by column, distinct[row + 1] counts the distinct columns of row
+            IndexT *distinct = gemm::utils::allocArray<IndexT>(rows + 1);
+            distinct[0] = 0;
+            gemm::utils::parallelFor(0, rows, 1024, [&](const long long begin, const long long end) {
+                for (long long row = begin; row < end; row++)
+                {
+                    std::sort(bucket + start[row], bucket + start[row + 1], [](const Element &e1, const Element &e2) -> bool {
+                        return e1.col < e2.col;
+                    });
+
+                    IndexT count = 0;
+                    for (IndexT i = start[row]; i < start[row + 1]; i++)
+                    {
+                        count += (i == start[row] || bucket[i].col != bucket[i - 1].col);
+                    }
+                    distinct[row + 1] = count;
+                }
+            });
+            for (IndexT row = 0; row < rows; row++)
+            {
+                distinct[row + 1] += distinct[row];
+            }
 
-        // calculate array
-        for (int i = 0; i < this->nnz; i++)
-        {
-            int _i = buf[array[i].row];
+            *this = BasicSparseCSR(rows, cols, distinct[rows]); // allocate memory
+            std::copy_n(distinct, rows + 1, this->rowStart);
 
-            this->array[_i].row = array[i].row;
-            this->array[_i].col = array[i].col;
-            this->array[_i].val = array[i].val;
+            gemm::utils::parallelFor(0, rows, 1024, [&](const long long begin, const long long end) {
+                for (long long row = begin; row < end; row++)
+                {
+                    IndexT p = this->rowStart[row] - 1;
+                    for (IndexT i = start[row]; i < start[row + 1]; i++)
+                    {
+                        if (i == start[row] || bucket[i].col != bucket[i - 1].col)
+                        {
+                            p++;
+                            this->colIdx[p] = bucket[i].col;
+                            this->values[p] = bucket[i].val;
+                        }
+                        else
+                        {
+                            this->values[p] += bucket[i].val; // duplicate entry
+                        }
+                    }
+                }
+            });
 
-            buf[array[i].row]++;
+            gemm::utils::alignedFree(start);
+            gemm::utils::alignedFree(bucket);
+            gemm::utils::alignedFree(distinct);
+            return;
         }
 
-        delete[] buf;
+        const int colBits = utils::bitWidth(cols);
+
+        uint64_t *keys = gemm::utils::allocArray<uint64_t>(nnz);
+        ValueT *vals = gemm::utils::allocArray<ValueT>(nnz);
+
+        gemm::utils::parallelFor(0, nnz, 1 << 16, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                keys[i] = utils::packedKey(array[i].row, array[i].col, colBits);
+                vals[i] = array[i].val;
+            }
+        });
 
         if (isArraySorted == false)
         {
-            // expensive cost
-            this->__sortArray();
+            uint64_t *tmpKeys = gemm::utils::allocArray<uint64_t>(nnz);
+            ValueT *tmpVals = gemm::utils::allocArray<ValueT>(nnz);
+
+            // col digits first, then row digits
+            utils::radixSortPairs(keys, vals, tmpKeys, tmpVals, nnz, 0, colBits + utils::bitWidth(rows));
+
+            gemm::utils::alignedFree(tmpKeys);
+            gemm::utils::alignedFree(tmpVals);
         }
+
+        *this = BasicSparseCSR(rows, cols, __checkedSize<IndexT>(utils::countDistinctKeys(keys, nnz), "nnz")); // allocate memory
+        utils::compressSortedKeys(keys, vals, nnz, rows, colBits, this->rowStart, this->colIdx, this->values);
+
+        gemm::utils::alignedFree(keys);
+        gemm::utils::alignedFree(vals);
     }
 
-    SparseCSR::~SparseCSR()
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz, IndexT *rowStart, ColT *colIdx, ValueT *values, std::shared_ptr<void> storage)
     {
-        if (this->rowStart != nullptr)
-        {
-            delete[] rowStart;
-        }
+        this->rows = rows;
+        this->cols = cols;
+        this->nnz = nnz;
 
-        if (this->array != nullptr)
+        this->rowStart = rowStart;
+        this->colIdx = colIdx;
+        this->values = values;
+
+        this->storage = std::move(storage);
+    }
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::~BasicSparseCSR()
+    {
+        if (this->storage != nullptr)
         {
-            delete[] array;
+            return; // view, the arrays belong to storage
         }
+
+        gemm::utils::alignedFree(rowStart);
+        gemm::utils::alignedFree(colIdx);
+        gemm::utils::alignedFree(values);
     }
 
-    SparseCSR::SparseCSR(const SparseCSR &x)
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR(const BasicSparseCSR &x) : BasicSparseCSR(x.rows, x.cols, x.nnz) // allocate memory
     {
-        *this = SparseCSR(x.rows, x.cols, x.nnz); // allocate memory
+        if (x.rowStart == nullptr) // default constructed
+        {
+            this->rowStart[0] = 0;
+            return;
+        }
 
         std::copy_n(x.rowStart, x.rows + 1, this->rowStart);
-        std::copy_n(x.array, x.nnz, this->array);
+        std::copy_n(x.colIdx, x.nnz, this->colIdx);
+        std::copy_n(x.values, x.nnz, this->values);
     }
 
-    SparseCSR &SparseCSR::operator=(const SparseCSR &x)
+    // The arrays are reused when they are owned and of the same size, otherwise they are replaced by a copy.
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> &BasicSparseCSR<IndexT, ValueT, ColT>::operator=(const BasicSparseCSR &x)
     {
-        *this = SparseCSR(x.rows, x.cols, x.nnz); // allocate memory
+        if (&x == this)
+        {
+            return *this;
+        }
 
+        if (this->storage != nullptr || this->rowStart == nullptr || x.rowStart == nullptr || this->rows != x.rows || this->nnz != x.nnz)
+        {
+            return *this = BasicSparseCSR(x);
+        }
+
+        this->cols = x.cols;
         std::copy_n(x.rowStart, x.rows + 1, this->rowStart);
-        std::copy_n(x.array, x.nnz, this->array);
+        std::copy_n(x.colIdx, x.nnz, this->colIdx);
+        std::copy_n(x.values, x.nnz, this->values);
 
         return *this;
     }
 
-    SparseCSR::SparseCSR(SparseCSR &&x)
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT>::BasicSparseCSR(BasicSparseCSR &&x)
     {
         this->rows = x.rows;
         this->cols = x.cols;
         this->nnz = x.nnz;
 
         this->rowStart = x.rowStart; // move
-        this->array = x.array;
+        this->colIdx = x.colIdx;
+        this->values = x.values;
+        this->storage = std::move(x.storage);
 
         x.rowStart = nullptr;
-        x.array = nullptr;
+        x.colIdx = nullptr;
+        x.values = nullptr;
     }
 
-    SparseCSR &SparseCSR::operator=(SparseCSR &&x)
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> &BasicSparseCSR<IndexT, ValueT, ColT>::operator=(BasicSparseCSR &&x)
     {
         // prevent from moving myself
         if (&x == this)
@@ -175,225 +310,768 @@ namespace sparse
             return *this;
         }
 
+        if (this->storage == nullptr) // release my own arrays, a view only drops its storage
+        {
+            gemm::utils::alignedFree(this->rowStart);
+            gemm::utils::alignedFree(this->colIdx);
+            gemm::utils::alignedFree(this->values);
+        }
+
         this->rows = x.rows;
         this->cols = x.cols;
         this->nnz = x.nnz;
 
         this->rowStart = x.rowStart; // move
-        this->array = x.array;
+        this->colIdx = x.colIdx;
+        this->values = x.values;
+        this->storage = std::move(x.storage);
 
         x.rowStart = nullptr;
-        x.array = nullptr;
+        x.colIdx = nullptr;
+        x.values = nullptr;
 
         return *this;
     }
 
-    // O(nnz * log(nnz))
-    void SparseCSR::__sortArray()
-    {
-        std::sort(this->array, this->array + this->nnz, [](const ElementCOO &e1, const ElementCOO &e2) -> bool {
-            if (e1.row == e2.row)
-            {
-                return e1.col < e2.col;
-            }
-            return e1.row < e2.row;
-        });
-    }
-
     // O(nnz)
-    void SparseCSR::__buildRowStartFromArray()
+    template <typename IndexT, typename ValueT, typename ColT>
+    std::vector<BasicElementCOO<IndexT, ValueT>> BasicSparseCSR<IndexT, ValueT, ColT>::ToCOO() const
     {
-        int *buf = new int[this->rows]; // save rowSize
-        std::fill_n(buf, this->rows, 0);
+        std::vector<Element> array(this->nnz);
 
-        for (int i = 0; i < 0; i++)
+        for (IndexT i = 0; i < this->rows; i++)
         {
-            buf[this->array[i].row]++;
-        }
-
-        this->rowStart[0] = 0;
-        for (int i = 1; i < this->rows; i++)
-        {
-            this->rowStart[i] = this->rowStart[i - 1] + buf[i - 1];
+            for (IndexT k = this->rowStart[i]; k < this->rowStart[i + 1]; k++)
+            {
+                array[k] = Element{i, this->colIdx[k], this->values[k]};
+            }
         }
-        this->rowStart[this->rows] = this->nnz;
 
-        delete[] buf;
+        return array;
     }
 
-    // O(nnz)
-    SparseCSR SparseCSR::Transpose()
+    // The CSR form of the transpose is the CSC form of this matrix.
+    // Entries are packed into (col, row) keys in row-major order and radix sorted in parallel by col only,
+    // the sort is stable so the rows stay sorted inside every column.
+    // O(nnz * bits(cols) / RadixBits)
+    // When bits(rows) + bits(cols) > 64 a serial counting sort by col is used instead, O(nnz + cols).
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::Transpose() const
     {
-        SparseCSR b(this->cols, this->rows, this->nnz); // allocate memory
+        BasicSparseCSR b(this->cols, this->rows, this->nnz); // allocate memory
 
-        if (nnz > 0)
+        if (utils::fitsPackedKey(this->cols, this->rows) == false)
         {
-            int *buf = new int[b.rows];
+            std::fill_n(b.rowStart, b.rows + 1, 0);
+            for (IndexT i = 0; i < this->nnz; i++)
+            {
+                b.rowStart[this->colIdx[i] + 1]++;
+            }
+            for (IndexT col = 0; col < b.rows; col++)
+            {
+                b.rowStart[col + 1] += b.rowStart[col];
+            }
 
-            // buf saves rowSize of matrix b
-            std::fill_n(buf, b.rows, 0);
-            for (int i = 0; i < b.nnz; i++)
+            std::vector<IndexT> next(b.rowStart, b.rowStart + b.rows);
+            for (IndexT row = 0; row < this->rows; row++)
             {
-                buf[this->array[i].col]++;
+                for (IndexT i = this->rowStart[row]; i < this->rowStart[row + 1]; i++)
+                {
+                    IndexT p = next[this->colIdx[i]]++;
+                    b.colIdx[p] = row;
+                    b.values[p] = this->values[i];
+                }
             }
 
-            // calculate rowStart of matrix b
-            b.rowStart[0] = 0;
-            for (int i = 1; i < b.rows; i++)
+            return b;
+        }
+
+        const int rowBits = utils::bitWidth(this->rows);
+
+        uint64_t *keys = gemm::utils::allocArray<uint64_t>(this->nnz);
+        ValueT *vals = gemm::utils::allocArray<ValueT>(this->nnz);
+        uint64_t *tmpKeys = gemm::utils::allocArray<uint64_t>(this->nnz);
+        ValueT *tmpVals = gemm::utils::allocArray<ValueT>(this->nnz);
+
+        gemm::utils::parallelFor(0, this->rows, 1024, [&](const long long begin, const long long end) {
+            for (long long row = begin; row < end; row++)
             {
-                b.rowStart[i] = b.rowStart[i - 1] + buf[i - 1];
+                for (IndexT i = this->rowStart[row]; i < this->rowStart[row + 1]; i++)
+                {
+                    keys[i] = utils::packedKey(this->colIdx[i], row, rowBits);
+                    vals[i] = this->values[i];
+                }
             }
-            b.rowStart[b.rows] = b.nnz;
+        });
+
+        utils::radixSortPairs(keys, vals, tmpKeys, tmpVals, this->nnz, rowBits, rowBits + utils::bitWidth(this->cols));
 
-            // buf saves rowStart of matrix b
-            std::copy_n(b.rowStart, b.rows, buf);
+        utils::compressSortedKeys(keys, vals, b.nnz, b.rows, rowBits, b.rowStart, b.colIdx, b.values);
 
-            // calculate array
+        gemm::utils::alignedFree(keys);
+        gemm::utils::alignedFree(vals);
+        gemm::utils::alignedFree(tmpKeys);
+        gemm::utils::alignedFree(tmpVals);
 
-            for (int i = 0; i < b.nnz; i++)
+        return b;
+    }
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    class RowAccumulator; // see Mul
+
+    // rows of more terms than this are summed in a RowAccumulator, fewer are merged by a scan over the cursors
+    const int MergeScanMax = 8;
+
+    // __MergeCursor is one row of a k-way merge, head is the column at col, the largest ColT once the row is done
+    template <typename ColT, typename ValueT>
+    struct __MergeCursor
+    {
+        ColT head;
+        const ColT *col;
+        const ColT *last;
+        const ValueT *value;
+        ValueT scale;
+    };
+
+    // Every row of the result is the merge of the rows of the terms: a symbolic pass counts the distinct
+    // columns of every row to size the output, a numeric pass merges again and writes sum_k alpha[k] * value.
+    // Both passes run over ranges of rows of equal input size, no intermediate matrix is created:
+    // up to MergeScanMax terms a row is a k-way merge that emits the smallest column of all cursors at every step,
+    // beyond that the row is summed in a hash or dense RowAccumulator (as in Mul) and sorted.
+    // O(min(n, MergeScanMax) * sum_k nnz(terms[k])) plus the sort of the accumulated rows
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::LinearCombination(const BasicSparseCSR *const *terms, const ValueT *alpha, const int n)
+    {
+        if (n < 1)
+        {
+            throw std::invalid_argument("sparse: LinearCombination needs at least one term");
+        }
+        for (int k = 1; k < n; k++)
+        {
+            if (terms[k]->rows != terms[0]->rows || terms[k]->cols != terms[0]->cols)
             {
-                int j = buf[this->array[i].col];
+                throw std::invalid_argument("sparse: LinearCombination shapes do not match");
+            }
+        }
 
-                b.array[j].row = this->array[i].col;
-                b.array[j].col = this->array[i].row;
-                b.array[j].val = this->array[i].val;
+        const IndexT rows = terms[0]->rows;
 
-                buf[array[i].col]++;
+        std::vector<long long> inputPrefix = utils::rowPrefix(rows, [&](const IndexT row) -> long long {
+            long long size = 0;
+            for (int k = 0; k < n; k++)
+            {
+                size += terms[k]->rowStart[row + 1] - terms[k]->rowStart[row];
             }
+            return size;
+        });
+        std::vector<IndexT> bounds = utils::balancedPartition(inputPrefix.data(), rows, gemm::utils::numThreads() * 8);
+
+        BasicSparseCSR c;
+        c.rows = rows;
+        c.cols = terms[0]->cols;
+        c.rowStart = gemm::utils::allocArray<IndexT>(c.rows + 1);
+        c.rowStart[0] = 0;
+
+        // mergeRows(numeric) merges every row: the symbolic pass (std::false_type) saves the size of row in
+        // rowStart[row + 1], the numeric pass (std::true_type) writes the row to colIdx and values.
+        // The cursors are local pointers so the merge loop does not reload them after every store.
+        auto mergeRows = [&](auto numeric) {
+            gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+                std::vector<const ColT *> cursor(n), last(n);
+                std::vector<const ValueT *> value(n);
+                std::vector<ValueT> scale(n);
+                std::vector<__MergeCursor<ColT, ValueT>> merge(std::min(n, MergeScanMax));
+                RowAccumulator<IndexT, ValueT, ColT> acc(c.cols);
+                for (IndexT row = bounds[begin]; row < bounds[end]; row++)
+                {
+                    int active = 0;
+                    for (int k = 0; k < n; k++)
+                    {
+                        const BasicSparseCSR &t = *terms[k];
+                        if (t.rowStart[row] < t.rowStart[row + 1])
+                        {
+                            cursor[active] = t.colIdx + t.rowStart[row];
+                            last[active] = t.colIdx + t.rowStart[row + 1];
+                            value[active] = t.values + t.rowStart[row];
+                            scale[active] = alpha[k];
+                            active++;
+                        }
+                    }
+
+                    IndexT count = 0;
+                    ColT *outCol = nullptr;
+                    ValueT *outVal = nullptr;
+                    if constexpr (decltype(numeric)::value)
+                    {
+                        outCol = c.colIdx + c.rowStart[row];
+                        outVal = c.values + c.rowStart[row];
+                    }
+                    auto emit = [&](const ColT col, const ValueT sum) {
+                        if constexpr (decltype(numeric)::value)
+                        {
+                            *outCol++ = col;
+                            *outVal++ = sum;
+                        }
+                        count++;
+                    };
+
+                    // three to MergeScanMax rows: each step emits the smallest head with the sum over the rows on it,
+                    // finished rows keep the largest head until two rows are left for the two-way merge below,
+                    // more rows go through the accumulator
+                    if (active > 2 && active <= MergeScanMax)
+                    {
+                        const ColT done = std::numeric_limits<ColT>::max(); // above every column
+                        const int m = active;
+                        for (int k = 0; k < m; k++)
+                        {
+                            merge[k] = {*cursor[k], cursor[k], last[k], value[k], scale[k]};
+                        }
+
+                        while (active > 2)
+                        {
+                            ColT col = merge[0].head;
+                            for (int k = 1; k < m; k++)
+                            {
+                                col = std::min(col, merge[k].head);
+                            }
+
+                            ValueT sum = 0;
+                            for (int k = 0; k < m; k++)
+                            {
+                                __MergeCursor<ColT, ValueT> &r = merge[k];
+                                if (r.head != col)
+                                {
+                                    continue;
+                                }
+                                if constexpr (decltype(numeric)::value)
+                                {
+                                    sum += r.scale * *r.value;
+                                }
+                                r.value++;
+                                if (++r.col == r.last)
+                                {
+                                    r.head = done;
+                                    active--;
+                                }
+                                else
+                                {
+                                    r.head = *r.col;
+                                }
+                            }
+                            emit(col, sum);
+                        }
+
+                        active = 0;
+                        for (int k = 0; k < m; k++)
+                        {
+                            if (merge[k].head != done)
+                            {
+                                cursor[active] = merge[k].col;
+                                last[active] = merge[k].last;
+                                value[active] = merge[k].value;
+                                scale[active] = merge[k].scale;
+                                active++;
+                            }
+                        }
+                    }
+                    else if (active > 2)
+                    {
+                        long long length = 0;
+                        for (int k = 0; k < active; k++)
+                        {
+                            length += last[k] - cursor[k];
+                        }
+                        acc.BeginRow(length);
+                        for (int k = 0; k < active; k++)
+                        {
+                            const ValueT *v = value[k];
+                            for (const ColT *col = cursor[k]; col < last[k]; col++, v++)
+                            {
+                                if constexpr (decltype(numeric)::value)
+                                {
+                                    acc.Accumulate(*col, scale[k] * *v);
+                                }
+                                else
+                                {
+                                    acc.Insert(*col);
+                                }
+                            }
+                        }
+                        if constexpr (decltype(numeric)::value)
+                        {
+                            acc.EndRow(outCol, outVal);
+                        }
+                        else
+                        {
+                            count = acc.Size();
+                            acc.ClearRow();
+                        }
+                        active = 0;
+                    }
+
+                    if (active == 2)
+                    {
+                        const ColT *c0 = cursor[0], *c1 = cursor[1];
+                        const ValueT *v0 = value[0], *v1 = value[1];
+                        while (c0 < last[0] && c1 < last[1])
+                        {
+                            if (*c0 < *c1)
+                            {
+                                emit(*c0++, scale[0] * *v0++);
+                            }
+                            else if (*c0 > *c1)
+                            {
+                                emit(*c1++, scale[1] * *v1++);
+                            }
+                            else
+                            {
+                                emit(*c0++, scale[0] * *v0++ + scale[1] * *v1++);
+                                c1++;
+                            }
+                        }
+
+                        // the unfinished row is left in slot 0
+                        const bool second = (c0 == last[0]);
+                        cursor[0] = second ? c1 : c0;
+                        last[0] = second ? last[1] : last[0];
+                        value[0] = second ? v1 : v0;
+                        scale[0] = second ? scale[1] : scale[0];
+                        active = 1;
+                    }
+
+                    if (active == 1)
+                    {
+                        for (const ColT *col = cursor[0]; col < last[0]; col++)
+                        {
+                            emit(*col, scale[0] * *value[0]++);
+                        }
+                    }
+
+                    if constexpr (decltype(numeric)::value == false)
+                    {
+                        c.rowStart[row + 1] = count;
+                    }
+                }
+            });
+        };
+
+        mergeRows(std::false_type()); // symbolic pass
 
-            delete[] buf;
+        long long total = 0;
+        for (IndexT row = 0; row < c.rows; row++)
+        {
+            total += c.rowStart[row + 1];
+            c.rowStart[row + 1] = total;
         }
 
-        return std::move(b);
+        c.nnz = __checkedSize<IndexT>(total, "nnz of the linear combination");
+        c.colIdx = gemm::utils::allocArray<ColT>(c.nnz);
+        c.values = gemm::utils::allocArray<ValueT>(c.nnz);
+
+        mergeRows(std::true_type()); // numeric pass
+
+        return c;
     }
 
-    // O(nzz)
-    SparseCSR SparseCSR::Add(const SparseCSR &b)
+    // O(nnz(a) + nnz(b)), the output is sized exactly by a symbolic merge
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::Add(const BasicSparseCSR &b) const
     {
-        // std::assert(this->rows == b.rows && this->cols == b.cols);
+        const BasicSparseCSR *terms[2] = {this, &b};
+        const ValueT alpha[2] = {1, 1};
 
-        SparseCSR c(this->rows, this->cols, this->nnz + b.nnz);
-        int i = 0;
-        int j = 0;
-        int p = 0;
+        return LinearCombination(terms, alpha, 2);
+    }
 
-        while (i < this->nnz && j < b.nnz)
+    // O(nnz(a) + nnz(b)), the output is sized exactly by a symbolic merge
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::Sub(const BasicSparseCSR &b) const
+    {
+        const BasicSparseCSR *terms[2] = {this, &b};
+        const ValueT alpha[2] = {1, -1};
+
+        return LinearCombination(terms, alpha, 2);
+    }
+
+    // RowAccumulator accumulates one row of C = AB at a time, it is private to one thread.
+    // Short rows use an open addressing hash table sized by the row flops,
+    // long rows use a dense accumulator of length b.cols which is allocated on first use.
+    template <typename IndexT, typename ValueT, typename ColT>
+    class RowAccumulator
+    {
+    private:
+        IndexT cols;
+
+        // hash accumulator
+        std::vector<ColT> hashKeys; // -1 = empty
+        std::vector<ValueT> hashVals;
+        int hashMask = 0;
+
+        // dense accumulator
+        std::vector<ValueT> denseVals;
+        std::vector<IndexT> denseMarker; // denseMarker[col] == rowTag means col is used by the current row
+        IndexT rowTag = -1;
+
+        std::vector<ColT> touched; // hash slots or dense columns of the current row, in insertion order
+        std::vector<std::pair<ColT, ValueT>> sorted;
+        bool useHash = true;
+
+    public:
+        // rows with more flops than this, or with flops close to cols, go to the dense accumulator
+        static const int HashMaxSize = 1 << 14;
+
+        explicit RowAccumulator(const IndexT cols)
         {
-            ElementCOO aCOO = this->array[i];
-            ElementCOO bCOO = b.array[j];
+            this->cols = cols;
+        }
 
-            int aIndex = aCOO.row * cols + aCOO.col;
-            int bIndex = bCOO.row * cols + bCOO.col;
+        void BeginRow(const long long rowFlops)
+        {
+            touched.clear();
+            useHash = rowFlops <= HashMaxSize && rowFlops * 8 < cols;
 
-            if (aIndex < bIndex)
+            if (useHash)
             {
-                c.array[p] = aCOO;
-                p++;
-                i++;
+                int size = 16;
+                while (size < rowFlops * 4) // load factor <= 1/4
+                {
+                    size <<= 1;
+                }
+                if ((int)hashKeys.size() < size)
+                {
+                    hashKeys.assign(size, -1);
+                    hashVals.resize(size);
+                }
+                hashMask = size - 1;
             }
-            else if (aIndex > bIndex)
+            else
             {
-                c.array[p] = bCOO;
-                p++;
-                j++;
+                if (denseMarker.empty())
+                {
+                    denseVals.resize(cols);
+                    denseMarker.assign(cols, -1);
+                }
+                rowTag++;
+            }
+        }
+
+        void Accumulate(const ColT col, const ValueT val)
+        {
+            if (useHash)
+            {
+                int h = (uint32_t(uint64_t(col) ^ (uint64_t(col) >> 32)) * 2654435761u) & hashMask;
+                while (hashKeys[h] != col && hashKeys[h] != -1)
+                {
+                    h = (h + 1) & hashMask;
+                }
+                if (hashKeys[h] == -1)
+                {
+                    hashKeys[h] = col;
+                    hashVals[h] = val;
+                    touched.push_back(h);
+                }
+                else
+                {
+                    hashVals[h] += val;
+                }
             }
             else
             {
-                c.array[p] = aCOO;
-                c.array[p].val += bCOO.val;
-                p++;
-                i++;
-                j++;
+                if (denseMarker[col] != rowTag)
+                {
+                    denseMarker[col] = rowTag;
+                    denseVals[col] = val;
+                    touched.push_back(col);
+                }
+                else
+                {
+                    denseVals[col] += val;
+                }
             }
         }
 
-        while (i < this->nnz)
+        // Insert marks col as used by the row without a value, used by the symbolic phase (then ClearRow)
+        void Insert(const ColT col)
         {
-            c.array[p] = this->array[i];
-            p++;
-            i++;
+            if (useHash)
+            {
+                int h = (uint32_t(uint64_t(col) ^ (uint64_t(col) >> 32)) * 2654435761u) & hashMask;
+                while (hashKeys[h] != col && hashKeys[h] != -1)
+                {
+                    h = (h + 1) & hashMask;
+                }
+                if (hashKeys[h] == -1)
+                {
+                    hashKeys[h] = col;
+                    touched.push_back(h);
+                }
+            }
+            else if (denseMarker[col] != rowTag)
+            {
+                denseMarker[col] = rowTag;
+                touched.push_back(col);
+            }
         }
 
-        while (j < b.nnz)
+        IndexT Size() const
         {
-            c.array[p] = b.array[j];
-            p++;
-            j++;
+            return touched.size();
         }
 
-        // resize non-zero element
-        if (p < this->nnz + b.nnz)
+        // EndRow writes the row sorted by column and resets the accumulator
+        void EndRow(ColT *colIdx, ValueT *values)
         {
-            ElementCOO *_array = new ElementCOO[p];
-            std::copy_n(c.array, p, _array);
-            delete[] c.array;
-            c.array = _array;
-
-            c.nnz = p;
+            if (useHash)
+            {
+                sorted.clear();
+                for (ColT slot : touched)
+                {
+                    sorted.emplace_back(hashKeys[slot], hashVals[slot]);
+                    hashKeys[slot] = -1;
+                }
+                std::sort(sorted.begin(), sorted.end(), [](const std::pair<ColT, ValueT> &e1, const std::pair<ColT, ValueT> &e2) -> bool {
+                    return e1.first < e2.first;
+                });
+                for (size_t k = 0; k < sorted.size(); k++)
+                {
+                    colIdx[k] = sorted[k].first;
+                    values[k] = sorted[k].second;
+                }
+            }
+            else
+            {
+                std::sort(touched.begin(), touched.end());
+                for (size_t k = 0; k < touched.size(); k++)
+                {
+                    colIdx[k] = touched[k];
+                    values[k] = denseVals[touched[k]];
+                }
+            }
         }
 
-        c.__buildRowStartFromArray();
-
-        return std::move(c);
-    }
+        // ClearRow forgets the row without writing it, used by the symbolic phase
+        void ClearRow()
+        {
+            if (useHash)
+            {
+                for (ColT slot : touched)
+                {
+                    hashKeys[slot] = -1;
+                }
+            }
+        }
+    };
 
-    SparseCSR SparseCSR::Sub(const SparseCSR &b)
+    // __CSRRows reads the rows of an operand of Mul stored as CSR
+    template <typename IndexT, typename ValueT, typename ColT>
+    struct __CSRRows
     {
-        // std::assert(this->rows == b.rows && this->cols == b.cols);
+        const IndexT *rowStart;
+        const ColT *colIdx;
+        const ValueT *values;
 
-        // TODO
+        explicit __CSRRows(const BasicSparseCSR<IndexT, ValueT, ColT> &A) : rowStart(A.RowStart()), colIdx(A.ColIdx()), values(A.Values()) {}
 
-        return SparseCSR();
-    }
+        IndexT Begin(const IndexT row) const { return rowStart[row]; }
+        IndexT End(const IndexT row) const { return rowStart[row + 1]; }
+        IndexT Col(const IndexT k) const { return colIdx[k]; }
+        ValueT Val(const IndexT k) const { return values[k]; }
+    };
 
-    // C = AB
-    // O( max(A.rows, A.nnz) * B.cols )
-    SparseCSR SparseCSR::Mul(const SparseCSR &b)
+    // __CSCRows reads the rows of a transposed operand of Mul: the columns of the matrix behind a CSCView
+    template <typename IndexT, typename ValueT, typename ColT>
+    struct __CSCRows
     {
-        // std::assert(this->cols == b.rows);
-        SparseCSR c(this->rows, b.cols, 0);
-
-        std::vector<ElementCOO> _array;
-
-        std::vector<float> tmpRowOfC(c.cols); // save a row of matrix C
-
-        int cur = 0;
+        const IndexT *colStart;
+        const IndexT *rowIdx;
+        const IndexT *pos;
+        const ValueT *values;
+
+        __CSCRows(const BasicSparseCSCView<IndexT, ValueT, ColT> &V, const BasicSparseCSR<IndexT, ValueT, ColT> &A) : colStart(V.ColStart()), rowIdx(V.RowIdx()), pos(V.Pos()), values(A.Values()) {}
+
+        IndexT Begin(const IndexT row) const { return colStart[row]; }
+        IndexT End(const IndexT row) const { return colStart[row + 1]; }
+        IndexT Col(const IndexT k) const { return rowIdx[k]; }
+        ValueT Val(const IndexT k) const { return values[pos[k]]; }
+    };
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSCView<IndexT, ValueT, ColT>::BasicSparseCSCView(const BasicSparseCSR<IndexT, ValueT, ColT> &A)
+        : rows(A.Rows()), cols(A.Cols()), nnz(A.Nnz()), rowStart(A.RowStart()), colStart(A.Cols() + 1, 0), rowIdx(A.Nnz()), pos(A.Nnz())
+    {
+        const IndexT *rowStart = A.RowStart();
+        const ColT *colIdx = A.ColIdx();
 
-        while (cur < this->nnz)
+        // counting sort by column, rows are visited in order so every column is sorted by row
+        for (IndexT k = 0; k < A.Nnz(); k++)
         {
-            std::fill(tmpRowOfC.begin(), tmpRowOfC.end(), 0.0);
-
-            // calculate the rowA-th row of C
+            this->colStart[colIdx[k] + 1]++;
+        }
+        for (IndexT col = 0; col < A.Cols(); col++)
+        {
+            this->colStart[col + 1] += this->colStart[col];
+        }
 
-            int rowA = this->array[cur].row;
-            while (cur < this->nnz && this->array[cur].row == rowA)
+        std::vector<IndexT> next(this->colStart.begin(), this->colStart.end() - 1);
+        for (IndexT row = 0; row < A.Rows(); row++)
+        {
+            for (IndexT k = rowStart[row]; k < rowStart[row + 1]; k++)
             {
-                int colA = this->array[cur].col;
-                for (int i = b.rowStart[colA]; i < b.rowStart[colA + 1]; i++)
-                {
-                    int colB = b.array[i].col;
-                    tmpRowOfC[colB] += this->array[cur].val * b.array[i].val; // +=
-                }
-                cur++;
+                const IndexT p = next[colIdx[k]]++;
+                this->rowIdx[p] = row;
+                this->pos[p] = k;
             }
+        }
+    }
 
-            for (int colC = 0; colC < c.cols; colC++)
+    // C = AB, Gustavson's row-wise algorithm in two phases:
+    // symbolic phase counts the non-zeros of every row of C, numeric phase fills the preallocated arrays.
+    // Rows are split into ranges of equal flops which are handed out dynamically to the threads.
+    // a and b give the rows of the operands (__CSRRows, __CSCRows for a transposed one).
+    // O( flops )
+    template <typename IndexT, typename ValueT, typename ColT>
+    template <typename RowsA, typename RowsB>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::__mul(const RowsA &a, const RowsB &b, const IndexT rows, const IndexT cols)
+    {
+        // flops of every row of C
+        std::vector<long long> flopsPrefix = utils::rowPrefix(rows, [&](const IndexT row) -> long long {
+            long long flops = 0;
+            for (IndexT k = a.Begin(row); k < a.End(row); k++)
             {
-                if (tmpRowOfC[colC] != 0.0)
+                flops += b.End(a.Col(k)) - b.Begin(a.Col(k));
+            }
+            return flops;
+        });
+
+        std::vector<IndexT> bounds = utils::balancedPartition(flopsPrefix.data(), rows, gemm::utils::numThreads() * 8);
+        const int ranges = bounds.size() - 1;
+
+        // runs phase(accumulator, row) over all rows of C in parallel,
+        // the symbolic pass only inserts the columns and never reads the values of a or b
+        auto forEachRow = [&](const bool symbolic, auto phase) {
+            std::atomic<int> next(0);
+            gemm::utils::parallelRun([&](const int, const int) {
+                RowAccumulator<IndexT, ValueT, ColT> acc(cols);
+                for (int r = next++; r < ranges; r = next++)
                 {
-                    _array.push_back(ElementCOO{rowA, colC, tmpRowOfC[colC]});
+                    for (IndexT row = bounds[r]; row < bounds[r + 1]; row++)
+                    {
+                        acc.BeginRow(flopsPrefix[row + 1] - flopsPrefix[row]);
+                        for (IndexT k = a.Begin(row); k < a.End(row); k++)
+                        {
+                            const IndexT colA = a.Col(k);
+                            if (symbolic)
+                            {
+                                for (IndexT i = b.Begin(colA); i < b.End(colA); i++)
+                                {
+                                    acc.Insert(b.Col(i));
+                                }
+                                continue;
+                            }
+
+                            const ValueT valA = a.Val(k);
+                            for (IndexT i = b.Begin(colA); i < b.End(colA); i++)
+                            {
+                                acc.Accumulate(b.Col(i), valA * b.Val(i)); // +=
+                            }
+                        }
+                        phase(acc, row);
+                    }
                 }
-            }
+            });
+        };
+
+        BasicSparseCSR c;
+        c.rows = rows;
+        c.cols = cols;
+        c.rowStart = gemm::utils::allocArray<IndexT>(c.rows + 1);
+
+        // symbolic phase: rowStart[row + 1] saves the size of row
+        c.rowStart[0] = 0;
+        forEachRow(true, [&](RowAccumulator<IndexT, ValueT, ColT> &acc, const IndexT row) {
+            c.rowStart[row + 1] = acc.Size();
+            acc.ClearRow();
+        });
+
+        // the row sizes fit IndexT, their sum may not
+        long long total = 0;
+        for (IndexT row = 0; row < c.rows; row++)
+        {
+            total += c.rowStart[row + 1];
+            c.rowStart[row + 1] = total;
         }
 
-        // foolish code !!!
-        c.nnz = _array.size();
-        c.array = new ElementCOO[c.nnz];
-        std::copy_n(_array.data(), c.nnz, c.array);
+        c.nnz = __checkedSize<IndexT>(total, "nnz(ab)");
+        c.colIdx = gemm::utils::allocArray<ColT>(c.nnz);
+        c.values = gemm::utils::allocArray<ValueT>(c.nnz);
+
+        // numeric phase
+        forEachRow(false, [&](RowAccumulator<IndexT, ValueT, ColT> &acc, const IndexT row) {
+            acc.EndRow(c.colIdx + c.rowStart[row], c.values + c.rowStart[row]);
+        });
+
+        return c;
+    }
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::Mul(const BasicSparseCSR &b) const
+    {
+        return Mul(b, MulNN); // checks the shapes
+    }
+
+    template <typename IndexT, typename ValueT, typename ColT>
+    BasicSparseCSR<IndexT, ValueT, ColT> BasicSparseCSR<IndexT, ValueT, ColT>::Mul(const BasicSparseCSR &b, const MulTrans trans, const CSCView *thisView, const CSCView *bView) const
+    {
+        const bool transA = (trans == MulTN || trans == MulTT);
+        const bool transB = (trans == MulNT || trans == MulTT);
+
+        const IndexT rows = transA ? this->cols : this->rows;
+        const IndexT inner = transA ? this->rows : this->cols;
+        const IndexT innerB = transB ? b.cols : b.rows;
+        const IndexT cols = transB ? b.rows : b.cols;
+        if (inner != innerB)
+        {
+            throw std::invalid_argument("sparse: Mul shapes do not match");
+        }
+        __checkedSize<ColT>(cols, "cols(ab)"); // the rows of a transposed b become columns
 
-        c.__buildRowStartFromArray();
+        // views of the transposed operands, built here when the caller has none
+        std::unique_ptr<CSCView> ownA, ownB;
+        if (transA && thisView == nullptr)
+        {
+            ownA.reset(new CSCView(*this));
+            thisView = ownA.get();
+        }
+        if (transB && bView == nullptr)
+        {
+            ownB.reset(new CSCView(b));
+            bView = ownB.get();
+        }
+        if ((transA && !thisView->BuiltFrom(*this)) || (transB && !bView->BuiltFrom(b)))
+        {
+            throw std::invalid_argument("sparse: Mul view of another matrix");
+        }
 
-        return std::move(c);
+        typedef __CSRRows<IndexT, ValueT, ColT> CSRRows;
+        typedef __CSCRows<IndexT, ValueT, ColT> CSCRows;
+        switch (trans)
+        {
+        case MulTN:
+            return __mul(CSCRows(*thisView, *this), CSRRows(b), rows, cols);
+        case MulNT:
+            return __mul(CSRRows(*this), CSCRows(*bView, b), rows, cols);
+        case MulTT:
+            return __mul(CSCRows(*thisView, *this), CSCRows(*bView, b), rows, cols);
+        default:
+            return __mul(CSRRows(*this), CSRRows(b), rows, cols);
+        }
     }
 
-} // namespace sparse
\ No newline at end of file
+#define SPARSE_INSTANTIATE_CSR(IndexT, ColT, ValueT)         \
+    template class BasicSparseCSR<IndexT, ValueT, ColT>;     \
+    template class BasicSparseCSCView<IndexT, ValueT, ColT>; \
+    template std::ostream &operator<<(std::ostream &out, const BasicSparseCSR<IndexT, ValueT, ColT> &M);
+
+    SPARSE_FOR_EACH_CSR_TYPE(SPARSE_INSTANTIATE_CSR)
+
+} // namespace sparse
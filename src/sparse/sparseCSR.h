@@ -1,52 +1,178 @@
 #ifndef __SPARSE_CSR_H__
 #define __SPARSE_CSR_H__
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 namespace sparse
 {
-    struct ElementCOO
+    // BasicElementCOO is the interchange format used to build and export BasicSparseCSR.
+    template <typename IndexT, typename ValueT>
+    struct BasicElementCOO
     {
-        int row;
-        int col;
-        float val;
+        IndexT row;
+        IndexT col;
+        ValueT val;
     };
 
-    class SparseCSR
+    template <typename IndexT, typename ValueT, typename ColT>
+    class BasicSparseCSCView;
+
+    // MulTrans selects the operands of BasicSparseCSR::Mul used transposed: MulTN is A^T * B, MulNT is A * B^T
+    enum MulTrans
     {
-        friend std::ostream &operator<<(std::ostream &out, const sparse::SparseCSR &M);
+        MulNN,
+        MulTN,
+        MulNT,
+        MulTT,
+    };
+
+    // BasicSparseCSR stores the non-zeros of row i in [rowStart[i], rowStart[i + 1]) of colIdx and values,
+    // columns are sorted inside a row. Both arrays are 64-byte aligned.
+    //   IndexT: rows, cols, nnz and rowStart, int or int64_t
+    //   ValueT: float or double
+    //   ColT:   colIdx, int by default to halve the index traffic of large-nnz matrices, int64_t when cols >= 2^31
+    // Sizes that do not fit IndexT or ColT throw std::overflow_error.
+    template <typename IndexT, typename ValueT, typename ColT = int>
+    class BasicSparseCSR
+    {
+    public:
+        typedef IndexT Index;
+        typedef ValueT Value;
+        typedef ColT ColIndex;
+        typedef BasicElementCOO<IndexT, ValueT> Element;
+        typedef BasicSparseCSCView<IndexT, ValueT, ColT> CSCView;
 
     private:
-        int rows;
-        int cols;
-        int nnz;
+        IndexT rows;
+        IndexT cols;
+        IndexT nnz;
+
+        IndexT *rowStart;
+        ColT *colIdx;
+        ValueT *values;
+
+        // storage owns the arrays of a view (e.g. a memory mapped file), nullptr when the arrays are allocated by BasicSparseCSR
+        std::shared_ptr<void> storage;
 
-        int *rowStart;
-        ElementCOO *array;
+        // __mul is Gustavson's algorithm on row accessors (see Mul), op(A) has `rows` rows and op(B) `cols` columns
+        template <typename RowsA, typename RowsB>
+        static BasicSparseCSR __mul(const RowsA &a, const RowsB &b, const IndexT rows, const IndexT cols);
 
     public:
-        SparseCSR();
-        SparseCSR(const int rows, const int cols, const int nnz);
-        SparseCSR(const int rows, const int cols, const int nnz, const ElementCOO *array, const bool isArraySorted = false);
+        BasicSparseCSR();
+        BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz);
+        // builds the matrix from nnz entries of array, entries with the same (row, col) are summed
+        BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz, const Element *array, const bool isArraySorted = false);
+
+        // builds a view on arrays kept alive by storage, nothing is copied
+        BasicSparseCSR(const IndexT rows, const IndexT cols, const IndexT nnz, IndexT *rowStart, ColT *colIdx, ValueT *values, std::shared_ptr<void> storage);
+
+        ~BasicSparseCSR();
+
+        BasicSparseCSR(const BasicSparseCSR &x);
+        BasicSparseCSR &operator=(const BasicSparseCSR &x);
+
+        BasicSparseCSR(BasicSparseCSR &&x);
+        BasicSparseCSR &operator=(BasicSparseCSR &&x);
+
+        IndexT Rows() const { return rows; }
+        IndexT Cols() const { return cols; }
+        IndexT Nnz() const { return nnz; }
+        bool IsView() const { return storage != nullptr; }
+
+        const IndexT *RowStart() const { return rowStart; }
+        const ColT *ColIdx() const { return colIdx; }
+        const ValueT *Values() const { return values; }
+        ValueT *Values() { return values; }
 
-        ~SparseCSR();
+        // writable structure for the functions that fill a matrix allocated with (rows, cols, nnz),
+        // they keep rowStart[0] == 0, rowStart[rows] == nnz and the columns of every row sorted
+        IndexT *RowStart() { return rowStart; }
+        ColT *ColIdx() { return colIdx; }
 
-        SparseCSR(const SparseCSR &x);
-        SparseCSR &operator=(const SparseCSR &x);
+        std::vector<Element> ToCOO() const;
 
-        SparseCSR(SparseCSR &&x);
-        SparseCSR &operator=(SparseCSR &&x);
+        BasicSparseCSR Transpose() const;
+        BasicSparseCSR Add(const BasicSparseCSR &b) const;
+        BasicSparseCSR Sub(const BasicSparseCSR &b) const;
 
-        void __sortArray();
-        void __buildRowStartFromArray();
+        // Mul returns this * b, throws std::invalid_argument when this->cols != b.rows
+        BasicSparseCSR Mul(const BasicSparseCSR &b) const;
 
-        SparseCSR Transpose();
-        SparseCSR Add(const SparseCSR &b);
-        SparseCSR Sub(const SparseCSR &b);
-        SparseCSR Mul(const SparseCSR &b);
+        // Mul returns op(this) * op(b), op transposes the operands selected by trans without building the transpose:
+        // a transposed operand is read column by column through a CSCView (Gustavson over the rows of op(A)).
+        // Views of this and b can be passed to reuse them across calls (e.g. a fixed pattern with new values every step),
+        // the missing ones are built for the call. Views of operands that are not transposed are ignored.
+        // throws std::invalid_argument when the shapes do not match or a view belongs to another matrix
+        // O( flops + nnz + cols of the transposed operands when their views are built )
+        BasicSparseCSR Mul(const BasicSparseCSR &b, const MulTrans trans, const CSCView *thisView = nullptr, const CSCView *bView = nullptr) const;
+
+        // LinearCombination returns sum_k alpha[k] * terms[k] for n >= 1 matrices of the same shape in one pass,
+        // throws std::invalid_argument otherwise. Lazy expressions like A + B - 2 * C evaluate through it (sparseExpr.h).
+        static BasicSparseCSR LinearCombination(const BasicSparseCSR *const *terms, const ValueT *alpha, const int n);
     };
 
+    template <typename IndexT, typename ValueT, typename ColT>
+    std::ostream &operator<<(std::ostream &out, const BasicSparseCSR<IndexT, ValueT, ColT> &M);
+
+    // BasicSparseCSCView is the column structure of a BasicSparseCSR: the entries of column j are
+    // [colStart[j], colStart[j + 1]) of rowIdx (sorted) and pos, pos is the position of the entry in the arrays of the matrix.
+    // Values are not copied, Mul reads them from the operand, so the view stays valid while the values change
+    // as long as the matrix keeps its pattern. One counting sort pass, O(nnz + cols).
+    // The view keeps no reference to the matrix, Mul recognizes the operand it was built from by shape, nnz and
+    // the address of the rowStart array and throws otherwise. A view must not outlive the storage of its matrix:
+    // after a move it belongs to the matrix moved to, a copy of the matrix needs a view of its own.
+    template <typename IndexT, typename ValueT, typename ColT = int>
+    class BasicSparseCSCView
+    {
+    private:
+        IndexT rows;
+        IndexT cols;
+        IndexT nnz;
+        const IndexT *rowStart; // identity of the matrix the view was built from, never dereferenced
+        std::vector<IndexT> colStart;
+        std::vector<IndexT> rowIdx;
+        std::vector<IndexT> pos;
+
+    public:
+        explicit BasicSparseCSCView(const BasicSparseCSR<IndexT, ValueT, ColT> &A);
+
+        // BuiltFrom returns whether the view was built from A, by shape, nnz and the address of its rowStart array
+        bool BuiltFrom(const BasicSparseCSR<IndexT, ValueT, ColT> &A) const
+        {
+            return rows == A.Rows() && cols == A.Cols() && nnz == A.Nnz() && rowStart == A.RowStart();
+        }
+
+        IndexT Rows() const { return rows; }
+        IndexT Cols() const { return cols; }
+
+        const IndexT *ColStart() const { return colStart.data(); }
+        const IndexT *RowIdx() const { return rowIdx.data(); }
+        const IndexT *Pos() const { return pos.data(); }
+    };
+
+    typedef BasicElementCOO<int, float> ElementCOO;
+    typedef BasicSparseCSR<int, float> SparseCSR;
+    typedef BasicSparseCSR<int, double> SparseCSRd;
+    typedef BasicSparseCSR<int64_t, float> SparseCSR64; // 64-bit rows and nnz, 32-bit columns
+    typedef BasicSparseCSR<int64_t, double> SparseCSR64d;
+    typedef BasicSparseCSR<int64_t, float, int64_t> SparseCSR64Wide; // 64-bit columns too
+    typedef BasicSparseCSR<int64_t, double, int64_t> SparseCSR64dWide;
+    typedef BasicSparseCSCView<int, float> SparseCSCView;
+    typedef BasicSparseCSCView<int, double> SparseCSCViewd;
+
+// SPARSE_FOR_EACH_CSR_TYPE(X) expands X(IndexT, ColT, ValueT) for every instantiated BasicSparseCSR
+#define SPARSE_FOR_EACH_CSR_TYPE(X) \
+    X(int, int, float)              \
+    X(int, int, double)             \
+    X(int64_t, int, float)          \
+    X(int64_t, int, double)         \
+    X(int64_t, int64_t, float)      \
+    X(int64_t, int64_t, double)
+
 } // namespace sparse
 
-#endif // __SPARSE_CSR_H__
\ No newline at end of file
+#endif // __SPARSE_CSR_H__
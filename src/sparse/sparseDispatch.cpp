@@ -0,0 +1,332 @@
+#include "sparseDispatch.h"
+
+#include "sparseKernels.h" // SpMM
+
+#include "gemm.h"        // generalMatMulOpt
+#include "gemm_thread.h" // parallelFor
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::fill_n, std::copy_n, std::count, std::min, std::max
+#include <stdexcept> // std::invalid_argument
+#include <vector>    // std::vector
+
+namespace sparse
+{
+    // the dense kernels work on whole DenseBlock x DenseBlock blocks (gemm BlockDim), operands are zero padded
+    const int DenseBlock = 64;
+
+    // largest padded dense operand of the dense paths, 1 GiB of float
+    const long long DenseMaxElements = 1LL << 28;
+
+    // empirical single thread costs in ns (AVX2), only their ratios matter since every path runs on all threads
+    const double SparseFlopNs = 8.0;    // one multiply-add of Gustavson SpGEMM (symbolic + numeric)
+    const double SparseOutputNs = 60.0; // one non-zero of C written by Gustavson SpGEMM
+    const double SpMMMaddNs = 0.2;      // one multiply-add of SpMM
+    const double DenseMaddNs = 0.075;   // one multiply-add of generalMatMulOpt
+    const double DenseElementNs = 0.25; // one dense element zeroed, copied or scanned
+
+    long long __roundUp(const long long n, const long long block)
+    {
+        return (n + block - 1) / block * block;
+    }
+
+    // __scatterRows zeroes the first `width` columns of rows [0, height) of D and writes the entries of A into them,
+    // height >= A.Rows() and width >= A.Cols() pad the matrix with zeros
+    void __scatterRows(const SparseCSR &A, float *D, const long long stride, const long long width, const long long height)
+    {
+        const long long grain = std::max<long long>(1, (1 << 16) / std::max<long long>(1, width));
+
+        gemm::utils::parallelFor(0, height, grain, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                float *row = D + i * stride;
+                std::fill_n(row, width, 0.0f);
+                if (i < A.Rows())
+                {
+                    for (int k = A.RowStart()[i]; k < A.RowStart()[i + 1]; k++)
+                    {
+                        row[A.ColIdx()[k]] = A.Values()[k];
+                    }
+                }
+            }
+        });
+    }
+
+    void ToDense(const SparseCSR &A, float *D, const int stride)
+    {
+        __scatterRows(A, D, stride, A.Cols(), A.Rows());
+    }
+
+    SparseCSR FromDense(const float *D, const int rows, const int cols, const int stride)
+    {
+        const long long grain = std::max(1, (1 << 16) / std::max(1, cols));
+
+        // count pass: rowStart[i + 1] saves the size of row i
+        std::vector<int> counts(rows + 1, 0);
+        gemm::utils::parallelFor(0, rows, grain, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                const float *row = D + i * stride;
+                int count = 0;
+                for (int j = 0; j < cols; j++)
+                {
+                    count += (row[j] != 0.0f);
+                }
+                counts[i + 1] = count;
+            }
+        });
+
+        long long nnz = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            nnz += counts[i + 1];
+        }
+        if (nnz > INT32_MAX)
+        {
+            throw std::overflow_error("sparse: FromDense non-zeros do not fit int");
+        }
+
+        SparseCSR C(rows, cols, nnz); // allocate memory
+        int *rowStart = C.RowStart();
+        rowStart[0] = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            rowStart[i + 1] = rowStart[i] + counts[i + 1];
+        }
+
+        // fill pass
+        gemm::utils::parallelFor(0, rows, grain, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                const float *row = D + i * stride;
+                int p = rowStart[i];
+                for (int j = 0; j < cols; j++)
+                {
+                    if (row[j] != 0.0f)
+                    {
+                        C.ColIdx()[p] = j;
+                        C.Values()[p] = row[j];
+                        p++;
+                    }
+                }
+            }
+        });
+
+        return C;
+    }
+
+    MulPlan PlanMul(const SparseCSR &A, const SparseCSR &B, const bool denseOutput, const int samples)
+    {
+        if (A.Cols() != B.Rows())
+        {
+            throw std::invalid_argument("sparse: PlanMul shapes do not match");
+        }
+
+        const long long M = A.Rows(), N = A.Cols(), K = B.Cols();
+        auto rowFlops = [&](const int i) -> long long {
+            long long flops = 0;
+            for (int k = A.RowStart()[i]; k < A.RowStart()[i + 1]; k++)
+            {
+                flops += B.RowStart()[A.ColIdx()[k] + 1] - B.RowStart()[A.ColIdx()[k]];
+            }
+            return flops;
+        };
+
+        MulPlan plan;
+        plan.flops = 0;
+        for (int i = 0; i < M; i++)
+        {
+            plan.flops += rowFlops(i);
+        }
+
+        // fill-in of evenly spaced rows: nnz of the row / flops of the row,
+        // at most 1/32 of the rows (and of the expected flops) are sampled unless the matrix is tiny
+        const int count = std::min<long long>(std::max(1, samples), std::max<long long>(std::min<long long>(M, 16), M / 32));
+        long long sampleFlops = 0, sampleNnz = 0;
+        std::vector<int> mark(K, -1);
+        for (int s = 0; s < count; s++)
+        {
+            const int i = (long long)s * M / count;
+
+            for (int k = A.RowStart()[i]; k < A.RowStart()[i + 1]; k++)
+            {
+                const int colA = A.ColIdx()[k];
+                for (int p = B.RowStart()[colA]; p < B.RowStart()[colA + 1]; p++)
+                {
+                    sampleNnz += (mark[B.ColIdx()[p]] != i);
+                    mark[B.ColIdx()[p]] = i;
+                }
+                sampleFlops += B.RowStart()[colA + 1] - B.RowStart()[colA];
+            }
+        }
+        plan.nnzEstimate = (sampleFlops == 0) ? 0.0 : std::min<double>((double)plan.flops * sampleNnz / sampleFlops, (double)M * K);
+
+        const double outputNs = DenseElementNs * M * K; // ToDense of a sparse result, FromDense of a dense one
+
+        plan.cost[MulPathSparse] = SparseFlopNs * plan.flops + SparseOutputNs * plan.nnzEstimate + (denseOutput ? outputNs : 0.0);
+
+        plan.cost[MulPathSparseDense] = -1.0;
+        if (N * K <= DenseMaxElements && (denseOutput || M * K <= DenseMaxElements))
+        {
+            plan.cost[MulPathSparseDense] = DenseElementNs * N * K + SpMMMaddNs * A.Nnz() * K + DenseElementNs * M * K + (denseOutput ? 0.0 : outputNs);
+        }
+
+        const long long Mp = __roundUp(M, DenseBlock), Np = __roundUp(N, DenseBlock), Kp = __roundUp(K, DenseBlock);
+        plan.cost[MulPathDense] = -1.0;
+        if (Mp * Np <= DenseMaxElements && Np * Kp <= DenseMaxElements && Mp * Kp <= DenseMaxElements)
+        {
+            plan.cost[MulPathDense] = DenseElementNs * (Mp * Np + Np * Kp + Mp * Kp) + DenseMaddNs * Mp * Np * Kp + outputNs;
+        }
+
+        plan.path = MulPathSparse;
+        for (MulPath path : {MulPathSparseDense, MulPathDense})
+        {
+            if (plan.cost[path] >= 0.0 && plan.cost[path] < plan.cost[plan.path])
+            {
+                plan.path = path;
+            }
+        }
+
+        return plan;
+    }
+
+    // __denseProduct computes A * B on a dense path into a new buffer, stride receives its row stride.
+    // Release the buffer with alignedFree.
+    float *__denseProduct(const SparseCSR &A, const SparseCSR &B, const MulPath path, long long &stride)
+    {
+        const long long M = A.Rows(), N = A.Cols(), K = B.Cols();
+
+        if (path == MulPathSparseDense)
+        {
+            float *dB = gemm::utils::allocArray<float>(N * K);
+            float *dC = gemm::utils::allocArray<float>(M * K);
+            ToDense(B, dB, K);
+            SpMM(A, dB, dC, K, K, K);
+            gemm::utils::alignedFree(dB);
+
+            stride = K;
+            return dC;
+        }
+
+        const long long Mp = __roundUp(M, DenseBlock), Np = __roundUp(N, DenseBlock), Kp = __roundUp(K, DenseBlock);
+        float *dA = gemm::utils::allocArray<float>(Mp * Np);
+        float *dB = gemm::utils::allocArray<float>(Np * Kp);
+        float *dC = gemm::utils::allocArray<float>(Mp * Kp);
+        __scatterRows(A, dA, Np, Np, Mp);
+        __scatterRows(B, dB, Kp, Kp, Np);
+        gemm::generalMatMulOpt(dA, dB, dC, Mp, Np, Kp);
+        gemm::utils::alignedFree(dA);
+        gemm::utils::alignedFree(dB);
+
+        stride = Kp;
+        return dC;
+    }
+
+    // __dropZeros returns C without its stored zeros, C itself when it has none
+    SparseCSR __dropZeros(SparseCSR C)
+    {
+        const int *rowStart = C.RowStart();
+        const int *colIdx = C.ColIdx();
+        const float *values = C.Values();
+        const long long zeros = std::count(values, values + C.Nnz(), 0.0f);
+        if (zeros == 0)
+        {
+            return C;
+        }
+
+        SparseCSR D(C.Rows(), C.Cols(), C.Nnz() - zeros); // allocate memory
+        int p = 0;
+        D.RowStart()[0] = 0;
+        for (int i = 0; i < C.Rows(); i++)
+        {
+            for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            {
+                if (values[k] != 0.0f)
+                {
+                    D.ColIdx()[p] = colIdx[k];
+                    D.Values()[p] = values[k];
+                    p++;
+                }
+            }
+            D.RowStart()[i + 1] = p;
+        }
+        return D;
+    }
+
+    SparseCSR MulWith(const SparseCSR &A, const SparseCSR &B, const MulPath path)
+    {
+        if (A.Cols() != B.Rows())
+        {
+            throw std::invalid_argument("sparse: MulWith shapes do not match");
+        }
+
+        if (path == MulPathSparse)
+        {
+            return __dropZeros(A.Mul(B));
+        }
+
+        long long stride;
+        float *dC = __denseProduct(A, B, path, stride);
+        SparseCSR C = FromDense(dC, A.Rows(), B.Cols(), stride);
+        gemm::utils::alignedFree(dC);
+
+        return C;
+    }
+
+    void MulWithDense(const SparseCSR &A, const SparseCSR &B, float *C, const int cStride, const MulPath path)
+    {
+        if (A.Cols() != B.Rows())
+        {
+            throw std::invalid_argument("sparse: MulWithDense shapes do not match");
+        }
+
+        switch (path)
+        {
+        case MulPathSparse:
+            ToDense(A.Mul(B), C, cStride);
+            break;
+        case MulPathSparseDense:
+        {
+            float *dB = gemm::utils::allocArray<float>((long long)B.Rows() * B.Cols());
+            ToDense(B, dB, B.Cols());
+            SpMM(A, dB, C, B.Cols(), B.Cols(), cStride);
+            gemm::utils::alignedFree(dB);
+            break;
+        }
+        case MulPathDense:
+        {
+            long long stride;
+            float *dC = __denseProduct(A, B, path, stride);
+            gemm::utils::parallelFor(0, A.Rows(), 64, [&](const long long begin, const long long end) {
+                for (long long i = begin; i < end; i++)
+                {
+                    std::copy_n(dC + i * stride, B.Cols(), C + i * cStride);
+                }
+            });
+            gemm::utils::alignedFree(dC);
+            break;
+        }
+        }
+    }
+
+    SparseCSR MulAuto(const SparseCSR &A, const SparseCSR &B, MulPlan *plan)
+    {
+        const MulPlan p = PlanMul(A, B, false);
+        if (plan != nullptr)
+        {
+            *plan = p;
+        }
+        return MulWith(A, B, p.path);
+    }
+
+    void MulAutoDense(const SparseCSR &A, const SparseCSR &B, float *C, const int cStride, MulPlan *plan)
+    {
+        const MulPlan p = PlanMul(A, B, true);
+        if (plan != nullptr)
+        {
+            *plan = p;
+        }
+        MulWithDense(A, B, C, cStride, p.path);
+    }
+
+} // namespace sparse
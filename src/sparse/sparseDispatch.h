@@ -0,0 +1,64 @@
+#ifndef __SPARSE_DISPATCH_H__
+#define __SPARSE_DISPATCH_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    enum MulPath
+    {
+        MulPathSparse,      // SparseCSR::Mul, Gustavson SpGEMM
+        MulPathSparseDense, // B converted to dense, SpMM
+        MulPathDense,       // A and B converted to dense, gemm::generalMatMulOpt
+    };
+
+    // MulPlan is the cost estimate of C = A * B behind MulAuto.
+    struct MulPlan
+    {
+        MulPath path;
+        long long flops;    // multiply-adds of the row-wise sparse product
+        double nnzEstimate; // nnz of C estimated from sampled rows
+        double cost[3];     // estimated time in ns on one thread, indexed by MulPath, < 0 when the path is not possible
+    };
+
+    // ToDense writes A into the row-major dense matrix D[rows][stride], columns [cols, stride) are left untouched.
+    // Parallel over rows, every row is zeroed then scattered.
+    // O(rows * cols)
+    void ToDense(const SparseCSR &A, float *D, const int stride);
+
+    // FromDense builds a SparseCSR from the non-zero entries of the row-major dense matrix D[rows][stride].
+    // Two parallel passes over rows, count then fill.
+    // O(rows * cols)
+    SparseCSR FromDense(const float *D, const int rows, const int cols, const int stride);
+
+    // PlanMul estimates the cost of the three ways to compute C = A * B and picks the cheapest.
+    // flops are counted exactly in O(nnz(A)), the fill-in of C is the ratio nnz / flops of up to `samples` evenly spaced rows (at most 1/32 of them).
+    // denseOutput adds the conversion to the output format the caller wants (MulAutoDense) to every path.
+    // Dense paths are skipped when the padded operands would exceed DenseMaxElements.
+    // throws std::invalid_argument when A.Cols() != B.Rows()
+    MulPlan PlanMul(const SparseCSR &A, const SparseCSR &B, const bool denseOutput = false, const int samples = 256);
+
+    // MulAuto computes C = A * B along the path chosen by PlanMul, plan receives the estimate when not nullptr.
+    // input    : A[M][N], B[N][K] sparse
+    // function : C = A*B
+    // output   : C[M][K] sparse, the same on every path (see MulWith)
+    SparseCSR MulAuto(const SparseCSR &A, const SparseCSR &B, MulPlan *plan = nullptr);
+
+    // MulAutoDense is MulAuto for a dense result, element (i, j) of C is C[i * cStride + j].
+    // input    : A[M][N], B[N][K] sparse
+    // function : C = A*B
+    // output   : C[M][K] dense
+    void MulAutoDense(const SparseCSR &A, const SparseCSR &B, float *C, const int cStride, MulPlan *plan = nullptr);
+
+    // MulWith computes C = A * B along the given path instead of the one of PlanMul. The dense paths cannot tell
+    // a zero from a missing entry, so the sparse path drops the zeros of its result (cancellation, explicit zeros
+    // of the operands) too and C has the same pattern on every path. The dense paths convert the operands
+    // whatever their size. throws std::invalid_argument when A.Cols() != B.Rows()
+    SparseCSR MulWith(const SparseCSR &A, const SparseCSR &B, const MulPath path);
+
+    // MulWithDense is MulWith for a dense result, element (i, j) of C is C[i * cStride + j].
+    void MulWithDense(const SparseCSR &A, const SparseCSR &B, float *C, const int cStride, const MulPath path);
+
+} // namespace sparse
+
+#endif // __SPARSE_DISPATCH_H__
@@ -0,0 +1,279 @@
+#include "sparseDynamic.h"
+
+#include "sparseKernels.h" // SpMV
+
+#include <algorithm> // std::lower_bound, std::max
+#include <chrono>    // std::chrono::seconds
+#include <string>    // std::to_string
+#include <stdexcept> // std::overflow_error, std::out_of_range
+#include <utility>   // std::move
+
+namespace sparse
+{
+    // __baseFind returns the position of (row, col) in A, -1 when it is not stored
+    int __baseFind(const SparseCSR &A, const int row, const int col)
+    {
+        const int *first = A.ColIdx() + A.RowStart()[row];
+        const int *last = A.ColIdx() + A.RowStart()[row + 1];
+        const int *it = std::lower_bound(first, last, col);
+        return (it != last && *it == col) ? (int)(it - A.ColIdx()) : -1;
+    }
+
+    DynamicSparseCSR::DynamicSparseCSR(const int rows, const int cols) : DynamicSparseCSR(SparseCSR(rows, cols, 0, nullptr))
+    {
+    }
+
+    DynamicSparseCSR::DynamicSparseCSR(SparseCSR base)
+    {
+        this->rows = base.Rows();
+        this->cols = base.Cols();
+        this->nnz = base.Nnz();
+        this->compactThreshold = std::max<long long>(4096, this->nnz / 16);
+        this->base = std::make_shared<const SparseCSR>(std::move(base));
+    }
+
+    DynamicSparseCSR::~DynamicSparseCSR()
+    {
+        if (this->compaction.valid())
+        {
+            this->compaction.wait();
+        }
+    }
+
+    const DynamicSparseCSR::DeltaEntry *DynamicSparseCSR::__find(const int row, const int col) const
+    {
+        const uint64_t key = __key(row, col);
+
+        auto it = this->delta.find(key);
+        if (it != this->delta.end())
+        {
+            return &it->second;
+        }
+
+        if (this->frozen)
+        {
+            it = this->frozen->find(key);
+            if (it != this->frozen->end())
+            {
+                return &it->second;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void DynamicSparseCSR::__check(const int row, const int col) const
+    {
+        if (row < 0 || row >= this->rows || col < 0 || col >= this->cols)
+        {
+            throw std::out_of_range("sparse: DynamicSparseCSR index (" + std::to_string(row) + ", " + std::to_string(col) + ") out of range");
+        }
+    }
+
+    bool DynamicSparseCSR::Contains(const int row, const int col) const
+    {
+        __check(row, col);
+        const DeltaEntry *entry = __find(row, col);
+        if (entry != nullptr)
+        {
+            return entry->erased == false;
+        }
+        return __baseFind(*this->base, row, col) >= 0;
+    }
+
+    float DynamicSparseCSR::Get(const int row, const int col) const
+    {
+        __check(row, col);
+        const DeltaEntry *entry = __find(row, col);
+        if (entry != nullptr)
+        {
+            return entry->erased ? 0.0f : entry->val;
+        }
+
+        int k = __baseFind(*this->base, row, col);
+        return (k >= 0) ? this->base->Values()[k] : 0.0f;
+    }
+
+    void DynamicSparseCSR::Set(const int row, const int col, const float val)
+    {
+        if (Contains(row, col) == false)
+        {
+            this->nnz++;
+        }
+        __write(row, col, DeltaEntry{val, false});
+    }
+
+    void DynamicSparseCSR::Erase(const int row, const int col)
+    {
+        if (Contains(row, col) == false)
+        {
+            return;
+        }
+        this->nnz--;
+
+        // an entry only known to the new log is dropped, otherwise a tombstone hides the older one
+        const uint64_t key = __key(row, col);
+        if (__baseFind(*this->base, row, col) < 0 && (this->frozen == nullptr || this->frozen->count(key) == 0))
+        {
+            this->delta.erase(key);
+            return;
+        }
+        __write(row, col, DeltaEntry{0.0f, true});
+    }
+
+    void DynamicSparseCSR::__write(const int row, const int col, const DeltaEntry entry)
+    {
+        this->delta[__key(row, col)] = entry;
+
+        __poll(false);
+        if (this->compactThreshold > 0 && (long long)this->delta.size() >= this->compactThreshold && this->frozen == nullptr)
+        {
+            __startCompaction();
+        }
+    }
+
+    void DynamicSparseCSR::__poll(const bool wait)
+    {
+        if (this->compaction.valid() == false)
+        {
+            return;
+        }
+        if (wait || this->compaction.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+        {
+            std::shared_ptr<const SparseCSR> merged;
+            try
+            {
+                merged = this->compaction.get();
+            }
+            catch (...)
+            {
+                // the merge failed: the frozen entries go back under the newer ones of the log, nothing is lost
+                for (const auto &e : *this->frozen)
+                {
+                    this->delta.emplace(e.first, e.second);
+                }
+                this->frozen.reset();
+                throw;
+            }
+            this->base = std::move(merged);
+            this->frozen.reset();
+        }
+    }
+
+    void DynamicSparseCSR::__startCompaction()
+    {
+        // the frozen log and the old base are immutable, the background thread shares them with the readers
+        std::shared_ptr<const DeltaLog> log = std::make_shared<const DeltaLog>(std::move(this->delta));
+        this->delta.clear();
+        this->frozen = log;
+
+        std::shared_ptr<const SparseCSR> old = this->base;
+        const long long nnz = this->nnz;
+        this->compaction = std::async(std::launch::async, [old, log, nnz]() {
+            return __merge(*old, *log, nnz);
+        });
+    }
+
+    std::shared_ptr<const SparseCSR> DynamicSparseCSR::__merge(const SparseCSR &base, const DeltaLog &log, const long long nnz)
+    {
+        if (nnz > INT32_MAX)
+        {
+            throw std::overflow_error("sparse: DynamicSparseCSR non-zeros do not fit int");
+        }
+
+        std::shared_ptr<SparseCSR> merged = std::make_shared<SparseCSR>(base.Rows(), base.Cols(), nnz); // allocate memory
+        int *rowStart = merged->RowStart();
+        int *colIdx = merged->ColIdx();
+        float *values = merged->Values();
+
+        // one sequential pass: the log is walked once in (row, col) order next to the rows of the base
+        auto it = log.begin();
+        int p = 0;
+        rowStart[0] = 0;
+        for (int row = 0; row < base.Rows(); row++)
+        {
+            const uint64_t rowEnd = __key(row + 1, 0);
+            int k = base.RowStart()[row];
+            const int end = base.RowStart()[row + 1];
+
+            while (k < end || (it != log.end() && it->first < rowEnd))
+            {
+                const bool fromLog = it != log.end() && it->first < rowEnd;
+                const int logCol = fromLog ? (int)(uint32_t)it->first : 0;
+
+                if (fromLog && (k == end || logCol <= base.ColIdx()[k]))
+                {
+                    if (it->second.erased == false)
+                    {
+                        colIdx[p] = logCol;
+                        values[p] = it->second.val;
+                        p++;
+                    }
+                    k += (k < end && logCol == base.ColIdx()[k]); // overridden base entry
+                    ++it;
+                }
+                else
+                {
+                    colIdx[p] = base.ColIdx()[k];
+                    values[p] = base.Values()[k];
+                    p++;
+                    k++;
+                }
+            }
+            rowStart[row + 1] = p;
+        }
+
+        return merged;
+    }
+
+    void DynamicSparseCSR::SpMV(const float *x, float *y, const float alpha, const float beta) const
+    {
+        sparse::SpMV(*this->base, x, y, alpha, beta);
+
+        // y[row] += alpha * (new value - base value) * x[col] for every entry of the logs,
+        // frozen entries overridden by the new log are skipped
+        auto correct = [&](const uint64_t key, const DeltaEntry &entry) {
+            const int row = key >> 32;
+            const int col = (uint32_t)key;
+            const int k = __baseFind(*this->base, row, col);
+            const float old = (k >= 0) ? this->base->Values()[k] : 0.0f;
+            const float val = entry.erased ? 0.0f : entry.val;
+            y[row] += alpha * (val - old) * x[col];
+        };
+
+        if (this->frozen)
+        {
+            for (const auto &e : *this->frozen)
+            {
+                if (this->delta.count(e.first) == 0)
+                {
+                    correct(e.first, e.second);
+                }
+            }
+        }
+        for (const auto &e : this->delta)
+        {
+            correct(e.first, e.second);
+        }
+    }
+
+    void DynamicSparseCSR::Compact(const bool wait)
+    {
+        __poll(wait);
+        if (this->frozen == nullptr && this->delta.empty() == false)
+        {
+            __startCompaction();
+        }
+        if (wait)
+        {
+            __poll(true);
+        }
+    }
+
+    const SparseCSR &DynamicSparseCSR::Snapshot()
+    {
+        Compact(true);
+        return *this->base;
+    }
+
+} // namespace sparse
@@ -0,0 +1,168 @@
+#ifndef __SPARSE_DYNAMIC_H__
+#define __SPARSE_DYNAMIC_H__
+
+#include "sparseCSR.h"
+
+#include <algorithm> // std::min
+#include <cstdint>   // uint64_t
+#include <future>    // std::future
+#include <iterator>  // std::next
+#include <map>       // std::map
+#include <memory>    // std::shared_ptr
+
+namespace sparse
+{
+    // DynamicSparseCSR is an updatable sparse matrix: an immutable SparseCSR base plus a sorted delta log of
+    // pending writes (std::map keyed by (row, col)), an entry of the log overrides the base or erases it.
+    // Updates cost O(log delta + log row length), reads merge the log on the fly.
+    // When the log reaches the compaction threshold it is frozen and merged with the base into a fresh SparseCSR
+    // by a background thread, new updates go to a new log meanwhile. The merged base is installed by the next update.
+    // Like the standard containers, one object must not be used from several threads at the same time.
+    // Indices outside the matrix throw std::out_of_range. An exception of a background compaction
+    // (std::overflow_error when the merged matrix does not fit int) is rethrown by the update or Compact
+    // that installs it, the pending updates are kept.
+    class DynamicSparseCSR
+    {
+    private:
+        struct DeltaEntry
+        {
+            float val;
+            bool erased; // tombstone of a base entry
+        };
+        typedef std::map<uint64_t, DeltaEntry> DeltaLog;
+
+        int rows;
+        int cols;
+        long long nnz; // non-zeros of the merged matrix
+        long long compactThreshold;
+
+        std::shared_ptr<const SparseCSR> base;
+        std::shared_ptr<const DeltaLog> frozen; // log being merged by the background compaction, nullptr otherwise
+        DeltaLog delta;
+        std::future<std::shared_ptr<const SparseCSR>> compaction;
+
+        static uint64_t __key(const int row, const int col) { return ((uint64_t)row << 32) | (uint32_t)col; }
+
+        // __check throws std::out_of_range when (row, col) is outside the matrix
+        void __check(const int row, const int col) const;
+
+        // __find returns the entry of (row, col) in the logs, nullptr when the base is authoritative
+        const DeltaEntry *__find(const int row, const int col) const;
+
+        // __poll installs the result of a finished compaction, wait blocks until it is finished.
+        // A failed compaction returns the frozen log to the new one and rethrows its exception.
+        void __poll(const bool wait);
+
+        // __write records entry for (row, col) and starts a compaction when the log is full
+        void __write(const int row, const int col, const DeltaEntry entry);
+
+        // __startCompaction freezes the log and merges it with the base in a background thread
+        void __startCompaction();
+
+        // __merge returns base with the entries of log applied, nnz is the size of the result
+        static std::shared_ptr<const SparseCSR> __merge(const SparseCSR &base, const DeltaLog &log, const long long nnz);
+
+    public:
+        DynamicSparseCSR(const int rows, const int cols);
+        explicit DynamicSparseCSR(SparseCSR base);
+
+        ~DynamicSparseCSR(); // waits for a running compaction
+
+        DynamicSparseCSR(const DynamicSparseCSR &) = delete;
+        DynamicSparseCSR &operator=(const DynamicSparseCSR &) = delete;
+
+        int Rows() const { return rows; }
+        int Cols() const { return cols; }
+        long long Nnz() const { return nnz; }
+
+        // PendingUpdates returns the entries of the logs not yet merged into the base
+        long long PendingUpdates() const { return delta.size() + (frozen ? frozen->size() : 0); }
+
+        // SetCompactThreshold sets the log size which starts a background compaction,
+        // default max(4096, nnz / 16) of the initial matrix. n <= 0 disables the automatic compaction.
+        void SetCompactThreshold(const long long n) { compactThreshold = n; }
+
+        // Set inserts (row, col) or overwrites its value, O(log delta + log row length)
+        void Set(const int row, const int col, const float val);
+
+        // Erase removes (row, col), nothing happens when it does not exist, O(log delta + log row length)
+        void Erase(const int row, const int col);
+
+        // Contains and Get look (row, col) up, Get returns 0 for a missing entry, O(log delta + log row length)
+        bool Contains(const int row, const int col) const;
+        float Get(const int row, const int col) const;
+
+        // ForEachInRow calls visit(col, val) for the entries of row in column order, O(row length + log delta)
+        template <typename Visit>
+        void ForEachInRow(const int row, Visit visit) const;
+
+        // SpMV is sparse::SpMV on the merged matrix: the base product is corrected entry by entry with the logs.
+        // input    : x[cols], y[rows]
+        // function : y = alpha*A*x + beta*y, y is not read when beta == 0
+        // output   : y[rows]
+        // O(nnz + delta * log row length)
+        void SpMV(const float *x, float *y, const float alpha = 1.0, const float beta = 0.0) const;
+
+        // Compact merges the logs into the base, synchronously when wait is set (the default),
+        // otherwise a background compaction is started unless one is already running.
+        void Compact(const bool wait = true);
+
+        // Snapshot returns the merged matrix after a synchronous compaction, it stays valid until the next update
+        const SparseCSR &Snapshot();
+    };
+
+    template <typename Visit>
+    void DynamicSparseCSR::ForEachInRow(const int row, Visit visit) const
+    {
+        const int *colIdx = this->base->ColIdx();
+        const float *values = this->base->Values();
+        int k = this->base->RowStart()[row];
+        const int end = this->base->RowStart()[row + 1];
+
+        // columns of the logs in order, the new log overrides the frozen one
+        DeltaLog::const_iterator it[2], last[2];
+        const DeltaLog *logs[2] = {&this->delta, this->frozen.get()};
+        for (int l = 0; l < 2; l++)
+        {
+            if (logs[l] != nullptr)
+            {
+                it[l] = logs[l]->lower_bound(__key(row, 0));
+                last[l] = logs[l]->lower_bound(__key(row + 1, 0));
+            }
+            else
+            {
+                it[l] = last[l] = this->delta.end();
+            }
+        }
+
+        const uint64_t none = UINT64_MAX;
+        while (true)
+        {
+            uint64_t k0 = (it[0] != last[0]) ? it[0]->first : none;
+            uint64_t k1 = (it[1] != last[1]) ? it[1]->first : none;
+            uint64_t kb = (k < end) ? __key(row, colIdx[k]) : none;
+            uint64_t key = std::min(std::min(k0, k1), kb);
+            if (key == none)
+            {
+                break;
+            }
+
+            const DeltaEntry *entry = (key == k0) ? &it[0]->second : (key == k1) ? &it[1]->second : nullptr;
+            if (entry == nullptr)
+            {
+                visit(colIdx[k], values[k]);
+            }
+            else if (entry->erased == false)
+            {
+                visit((int)(uint32_t)key, entry->val);
+            }
+
+            it[0] = (key == k0) ? std::next(it[0]) : it[0];
+            it[1] = (key == k1) ? std::next(it[1]) : it[1];
+            k += (key == kb);
+        }
+    }
+
+} // namespace sparse
+
+#endif // __SPARSE_DYNAMIC_H__
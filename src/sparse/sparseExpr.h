@@ -0,0 +1,227 @@
+#ifndef __SPARSE_EXPR_H__
+#define __SPARSE_EXPR_H__
+
+#include "sparseCSR.h"
+
+#include <memory>  // std::shared_ptr
+#include <utility> // std::move
+#include <vector>  // std::vector
+
+namespace sparse
+{
+    // BasicSparseExpr is a lazily evaluated linear combination sum_k alpha[k] * A_k of sparse matrices.
+    // The operators +, - and scalar * only collect terms, the conversion to the matrix type evaluates the
+    // whole expression with one BasicSparseCSR::LinearCombination (a symbolic pass and a fused k-way merge),
+    // so A + B - 2 * C creates no intermediate matrix:
+    //     SparseCSR D = A + B - 2.0f * C;
+    // The expression keeps pointers to the named operands, they must outlive it. Temporaries are moved into
+    // the expression, so auto e = A.Transpose() + B; holds the transpose itself.
+    template <typename Matrix>
+    class BasicSparseExpr
+    {
+    public:
+        typedef typename Matrix::Value Value;
+
+    private:
+        std::vector<const Matrix *> terms;
+        std::vector<Value> alpha;
+        std::vector<std::shared_ptr<const Matrix>> owned; // temporaries among the terms, shared by the copies
+
+    public:
+        explicit BasicSparseExpr(const Matrix &A, const Value a = 1)
+        {
+            this->terms.push_back(&A);
+            this->alpha.push_back(a);
+        }
+
+        explicit BasicSparseExpr(Matrix &&A, const Value a = 1)
+        {
+            this->owned.push_back(std::make_shared<const Matrix>(std::move(A)));
+            this->terms.push_back(this->owned.back().get());
+            this->alpha.push_back(a);
+        }
+
+        // Append adds s * e to the expression
+        BasicSparseExpr &Append(const BasicSparseExpr &e, const Value s = 1)
+        {
+            for (size_t k = 0; k < e.terms.size(); k++)
+            {
+                this->terms.push_back(e.terms[k]);
+                this->alpha.push_back(s * e.alpha[k]);
+            }
+            this->owned.insert(this->owned.end(), e.owned.begin(), e.owned.end());
+            return *this;
+        }
+
+        // Scale multiplies every term by s
+        BasicSparseExpr &Scale(const Value s)
+        {
+            for (Value &a : this->alpha)
+            {
+                a *= s;
+            }
+            return *this;
+        }
+
+        Matrix Eval() const
+        {
+            return Matrix::LinearCombination(this->terms.data(), this->alpha.data(), this->terms.size());
+        }
+
+        operator Matrix() const { return Eval(); }
+    };
+
+    typedef BasicSparseExpr<SparseCSR> SparseExpr;
+    typedef BasicSparseExpr<SparseCSRd> SparseExprd;
+
+    // operators on matrices and expressions, they only collect terms; the rvalue overloads move temporaries in
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseExpr<BasicSparseCSR<I, V, C>> e1, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e2)
+    {
+        return e1.Append(e2);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseExpr<BasicSparseCSR<I, V, C>> e1, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e2)
+    {
+        return e1.Append(e2, -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseExpr<BasicSparseCSR<I, V, C>> e, const BasicSparseCSR<I, V, C> &B)
+    {
+        return e.Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseExpr<BasicSparseCSR<I, V, C>> e, const BasicSparseCSR<I, V, C> &B)
+    {
+        return e.Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseExpr<BasicSparseCSR<I, V, C>> e, BasicSparseCSR<I, V, C> &&B)
+    {
+        return e.Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseExpr<BasicSparseCSR<I, V, C>> e, BasicSparseCSR<I, V, C> &&B)
+    {
+        return e.Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(const BasicSparseCSR<I, V, C> &A, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(e);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(const BasicSparseCSR<I, V, C> &A, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(e, -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseCSR<I, V, C> &&A, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(e);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseCSR<I, V, C> &&A, const BasicSparseExpr<BasicSparseCSR<I, V, C>> &e)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(e, -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(const BasicSparseCSR<I, V, C> &A, const BasicSparseCSR<I, V, C> &B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(const BasicSparseCSR<I, V, C> &A, const BasicSparseCSR<I, V, C> &B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseCSR<I, V, C> &&A, const BasicSparseCSR<I, V, C> &B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(const BasicSparseCSR<I, V, C> &A, BasicSparseCSR<I, V, C> &&B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator+(BasicSparseCSR<I, V, C> &&A, BasicSparseCSR<I, V, C> &&B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)));
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseCSR<I, V, C> &&A, const BasicSparseCSR<I, V, C> &B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(B), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(const BasicSparseCSR<I, V, C> &A, BasicSparseCSR<I, V, C> &&B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseCSR<I, V, C> &&A, BasicSparseCSR<I, V, C> &&B)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A)).Append(BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(B)), -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseExpr<BasicSparseCSR<I, V, C>> e)
+    {
+        return e.Scale(-1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(const BasicSparseCSR<I, V, C> &A)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A, -1);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator-(BasicSparseCSR<I, V, C> &&A)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A), -1);
+    }
+
+    // the scalar has the value type of the matrix, it is not deduced so 2 * A works for float and double
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator*(const typename BasicSparseCSR<I, V, C>::Value s, BasicSparseExpr<BasicSparseCSR<I, V, C>> e)
+    {
+        return e.Scale(s);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator*(const typename BasicSparseCSR<I, V, C>::Value s, const BasicSparseCSR<I, V, C> &A)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(A, s);
+    }
+
+    template <typename I, typename V, typename C>
+    BasicSparseExpr<BasicSparseCSR<I, V, C>> operator*(const typename BasicSparseCSR<I, V, C>::Value s, BasicSparseCSR<I, V, C> &&A)
+    {
+        return BasicSparseExpr<BasicSparseCSR<I, V, C>>(std::move(A), s);
+    }
+
+} // namespace sparse
+
+#endif // __SPARSE_EXPR_H__
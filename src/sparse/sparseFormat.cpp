@@ -0,0 +1,47 @@
+#include "sparseFormat.h"
+
+#include "sparseBSR.h"  // CountBlocks
+#include "sparseSELL.h" // PaddedSizeOf
+
+namespace sparse
+{
+    // minimum fraction of non-zeros inside the stored blocks for BSR
+    const double BSRMinFill = 0.7;
+
+    // minimum fraction of non-zeros inside the stored SELL chunks
+    const double SELLMinFill = 0.8;
+
+    // rows longer than this keep CSR, its per-row SIMD dot product is already efficient
+    const double SELLMaxMeanRow = 32.0;
+
+    FormatChoice ChooseFormat(const SparseCSR &A)
+    {
+        if (A.Nnz() == 0 || A.Rows() == 0)
+        {
+            return FormatChoice{FormatCSR, 0};
+        }
+
+        // larger blocks first, they save more index traffic
+        for (int D : {4, 3, 2})
+        {
+            long long blocks = SparseBSR::CountBlocks(A, D);
+            if ((double)A.Nnz() / ((double)blocks * D * D) >= BSRMinFill)
+            {
+                return FormatChoice{FormatBSR, D};
+            }
+        }
+
+        double meanRow = (double)A.Nnz() / A.Rows();
+        if (meanRow <= SELLMaxMeanRow)
+        {
+            long long padded = SparseSELL::PaddedSizeOf(A);
+            if ((double)A.Nnz() / (double)padded >= SELLMinFill)
+            {
+                return FormatChoice{FormatSELL, 0};
+            }
+        }
+
+        return FormatChoice{FormatCSR, 0};
+    }
+
+} // namespace sparse
@@ -0,0 +1,28 @@
+#ifndef __SPARSE_FORMAT_H__
+#define __SPARSE_FORMAT_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    enum SparseFormat
+    {
+        FormatCSR,
+        FormatSELL, // SparseSELL, short and irregular rows
+        FormatBSR,  // SparseBSR, dense D x D blocks
+    };
+
+    struct FormatChoice
+    {
+        SparseFormat format;
+        int blockDim; // D of SparseBSR, 0 otherwise
+    };
+
+    // ChooseFormat picks the storage format for SpMV from the row length and block statistics of A:
+    // BSR when some block size is filled well enough, SELL-C-sigma when its padding is small, CSR otherwise.
+    // O(nnz)
+    FormatChoice ChooseFormat(const SparseCSR &A);
+
+} // namespace sparse
+
+#endif // __SPARSE_FORMAT_H__
@@ -0,0 +1,163 @@
+#include "sparseGenerators.h"
+
+#include "gemm_thread.h" // parallelFor
+
+#include <algorithm> // std::min, std::max
+
+namespace sparse
+{
+    // SplitMix64 is a small counter based generator, every row or chunk of entries owns one
+    // so the output does not depend on the thread schedule nor on the standard library.
+    class SplitMix64
+    {
+    private:
+        uint64_t state;
+
+    public:
+        SplitMix64(const uint64_t seed, const uint64_t stream)
+        {
+            this->state = seed * 0x9E3779B97F4A7C15ull ^ (stream + 1) * 0xD1B54A32D192ED03ull;
+            Next();
+        }
+
+        uint64_t Next()
+        {
+            uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // Uniform returns a double in [0, 1)
+        double Uniform()
+        {
+            return (Next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+
+        // Below returns an integer in [0, n)
+        uint64_t Below(const uint64_t n)
+        {
+            return (uint64_t)(((unsigned __int128)Next() * n) >> 64);
+        }
+
+        float Value()
+        {
+            return 0.5f + (float)Uniform();
+        }
+    };
+
+    // entries generated by one SplitMix64 stream of GenerateRMAT
+    const long long GeneratorChunk = 1 << 16;
+
+    // __scramble is a bijection of [0, 2^scale), odd multiplication and xorshift modulo 2^scale
+    inline uint64_t __scramble(uint64_t v, const int scale, const uint64_t key)
+    {
+        const uint64_t mask = (scale >= 64) ? ~0ull : (1ull << scale) - 1;
+        for (int round = 0; round < 2; round++)
+        {
+            v = (v * (key | 1)) & mask;
+            v ^= v >> std::max(1, scale / 2);
+        }
+        return v;
+    }
+
+    std::vector<ElementCOO> GenerateRMAT(const int scale, const int edgeFactor, const uint64_t seed, const double a, const double b, const double c)
+    {
+        const long long edges = (long long)edgeFactor << scale;
+        const uint64_t key = SplitMix64(seed, ~0ull).Next();
+
+        std::vector<ElementCOO> array(edges);
+
+        gemm::utils::parallelFor(0, (edges + GeneratorChunk - 1) / GeneratorChunk, 1, [&](const long long begin, const long long end) {
+            for (long long chunk = begin; chunk < end; chunk++)
+            {
+                SplitMix64 rng(seed, chunk);
+                for (long long e = chunk * GeneratorChunk; e < std::min(edges, (chunk + 1) * GeneratorChunk); e++)
+                {
+                    uint64_t row = 0, col = 0;
+                    for (int level = 0; level < scale; level++) // one quadrant per level
+                    {
+                        double u = rng.Uniform();
+                        uint64_t down = (u >= a + b);
+                        uint64_t right = (u >= a && u < a + b) || (u >= a + b + c);
+                        row = (row << 1) | down;
+                        col = (col << 1) | right;
+                    }
+
+                    array[e] = ElementCOO{(int)__scramble(row, scale, key), (int)__scramble(col, scale, key), rng.Value()};
+                }
+            }
+        });
+
+        return array;
+    }
+
+    // __generateRows fills the entries of every row in parallel, count(row) entries per row, fill(rng, row, out)
+    template <typename Count, typename Fill>
+    std::vector<ElementCOO> __generateRows(const int rows, const uint64_t seed, Count count, Fill fill)
+    {
+        std::vector<long long> offset(rows + 1, 0);
+        for (int row = 0; row < rows; row++)
+        {
+            offset[row + 1] = offset[row] + count(row);
+        }
+
+        std::vector<ElementCOO> array(offset[rows]);
+
+        gemm::utils::parallelFor(0, rows, 1024, [&](const long long begin, const long long end) {
+            for (long long row = begin; row < end; row++)
+            {
+                SplitMix64 rng(seed, row);
+                fill(rng, (int)row, array.data() + offset[row]);
+            }
+        });
+
+        return array;
+    }
+
+    std::vector<ElementCOO> GenerateBanded(const int n, const int halfBandwidth, const uint64_t seed)
+    {
+        auto first = [=](const int row) { return std::max(0, row - halfBandwidth); };
+        auto last = [=](const int row) { return std::min(n - 1, row + halfBandwidth); };
+
+        return __generateRows(
+            n, seed,
+            [&](const int row) { return last(row) - first(row) + 1; },
+            [&](SplitMix64 &rng, const int row, ElementCOO *out) {
+                for (int col = first(row); col <= last(row); col++)
+                {
+                    *out++ = ElementCOO{row, col, rng.Value()};
+                }
+            });
+    }
+
+    std::vector<ElementCOO> GenerateUniform(const int rows, const int cols, const int nnzPerRow, const uint64_t seed)
+    {
+        return __generateRows(
+            rows, seed,
+            [&](const int) { return nnzPerRow; },
+            [&](SplitMix64 &rng, const int row, ElementCOO *out) {
+                for (int k = 0; k < nnzPerRow; k++)
+                {
+                    *out++ = ElementCOO{row, (int)rng.Below(cols), rng.Value()};
+                }
+            });
+    }
+
+    std::vector<ElementCOO> GenerateBlockDiagonal(const int n, const int blockSize, const uint64_t seed)
+    {
+        auto first = [=](const int row) { return row / blockSize * blockSize; };
+        auto last = [=](const int row) { return std::min(n, first(row) + blockSize) - 1; };
+
+        return __generateRows(
+            n, seed,
+            [&](const int row) { return last(row) - first(row) + 1; },
+            [&](SplitMix64 &rng, const int row, ElementCOO *out) {
+                for (int col = first(row); col <= last(row); col++)
+                {
+                    *out++ = ElementCOO{row, col, rng.Value()};
+                }
+            });
+    }
+
+} // namespace sparse
@@ -0,0 +1,32 @@
+#ifndef __SPARSE_GENERATORS_H__
+#define __SPARSE_GENERATORS_H__
+
+#include "sparseCSR.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace sparse
+{
+    // Reproducible synthetic matrices for tests and benchmarks.
+    // The entries depend only on the arguments and the seed, not on the number of threads.
+    // Values are uniform in [0.5, 1.5), duplicate entries are left to the SparseCSR constructor, which sums them.
+
+    // GenerateRMAT returns the R-MAT (recursive matrix) power-law graph with 2^scale vertices and
+    // edgeFactor * 2^scale edges, quadrant probabilities a, b, c and 1 - a - b - c (Graph500 defaults).
+    // Vertex labels are scrambled so that the high degree vertices are not all at the top left.
+    std::vector<ElementCOO> GenerateRMAT(const int scale, const int edgeFactor, const uint64_t seed = 1, const double a = 0.57, const double b = 0.19, const double c = 0.19);
+
+    // GenerateBanded returns the n x n matrix with every entry of the band |row - col| <= halfBandwidth.
+    std::vector<ElementCOO> GenerateBanded(const int n, const int halfBandwidth, const uint64_t seed = 1);
+
+    // GenerateUniform returns the rows x cols matrix with nnzPerRow uniformly random columns in every row.
+    std::vector<ElementCOO> GenerateUniform(const int rows, const int cols, const int nnzPerRow, const uint64_t seed = 1);
+
+    // GenerateBlockDiagonal returns the n x n matrix of dense blockSize x blockSize blocks on the diagonal,
+    // the last block is cut at n.
+    std::vector<ElementCOO> GenerateBlockDiagonal(const int n, const int blockSize, const uint64_t seed = 1);
+
+} // namespace sparse
+
+#endif // __SPARSE_GENERATORS_H__
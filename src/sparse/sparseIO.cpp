@@ -0,0 +1,415 @@
+#include "sparseIO.h"
+
+#include "gemm_thread.h" // parallelRun, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::min, std::copy, std::find
+#include <cctype>    // tolower
+#include <cerrno>    // errno
+#include <charconv>  // std::from_chars
+#include <cstdio>    // std::FILE, std::fopen, std::fwrite
+#include <cstring>   // std::memcmp, std::memcpy, std::strerror
+#include <limits>    // std::numeric_limits
+#include <stdexcept> // std::runtime_error, std::overflow_error
+#include <sstream>   // std::istringstream
+#include <vector>    // std::vector
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+#define SPARSE_IO_MMAP 1
+#endif
+
+namespace sparse
+{
+    static_assert(sizeof(BinaryHeader) <= BinaryHeaderSize, "BinaryHeader must fit in BinaryHeaderSize");
+
+    uint64_t __alignUp(const uint64_t offset)
+    {
+        return (offset + BinaryAlignment - 1) / BinaryAlignment * BinaryAlignment;
+    }
+
+    // __sectionFits checks that count elements of `size` bytes at offset end inside a file of `bytes`, without overflow
+    bool __sectionFits(const uint64_t offset, const uint64_t count, const uint64_t size, const uint64_t bytes)
+    {
+        return offset <= bytes && count <= (bytes - offset) / size;
+    }
+
+    // __mapFile maps the whole file copy-on-write, the returned storage unmaps it
+    std::shared_ptr<void> __mapFile(const std::string &path, uint64_t &bytes)
+    {
+#if defined(SPARSE_IO_MMAP)
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("sparse: cannot open " + path + ": " + std::strerror(errno));
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("sparse: cannot stat " + path);
+        }
+        bytes = st.st_size;
+
+        if (bytes == 0)
+        {
+            close(fd);
+            return std::shared_ptr<void>(nullptr, [](void *) {});
+        }
+
+        void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        close(fd); // the mapping keeps the file alive
+        if (p == MAP_FAILED)
+        {
+            throw std::runtime_error("sparse: cannot map " + path);
+        }
+
+        uint64_t length = bytes;
+        return std::shared_ptr<void>(p, [length](void *q) { munmap(q, length); });
+#else
+        std::FILE *file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("sparse: cannot open " + path);
+        }
+        std::fseek(file, 0, SEEK_END);
+        bytes = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+
+        void *p = gemm::utils::alignedAlloc(bytes);
+        if (std::fread(p, 1, bytes, file) != bytes)
+        {
+            std::fclose(file);
+            gemm::utils::alignedFree(p);
+            throw std::runtime_error("sparse: cannot read " + path);
+        }
+        std::fclose(file);
+
+        return std::shared_ptr<void>(p, [](void *q) { gemm::utils::alignedFree(q); });
+#endif
+    }
+
+    void __writeSection(std::FILE *file, const void *data, const uint64_t bytes, uint64_t &written, const uint64_t offset)
+    {
+        static const char zeros[BinaryAlignment] = {0};
+
+        while (written < offset)
+        {
+            uint64_t pad = std::min<uint64_t>(offset - written, BinaryAlignment);
+            std::fwrite(zeros, 1, pad, file);
+            written += pad;
+        }
+
+        if (bytes > 0 && std::fwrite(data, 1, bytes, file) != bytes)
+        {
+            throw std::runtime_error("sparse: short write");
+        }
+        written += bytes;
+    }
+
+    template <typename Matrix>
+    void SaveBinary(const Matrix &A, const std::string &path)
+    {
+        typedef typename Matrix::Index IndexT;
+        typedef typename Matrix::ColIndex ColT;
+        typedef typename Matrix::Value ValueT;
+
+        BinaryHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, BinaryMagic, sizeof(BinaryMagic));
+        header.version = BinaryVersion;
+        header.indexBytes = sizeof(IndexT);
+        header.valueBytes = sizeof(ValueT);
+        header.colIdxBytes = sizeof(ColT);
+        header.rows = A.Rows();
+        header.cols = A.Cols();
+        header.nnz = A.Nnz();
+        header.rowStartOffset = BinaryHeaderSize;
+        header.colIdxOffset = __alignUp(header.rowStartOffset + (header.rows + 1) * sizeof(IndexT));
+        header.valuesOffset = __alignUp(header.colIdxOffset + header.nnz * sizeof(ColT));
+        header.fileBytes = header.valuesOffset + header.nnz * sizeof(ValueT);
+
+        std::FILE *file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+        {
+            throw std::runtime_error("sparse: cannot create " + path);
+        }
+
+        try
+        {
+            uint64_t written = 0;
+            __writeSection(file, &header, sizeof(header), written, 0);
+            __writeSection(file, A.RowStart(), (header.rows + 1) * sizeof(IndexT), written, header.rowStartOffset);
+            __writeSection(file, A.ColIdx(), header.nnz * sizeof(ColT), written, header.colIdxOffset);
+            __writeSection(file, A.Values(), header.nnz * sizeof(ValueT), written, header.valuesOffset);
+        }
+        catch (...)
+        {
+            std::fclose(file);
+            throw;
+        }
+
+        if (std::fclose(file) != 0)
+        {
+            throw std::runtime_error("sparse: cannot write " + path);
+        }
+    }
+
+    template <typename Matrix>
+    Matrix LoadBinary(const std::string &path)
+    {
+        typedef typename Matrix::Index IndexT;
+        typedef typename Matrix::ColIndex ColT;
+        typedef typename Matrix::Value ValueT;
+
+        uint64_t bytes = 0;
+        std::shared_ptr<void> storage = __mapFile(path, bytes);
+        char *base = static_cast<char *>(storage.get());
+
+        if (bytes < BinaryHeaderSize)
+        {
+            throw std::runtime_error("sparse: " + path + " is too small for a binary CSR file");
+        }
+
+        BinaryHeader header;
+        std::memcpy(&header, base, sizeof(header));
+
+        if (std::memcmp(header.magic, BinaryMagic, sizeof(BinaryMagic)) != 0)
+        {
+            throw std::runtime_error("sparse: " + path + " is not a binary CSR file");
+        }
+        const uint32_t colIdxBytes = (header.colIdxBytes == 0) ? header.indexBytes : header.colIdxBytes;
+        if (header.version != BinaryVersion)
+        {
+            throw std::runtime_error("sparse: " + path + " has an unsupported version");
+        }
+        if (header.indexBytes != sizeof(IndexT) || colIdxBytes != sizeof(ColT) || header.valueBytes != sizeof(ValueT))
+        {
+            throw std::runtime_error("sparse: " + path + " stores " + std::to_string(header.indexBytes) + "/" + std::to_string(colIdxBytes) + "/" + std::to_string(header.valueBytes) +
+                                     "-byte rowStart/colIdx/values, the matrix type does not match");
+        }
+        if (header.rows > (uint64_t)std::numeric_limits<IndexT>::max() || header.cols > (uint64_t)std::numeric_limits<ColT>::max() || header.nnz > (uint64_t)std::numeric_limits<IndexT>::max())
+        {
+            throw std::runtime_error("sparse: " + path + " has dimensions that do not fit the index type");
+        }
+        if (header.fileBytes > bytes || header.rowStartOffset % BinaryAlignment != 0 || header.colIdxOffset % BinaryAlignment != 0 || header.valuesOffset % BinaryAlignment != 0 ||
+            !__sectionFits(header.rowStartOffset, header.rows + 1, sizeof(IndexT), bytes) || !__sectionFits(header.colIdxOffset, header.nnz, sizeof(ColT), bytes) ||
+            !__sectionFits(header.valuesOffset, header.nnz, sizeof(ValueT), bytes))
+        {
+            throw std::runtime_error("sparse: " + path + " is truncated or corrupt");
+        }
+
+        IndexT *rowStart = reinterpret_cast<IndexT *>(base + header.rowStartOffset);
+        ColT *colIdx = reinterpret_cast<ColT *>(base + header.colIdxOffset);
+        ValueT *values = reinterpret_cast<ValueT *>(base + header.valuesOffset);
+
+        // the rows must partition [0, nnz), the column indices are not scanned (the load stays O(rows))
+        bool ordered = rowStart[0] == 0 && (uint64_t)rowStart[header.rows] == header.nnz;
+        for (uint64_t i = 0; ordered && i < header.rows; i++)
+        {
+            ordered = rowStart[i] <= rowStart[i + 1];
+        }
+        if (!ordered)
+        {
+            throw std::runtime_error("sparse: " + path + " has a corrupt rowStart");
+        }
+
+        return Matrix(header.rows, header.cols, header.nnz, rowStart, colIdx, values, std::move(storage));
+    }
+
+    // __skipSpaces advances p over blanks, stops at the end of the line
+    inline const char *__skipSpaces(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        {
+            p++;
+        }
+        return p;
+    }
+
+    template <typename T>
+    inline const char *__parseNumber(const char *p, const char *end, T &value)
+    {
+        p = __skipSpaces(p, end);
+        if (p < end && *p == '+')
+        {
+            p++;
+        }
+        std::from_chars_result result = std::from_chars(p, end, value);
+        return (result.ec == std::errc()) ? result.ptr : nullptr;
+    }
+
+    template <typename Matrix>
+    Matrix ReadMatrixMarket(const std::string &path)
+    {
+        typedef typename Matrix::Index IndexT;
+        typedef typename Matrix::Value ValueT;
+        typedef typename Matrix::Element Element;
+
+        uint64_t bytes = 0;
+        std::shared_ptr<void> storage = __mapFile(path, bytes);
+        const char *begin = static_cast<const char *>(storage.get());
+        const char *end = begin + bytes;
+
+        // header: %%MatrixMarket matrix coordinate <field> <symmetry>
+        const char *lineEnd = std::find(begin, end, '\n');
+        std::istringstream banner(std::string(begin, lineEnd));
+        std::string tag, object, format, field, symmetry;
+        banner >> tag >> object >> format >> field >> symmetry;
+        for (std::string *s : {&object, &format, &field, &symmetry})
+        {
+            std::transform(s->begin(), s->end(), s->begin(), ::tolower);
+        }
+
+        if (tag != "%%MatrixMarket" || object != "matrix" || format != "coordinate")
+        {
+            throw std::runtime_error("sparse: " + path + " is not a coordinate Matrix Market file");
+        }
+        if (field != "real" && field != "integer" && field != "pattern")
+        {
+            throw std::runtime_error("sparse: " + path + " has an unsupported field " + field);
+        }
+        if (symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric")
+        {
+            throw std::runtime_error("sparse: " + path + " has an unsupported symmetry " + symmetry);
+        }
+
+        const bool pattern = (field == "pattern");
+        const bool symmetric = (symmetry != "general");
+        const ValueT mirrorSign = (symmetry == "skew-symmetric") ? -1.0 : 1.0;
+
+        // skip comments, then the size line: rows cols entries
+        const char *p = lineEnd;
+        while (p < end && (*p == '\n' || *p == '%'))
+        {
+            if (*p == '%')
+            {
+                p = std::find(p, end, '\n');
+            }
+            else
+            {
+                p++;
+            }
+        }
+
+        long long rows = 0, cols = 0, entries = 0;
+        const char *q = p;
+        if ((q = __parseNumber(q, end, rows)) == nullptr || (q = __parseNumber(q, end, cols)) == nullptr || (q = __parseNumber(q, end, entries)) == nullptr)
+        {
+            throw std::runtime_error("sparse: " + path + " has no size line");
+        }
+        if (rows < 0 || cols < 0 || entries < 0)
+        {
+            throw std::runtime_error("sparse: " + path + " has a negative size");
+        }
+        if (rows > std::numeric_limits<IndexT>::max() || cols > std::numeric_limits<typename Matrix::ColIndex>::max())
+        {
+            throw std::overflow_error("sparse: " + path + " is too large for the index type");
+        }
+        const char *data = std::find(q, end, '\n');
+
+        // split the entries into chunks at line boundaries, every thread parses its own chunk
+        const int T = std::max<long long>(1, std::min<long long>(gemm::utils::numThreads(), (end - data) / (1 << 20) + 1));
+        std::vector<const char *> bounds(T + 1);
+        bounds[0] = data;
+        bounds[T] = end;
+        for (int t = 1; t < T; t++)
+        {
+            const char *b = data + (end - data) * t / T;
+            bounds[t] = std::min(end, std::find(std::max(b, bounds[t - 1]), end, '\n'));
+        }
+
+        std::vector<std::vector<Element>> parts(T);
+        std::vector<int> failed(T, 0);
+        std::vector<long long> counts(T, 0); // entry lines, before mirroring
+
+        gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+            for (int t = tid; t < T; t += nthreads)
+            {
+                const char *s = bounds[t];
+                const char *e = bounds[t + 1];
+                std::vector<Element> &part = parts[t];
+                part.reserve((e - s) / 16);
+
+                while (s < e)
+                {
+                    const char *eol = std::find(s, e, '\n');
+                    const char *c = __skipSpaces(s, eol);
+
+                    if (c < eol && *c != '%')
+                    {
+                        long long row = 0, col = 0;
+                        ValueT val = 1.0;
+                        if ((c = __parseNumber(c, eol, row)) == nullptr || (c = __parseNumber(c, eol, col)) == nullptr || (!pattern && __parseNumber(c, eol, val) == nullptr) || row < 1 || row > rows || col < 1 || col > cols)
+                        {
+                            failed[t] = 1;
+                            return;
+                        }
+
+                        part.push_back(Element{IndexT(row - 1), IndexT(col - 1), val}); // 1-based
+                        counts[t]++;
+                        if (symmetric && row != col)
+                        {
+                            part.push_back(Element{IndexT(col - 1), IndexT(row - 1), mirrorSign * val});
+                        }
+                    }
+
+                    s = eol + 1;
+                }
+            }
+        });
+
+        std::vector<long long> offsets(T + 1, 0);
+        long long found = 0;
+        for (int t = 0; t < T; t++)
+        {
+            if (failed[t])
+            {
+                throw std::runtime_error("sparse: " + path + " has a malformed entry");
+            }
+            offsets[t + 1] = offsets[t] + parts[t].size();
+            found += counts[t];
+        }
+        if (found != entries)
+        {
+            throw std::runtime_error("sparse: " + path + " declares " + std::to_string(entries) + " entries but has " + std::to_string(found));
+        }
+        if (offsets[T] > std::numeric_limits<IndexT>::max())
+        {
+            throw std::overflow_error("sparse: " + path + " has too many entries for the index type");
+        }
+
+        Element *array = gemm::utils::allocArray<Element>(offsets[T]);
+        gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+            for (int t = tid; t < T; t += nthreads)
+            {
+                std::copy(parts[t].begin(), parts[t].end(), array + offsets[t]);
+                std::vector<Element>().swap(parts[t]);
+            }
+        });
+
+        Matrix A(rows, cols, offsets[T], array);
+        gemm::utils::alignedFree(array);
+
+        return A;
+    }
+
+    template <typename Matrix>
+    void ConvertMatrixMarket(const std::string &mtxPath, const std::string &binaryPath)
+    {
+        SaveBinary(ReadMatrixMarket<Matrix>(mtxPath), binaryPath);
+    }
+
+#define SPARSE_INSTANTIATE_IO(IndexT, ColT, ValueT)                                                         \
+    template void SaveBinary(const BasicSparseCSR<IndexT, ValueT, ColT> &A, const std::string &path);      \
+    template BasicSparseCSR<IndexT, ValueT, ColT> LoadBinary(const std::string &path);                     \
+    template BasicSparseCSR<IndexT, ValueT, ColT> ReadMatrixMarket(const std::string &path);               \
+    template void ConvertMatrixMarket<BasicSparseCSR<IndexT, ValueT, ColT>>(const std::string &mtxPath, const std::string &binaryPath);
+
+    SPARSE_FOR_EACH_CSR_TYPE(SPARSE_INSTANTIATE_IO)
+
+} // namespace sparse
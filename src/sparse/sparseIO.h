@@ -0,0 +1,60 @@
+#ifndef __SPARSE_IO_H__
+#define __SPARSE_IO_H__
+
+#include "sparseCSR.h"
+
+#include <cstdint>
+#include <string>
+
+namespace sparse
+{
+    // binary CSR file, version 1, little endian:
+    //   BinaryHeader (BinaryHeaderSize bytes), then the sections rowStart[rows + 1], colIdx[nnz], values[nnz],
+    //   every section starts at a multiple of BinaryAlignment bytes from the beginning of the file.
+    const char BinaryMagic[8] = {'S', 'P', 'A', 'R', 'S', 'E', 'C', 'R'};
+    const uint32_t BinaryVersion = 1;
+    const uint64_t BinaryAlignment = 64;
+    const uint64_t BinaryHeaderSize = 128;
+
+    struct BinaryHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t indexBytes;  // sizeof rowStart entries
+        uint32_t valueBytes;  // sizeof values entries
+        uint32_t colIdxBytes; // sizeof colIdx entries, 0 means indexBytes
+        uint64_t rows;
+        uint64_t cols;
+        uint64_t nnz;
+        uint64_t rowStartOffset; // section offsets in bytes
+        uint64_t colIdxOffset;
+        uint64_t valuesOffset;
+        uint64_t fileBytes;
+    };
+
+    // SaveBinary writes A to path in the binary CSR format, throws std::runtime_error on failure.
+    template <typename Matrix>
+    void SaveBinary(const Matrix &A, const std::string &path);
+
+    // LoadBinary maps the binary CSR file read-only and returns a view on it, no copy and no sort.
+    // Pages are copy-on-write, modifying the values never changes the file.
+    // The index and value sizes of the file must match Matrix. The sections must lie inside the file and
+    // rowStart must be non-decreasing from 0 to nnz, column indices are not checked.
+    // Throws std::runtime_error on failure or a corrupt file.
+    template <typename Matrix = SparseCSR>
+    Matrix LoadBinary(const std::string &path);
+
+    // ReadMatrixMarket parses a coordinate Matrix Market (.mtx) file in parallel.
+    // Supported fields: real, integer, pattern; symmetries: general, symmetric, skew-symmetric.
+    // Throws std::runtime_error on failure or when the entry count differs from the size line,
+    // std::overflow_error when the sizes do not fit Matrix.
+    template <typename Matrix = SparseCSR>
+    Matrix ReadMatrixMarket(const std::string &path);
+
+    // ConvertMatrixMarket converts a .mtx file into the binary CSR format of Matrix once.
+    template <typename Matrix = SparseCSR>
+    void ConvertMatrixMarket(const std::string &mtxPath, const std::string &binaryPath);
+
+} // namespace sparse
+
+#endif // __SPARSE_IO_H__
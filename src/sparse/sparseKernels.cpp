@@ -0,0 +1,196 @@
+#include "sparseKernels.h"
+
+#include "sparseUtils.h" // balancedPartition, rowDot
+
+#include "gemm_thread.h" // parallelFor, numThreads
+
+#include <algorithm> // std::min
+#include <vector>    // std::vector
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace sparse
+{
+    // columns of C processed at once by SpMM, the C slice stays in L1
+    const int SpMMBlockK = 256;
+
+    // non-zeros of a row of S handled together by SDDMM, they share the loads of the row of A
+    const int SDDMMGroup = 4;
+
+    // __denseDots writes dot(a, B[cols[j]]) for j in [0, NB) to out, every row of B has K elements
+    template <int NB>
+    inline void __denseDots(const float *a, const float *B, const long long bStride, const int *cols, const int K, float *out)
+    {
+        const float *b[NB];
+        float sum[NB];
+        for (int j = 0; j < NB; j++)
+        {
+            b[j] = B + cols[j] * bStride;
+            sum[j] = 0.0f;
+        }
+
+        int p = 0;
+#if defined(__AVX512F__)
+        __m512 acc[NB];
+        for (int j = 0; j < NB; j++)
+        {
+            acc[j] = _mm512_setzero_ps();
+        }
+        for (; p + 16 <= K; p += 16)
+        {
+            __m512 av = _mm512_loadu_ps(a + p);
+            for (int j = 0; j < NB; j++)
+            {
+                acc[j] = _mm512_fmadd_ps(av, _mm512_loadu_ps(b[j] + p), acc[j]);
+            }
+        }
+        for (int j = 0; j < NB; j++)
+        {
+            sum[j] = _mm512_reduce_add_ps(acc[j]);
+        }
+#elif defined(__AVX2__)
+        __m256 acc[NB];
+        for (int j = 0; j < NB; j++)
+        {
+            acc[j] = _mm256_setzero_ps();
+        }
+        for (; p + 8 <= K; p += 8)
+        {
+            __m256 av = _mm256_loadu_ps(a + p);
+            for (int j = 0; j < NB; j++)
+            {
+                acc[j] = _mm256_fmadd_ps(av, _mm256_loadu_ps(b[j] + p), acc[j]);
+            }
+        }
+        for (int j = 0; j < NB; j++)
+        {
+            __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc[j]), _mm256_extractf128_ps(acc[j], 1));
+            half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+            half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+            sum[j] = _mm_cvtss_f32(half);
+        }
+#endif
+
+        for (; p < K; p++)
+        {
+            for (int j = 0; j < NB; j++)
+            {
+                sum[j] += a[p] * b[j][p];
+            }
+        }
+        for (int j = 0; j < NB; j++)
+        {
+            out[j] = sum[j];
+        }
+    }
+
+    // __rowRanges splits the rows of A into ranges of about equal non-zero count
+    std::vector<int> __rowRanges(const SparseCSR &A)
+    {
+        return utils::balancedPartition(A.RowStart(), A.Rows(), gemm::utils::numThreads() * 4);
+    }
+
+    void SpMV(const SparseCSR &A, const float *x, float *y, const float alpha, const float beta)
+    {
+        const int *rowStart = A.RowStart();
+        const int *colIdx = A.ColIdx();
+        const float *values = A.Values();
+
+        std::vector<int> bounds = __rowRanges(A);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            for (long long r = begin; r < end; r++)
+            {
+                for (int i = bounds[r]; i < bounds[r + 1]; i++)
+                {
+                    float dot = utils::rowDot(colIdx, values, x, rowStart[i], rowStart[i + 1]);
+                    y[i] = (beta == 0.0f) ? alpha * dot : alpha * dot + beta * y[i];
+                }
+            }
+        });
+    }
+
+    void SpMM(const SparseCSR &A, const float *B, float *C, const int K, const int bStride, const int cStride, const float alpha, const float beta)
+    {
+        const int *rowStart = A.RowStart();
+        const int *colIdx = A.ColIdx();
+        const float *values = A.Values();
+
+        std::vector<int> bounds = __rowRanges(A);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            for (long long r = begin; r < end; r++)
+            {
+                for (int i = bounds[r]; i < bounds[r + 1]; i++)
+                {
+                    float *c = C + (long long)i * cStride;
+
+                    for (int j0 = 0; j0 < K; j0 += SpMMBlockK)
+                    {
+                        const int j1 = std::min(K, j0 + SpMMBlockK);
+
+                        for (int j = j0; j < j1; j++)
+                        {
+                            c[j] = (beta == 0.0f) ? 0.0f : beta * c[j];
+                        }
+
+                        for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+                        {
+                            const float aElement = alpha * values[k];
+                            const float *b = B + (long long)colIdx[k] * bStride;
+
+                            for (int j = j0; j < j1; j++) // contiguous, vectorized
+                            {
+                                c[j] += aElement * b[j];
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    void SDDMM(SparseCSR &S, const float *A, const float *B, const int K, const int aStride, const int bStride, const float alpha, const float beta)
+    {
+        const int *rowStart = S.RowStart();
+        const int *colIdx = S.ColIdx();
+        float *values = S.Values();
+
+        std::vector<int> bounds = __rowRanges(S);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            float dots[SDDMMGroup];
+            for (long long r = begin; r < end; r++)
+            {
+                for (int i = bounds[r]; i < bounds[r + 1]; i++)
+                {
+                    const float *a = A + (long long)i * aStride;
+
+                    for (int k = rowStart[i]; k < rowStart[i + 1];)
+                    {
+                        const int group = std::min(SDDMMGroup, rowStart[i + 1] - k);
+                        if (group == SDDMMGroup)
+                        {
+                            __denseDots<SDDMMGroup>(a, B, bStride, colIdx + k, K, dots);
+                        }
+                        else
+                        {
+                            for (int j = 0; j < group; j++)
+                            {
+                                __denseDots<1>(a, B, bStride, colIdx + k + j, K, dots + j);
+                            }
+                        }
+
+                        for (int j = 0; j < group; j++, k++)
+                        {
+                            values[k] = (beta == 0.0f) ? alpha * dots[j] : alpha * dots[j] + beta * values[k];
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+} // namespace sparse
@@ -0,0 +1,34 @@
+#ifndef __SPARSE_KERNELS_H__
+#define __SPARSE_KERNELS_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    // SpMV is the sparse matrix times dense vector multiplication.
+    // Rows are split by non-zero count over the threads, every row is a SIMD gather dot product.
+    // input    : A[M][N] sparse, x[N], y[M]
+    // function : y = alpha*A*x + beta*y, y is not read when beta == 0
+    // output   : y[M]
+    void SpMV(const SparseCSR &A, const float *x, float *y, const float alpha = 1.0, const float beta = 0.0);
+
+    // SpMM is the sparse matrix times row-major dense matrix multiplication.
+    // B and C follow the gemm Matrix convention: element (i, j) is data[i * stride + j].
+    // input    : A[M][N] sparse, B[N][K] with bStride, C[M][K] with cStride
+    // function : C = alpha*A*B + beta*C, C is not read when beta == 0
+    // output   : C[M][K]
+    void SpMM(const SparseCSR &A, const float *B, float *C, const int K, const int bStride, const int cStride, const float alpha = 1.0, const float beta = 0.0);
+
+    // SDDMM is the sampled dense-dense matrix multiplication: A*B^T is computed only at the non-zeros of S
+    // and written into the values of S, the pattern is not changed.
+    // Rows are split by non-zero count over the threads, every load of the row of A feeds SIMD dot
+    // products with four rows of B. A and B follow the gemm Matrix convention (row-major with stride).
+    // input    : S[M][N] sparse pattern, A[M][K] with aStride, B[N][K] with bStride
+    // function : S(i, j) = alpha*dot(A[i], B[j]) + beta*S(i, j) for every stored (i, j), S is not read when beta == 0
+    // output   : values of S
+    // O(nnz * K)
+    void SDDMM(SparseCSR &S, const float *A, const float *B, const int K, const int aStride, const int bStride, const float alpha = 1.0, const float beta = 0.0);
+
+} // namespace sparse
+
+#endif // __SPARSE_KERNELS_H__
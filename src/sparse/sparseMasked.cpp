@@ -0,0 +1,470 @@
+#include "sparseMasked.h"
+
+#include "sparseUtils.h" // balancedPartition, rowPrefix
+
+#include "gemm_thread.h" // parallelRun, parallelFor, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::sort, std::lower_bound, std::min
+#include <atomic>    // std::atomic
+#include <stdexcept> // std::invalid_argument
+#include <utility>   // std::swap
+#include <vector>    // std::vector
+
+namespace sparse
+{
+    // MaskedAccumulator accumulates one row of C<M> = A * B at a time, it is private to one thread.
+    // A column of the row is absent, masked (a column of the mask row) or hit (holds a sum).
+    // Structural masks only accumulate into masked columns, complemented masks only into the others.
+    // Short rows use an open addressing hash table, long rows a dense table of length cols allocated on first use.
+    class MaskedAccumulator
+    {
+    private:
+        static const char Masked = 1;
+        static const char Hit = 2;
+
+        int cols;
+        bool complement;
+
+        // hash table, hashKeys[slot] == -1 is an empty slot
+        std::vector<int> hashKeys;
+        std::vector<char> hashState;
+        std::vector<float> hashVals;
+        int hashMask = 0;
+
+        // dense table, the state of col is denseStamp[col] - stamp when it is Masked or Hit
+        std::vector<long long> denseStamp;
+        std::vector<float> denseVals;
+        long long stamp = 0;
+
+        std::vector<int> touched; // hash slots to clear, or dense columns which are hit
+        std::vector<int> sorted;
+        const int *maskCols = nullptr;
+        int maskLen = 0;
+        bool useHash = true;
+
+        int __find(const int col) const
+        {
+            int h = (unsigned(col) * 2654435761u) & hashMask;
+            while (hashKeys[h] != col && hashKeys[h] != -1)
+            {
+                h = (h + 1) & hashMask;
+            }
+            return h;
+        }
+
+        char __state(const int col) const
+        {
+            if (useHash)
+            {
+                int h = __find(col);
+                return (hashKeys[h] == -1) ? 0 : hashState[h];
+            }
+            long long s = denseStamp[col] - stamp;
+            return (s == Masked || s == Hit) ? s : 0;
+        }
+
+    public:
+        // rows with more entries than this, or with entries close to cols, go to the dense table
+        static const int HashMaxSize = 1 << 14;
+
+        MaskedAccumulator(const int cols, const bool complement)
+        {
+            this->cols = cols;
+            this->complement = complement;
+        }
+
+        void BeginRow(const int *maskCols, const int maskLen, const long long rowFlops)
+        {
+            this->maskCols = maskCols;
+            this->maskLen = maskLen;
+            touched.clear();
+
+            const long long entries = complement ? maskLen + rowFlops : maskLen;
+            useHash = entries <= HashMaxSize && entries * 8 < cols;
+
+            if (useHash)
+            {
+                int size = 16;
+                while (size < entries * 4) // load factor <= 1/4
+                {
+                    size <<= 1;
+                }
+                if ((int)hashKeys.size() < size)
+                {
+                    hashKeys.assign(size, -1);
+                    hashState.resize(size);
+                    hashVals.resize(size);
+                }
+                hashMask = size - 1;
+
+                for (int k = 0; k < maskLen; k++)
+                {
+                    int h = __find(maskCols[k]);
+                    hashKeys[h] = maskCols[k];
+                    hashState[h] = Masked;
+                    touched.push_back(h);
+                }
+            }
+            else
+            {
+                if (denseStamp.empty())
+                {
+                    denseStamp.assign(cols, -4);
+                    denseVals.resize(cols);
+                }
+                stamp += 4;
+
+                for (int k = 0; k < maskLen; k++)
+                {
+                    denseStamp[maskCols[k]] = stamp + Masked;
+                }
+            }
+        }
+
+        void Accumulate(const int col, const float val)
+        {
+            if (useHash)
+            {
+                int h = __find(col);
+                if (hashKeys[h] == -1)
+                {
+                    if (complement)
+                    {
+                        hashKeys[h] = col;
+                        hashState[h] = Hit;
+                        hashVals[h] = val;
+                        touched.push_back(h);
+                    }
+                }
+                else if (hashState[h] == Hit)
+                {
+                    hashVals[h] += val;
+                }
+                else if (complement == false) // first product on a mask column
+                {
+                    hashState[h] = Hit;
+                    hashVals[h] = val;
+                }
+            }
+            else
+            {
+                long long s = denseStamp[col] - stamp;
+                if (s == Hit)
+                {
+                    denseVals[col] += val;
+                }
+                else if ((s == Masked) != complement) // structural: masked, complement: absent
+                {
+                    denseStamp[col] = stamp + Hit;
+                    denseVals[col] = val;
+                    if (complement)
+                    {
+                        touched.push_back(col);
+                    }
+                }
+            }
+        }
+
+        // EndRow writes the hit columns sorted, returns their number and resets the accumulator
+        int EndRow(int *colIdx, float *values)
+        {
+            int p = 0;
+
+            if (complement == false)
+            {
+                // the mask row is sorted, no sort needed
+                for (int k = 0; k < maskLen; k++)
+                {
+                    int col = maskCols[k];
+                    if (__state(col) == Hit)
+                    {
+                        colIdx[p] = col;
+                        values[p] = useHash ? hashVals[__find(col)] : denseVals[col];
+                        p++;
+                    }
+                }
+            }
+            else
+            {
+                sorted.clear();
+                for (int t : touched)
+                {
+                    if (useHash == false || hashState[t] == Hit)
+                    {
+                        sorted.push_back(useHash ? hashKeys[t] : t);
+                    }
+                }
+                std::sort(sorted.begin(), sorted.end());
+                for (int col : sorted)
+                {
+                    colIdx[p] = col;
+                    values[p] = useHash ? hashVals[__find(col)] : denseVals[col];
+                    p++;
+                }
+            }
+
+            if (useHash)
+            {
+                for (int slot : touched)
+                {
+                    hashKeys[slot] = -1;
+                }
+            }
+
+            return p;
+        }
+    };
+
+    // __compactRows packs the rows written at tmpStart[i] with counts[i] entries into a new matrix
+    SparseCSR __compactRows(const int rows, const int cols, const std::vector<long long> &tmpStart, const std::vector<int> &counts, const int *tmpCol, const float *tmpVal)
+    {
+        long long nnz = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            nnz += counts[i];
+        }
+
+        SparseCSR C(rows, cols, nnz); // allocate memory
+        int *rowStart = C.RowStart();
+        rowStart[0] = 0;
+        for (int i = 0; i < rows; i++)
+        {
+            rowStart[i + 1] = rowStart[i] + counts[i];
+        }
+
+        gemm::utils::parallelFor(0, rows, 1024, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                std::copy_n(tmpCol + tmpStart[i], counts[i], C.ColIdx() + rowStart[i]);
+                std::copy_n(tmpVal + tmpStart[i], counts[i], C.Values() + rowStart[i]);
+            }
+        });
+
+        return C;
+    }
+
+    // __forEachRange runs body(row) over the rows of every range of bounds, ranges are handed out dynamically
+    template <typename Init, typename Body>
+    void __forEachRange(const std::vector<int> &bounds, Init init, Body body)
+    {
+        const int ranges = bounds.size() - 1;
+        std::atomic<int> next(0);
+
+        gemm::utils::parallelRun([&](const int, const int) {
+            auto state = init();
+            for (int r = next++; r < ranges; r = next++)
+            {
+                for (int row = bounds[r]; row < bounds[r + 1]; row++)
+                {
+                    body(state, row);
+                }
+            }
+        });
+    }
+
+    // __sparseDot returns the dot product of two sorted sparse vectors and whether they share a column.
+    // Lists of very different lengths are intersected by galloping the short one into the long one.
+    inline bool __sparseDot(const int *c1, const float *v1, int n1, const int *c2, const float *v2, int n2, float &sum)
+    {
+        if (n1 > n2)
+        {
+            std::swap(c1, c2);
+            std::swap(v1, v2);
+            std::swap(n1, n2);
+        }
+
+        bool found = false;
+        sum = 0.0f;
+
+        if (n1 * 16 < n2)
+        {
+            const int *lo = c2;
+            for (int i = 0; i < n1; i++)
+            {
+                lo = std::lower_bound(lo, c2 + n2, c1[i]);
+                if (lo == c2 + n2)
+                {
+                    break;
+                }
+                if (*lo == c1[i])
+                {
+                    sum += v1[i] * v2[lo - c2];
+                    found = true;
+                }
+            }
+            return found;
+        }
+
+        int i = 0, j = 0;
+        while (i < n1 && j < n2)
+        {
+            if (c1[i] < c2[j])
+            {
+                i++;
+            }
+            else if (c1[i] > c2[j])
+            {
+                j++;
+            }
+            else
+            {
+                sum += v1[i] * v2[j];
+                found = true;
+                i++;
+                j++;
+            }
+        }
+        return found;
+    }
+
+    SparseCSR MaskedMul(const SparseCSR &A, const SparseCSR &B, const SparseCSR &M, const MaskKind kind, const MaskedMethod method)
+    {
+        if (A.Cols() != B.Rows() || M.Rows() != A.Rows() || M.Cols() != B.Cols())
+        {
+            throw std::invalid_argument("sparse: MaskedMul shapes do not match");
+        }
+
+        const int rows = A.Rows();
+        const bool complement = (kind == MaskComplement);
+
+        auto lenA = [&](const int i) -> int { return A.RowStart()[i + 1] - A.RowStart()[i]; };
+        auto lenM = [&](const int i) -> int { return M.RowStart()[i + 1] - M.RowStart()[i]; };
+
+        // flops of the row-wise product, rows with an empty structural mask are skipped
+        std::vector<long long> flopsPrefix = utils::rowPrefix(rows, [&](const int i) -> long long {
+            long long flops = 0;
+            if (complement || lenM(i) > 0)
+            {
+                for (int k = A.RowStart()[i]; k < A.RowStart()[i + 1]; k++)
+                {
+                    flops += B.RowStart()[A.ColIdx()[k] + 1] - B.RowStart()[A.ColIdx()[k]];
+                }
+            }
+            return flops;
+        });
+
+        bool useDot = (method == MaskedDot);
+        std::vector<long long> dotPrefix;
+        if (complement == false && method != MaskedGustavson)
+        {
+            std::vector<int> colLen(B.Cols(), 0);
+            for (int k = 0; k < B.Nnz(); k++)
+            {
+                colLen[B.ColIdx()[k]]++;
+            }
+
+            dotPrefix = utils::rowPrefix(rows, [&](const int i) -> long long {
+                long long work = 0;
+                if (lenA(i) > 0)
+                {
+                    for (int k = M.RowStart()[i]; k < M.RowStart()[i + 1]; k++)
+                    {
+                        work += lenA(i) + colLen[M.ColIdx()[k]];
+                    }
+                }
+                return work;
+            });
+
+            useDot = useDot || (method == MaskedAuto && dotPrefix[rows] + B.Nnz() < flopsPrefix[rows]);
+        }
+        if (useDot && complement)
+        {
+            throw std::invalid_argument("sparse: MaskedDot needs a structural mask");
+        }
+
+        // every row is written at tmpStart[i], at most min(mask, flops) entries for a structural mask
+        std::vector<long long> tmpStart(rows + 1, 0);
+        for (int i = 0; i < rows; i++)
+        {
+            long long flops = flopsPrefix[i + 1] - flopsPrefix[i];
+            long long bound = complement ? std::min<long long>(flops, B.Cols() - lenM(i)) : (useDot ? lenM(i) : std::min<long long>(flops, lenM(i)));
+            tmpStart[i + 1] = tmpStart[i] + bound;
+        }
+
+        int *tmpCol = gemm::utils::allocArray<int>(tmpStart[rows]);
+        float *tmpVal = gemm::utils::allocArray<float>(tmpStart[rows]);
+        std::vector<int> counts(rows, 0);
+
+        if (useDot)
+        {
+            // C[i][j] = A[i][:] . B^T[j][:] for every (i, j) of the mask
+            const SparseCSR BT = B.Transpose();
+            std::vector<int> bounds = utils::balancedPartition(dotPrefix.data(), rows, gemm::utils::numThreads() * 8);
+
+            __forEachRange(
+                bounds, []() { return 0; },
+                [&](int &, const int i) {
+                    if (lenA(i) == 0)
+                    {
+                        return;
+                    }
+
+                    const int *aCols = A.ColIdx() + A.RowStart()[i];
+                    const float *aVals = A.Values() + A.RowStart()[i];
+                    long long p = tmpStart[i];
+
+                    for (int k = M.RowStart()[i]; k < M.RowStart()[i + 1]; k++)
+                    {
+                        int j = M.ColIdx()[k];
+                        int b0 = BT.RowStart()[j];
+                        float sum;
+                        if (__sparseDot(aCols, aVals, lenA(i), BT.ColIdx() + b0, BT.Values() + b0, BT.RowStart()[j + 1] - b0, sum))
+                        {
+                            tmpCol[p] = j;
+                            tmpVal[p] = sum;
+                            p++;
+                        }
+                    }
+                    counts[i] = p - tmpStart[i];
+                });
+        }
+        else
+        {
+            // masked Gustavson, for a structural mask the B rows are cut to the column span of the mask row
+            std::vector<int> bounds = utils::balancedPartition(flopsPrefix.data(), rows, gemm::utils::numThreads() * 8);
+
+            __forEachRange(
+                bounds, [&]() { return MaskedAccumulator(B.Cols(), complement); },
+                [&](MaskedAccumulator &acc, const int i) {
+                    const int maskLen = lenM(i);
+                    if (lenA(i) == 0 || (complement == false && maskLen == 0))
+                    {
+                        return;
+                    }
+
+                    const int *maskCols = M.ColIdx() + M.RowStart()[i];
+                    acc.BeginRow(maskCols, maskLen, flopsPrefix[i + 1] - flopsPrefix[i]);
+
+                    for (int k = A.RowStart()[i]; k < A.RowStart()[i + 1]; k++)
+                    {
+                        const int colA = A.ColIdx()[k];
+                        const float valA = A.Values()[k];
+
+                        const int *first = B.ColIdx() + B.RowStart()[colA];
+                        const int *last = B.ColIdx() + B.RowStart()[colA + 1];
+                        if (complement == false)
+                        {
+                            first = std::lower_bound(first, last, maskCols[0]);
+                            last = std::upper_bound(first, last, maskCols[maskLen - 1]);
+                        }
+
+                        for (const int *c = first; c < last; c++)
+                        {
+                            acc.Accumulate(*c, valA * B.Values()[c - B.ColIdx()]);
+                        }
+                    }
+
+                    counts[i] = acc.EndRow(tmpCol + tmpStart[i], tmpVal + tmpStart[i]);
+                });
+        }
+
+        SparseCSR C = __compactRows(rows, B.Cols(), tmpStart, counts, tmpCol, tmpVal);
+
+        gemm::utils::alignedFree(tmpCol);
+        gemm::utils::alignedFree(tmpVal);
+
+        return C;
+    }
+
+} // namespace sparse
@@ -0,0 +1,34 @@
+#ifndef __SPARSE_MASKED_H__
+#define __SPARSE_MASKED_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    enum MaskKind
+    {
+        MaskStructural, // keep the entries of A * B on the pattern of M
+        MaskComplement, // keep the entries of A * B off the pattern of M
+    };
+
+    enum MaskedMethod
+    {
+        MaskedAuto,
+        MaskedDot,       // C[i][j] = A[i][:] . B[:][j] for every (i, j) of M, structural masks only
+        MaskedGustavson, // row-wise product, contributions outside the mask are dropped as they are generated
+    };
+
+    // MaskedMul is the masked sparse matrix multiplication C<M> = A * B used by graph algorithms
+    // (e.g. triangle counting: sum of C<L> = L * L for the strictly lower triangle L).
+    // Only the pattern of M is used, its values are ignored. Entries of C are only created where a product exists.
+    // MaskedAuto picks the dot product form when the merge work over the mask, sum of nnz(A row) + nnz(B column),
+    // is smaller than the flops of the row-wise product. Both forms are parallel over rows balanced by their cost.
+    // input    : A[M][K], B[K][N], M[M][N] sparse
+    // function : C = (A * B) .* pattern(M) (structural) or (A * B) .* !pattern(M) (complement)
+    // output   : C[M][N], throws std::invalid_argument when the shapes do not match
+    // O(mask merge work) for the dot form, O(flops of the rows with a non-empty mask) for Gustavson
+    SparseCSR MaskedMul(const SparseCSR &A, const SparseCSR &B, const SparseCSR &M, const MaskKind kind = MaskStructural, const MaskedMethod method = MaskedAuto);
+
+} // namespace sparse
+
+#endif // __SPARSE_MASKED_H__
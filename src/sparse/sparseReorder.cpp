@@ -0,0 +1,410 @@
+#include "sparseReorder.h"
+
+#include "sparseUtils.h" // balancedPartition
+
+#include "gemm_thread.h" // parallelFor, numThreads
+
+#include <algorithm> // std::sort, std::stable_sort, std::reverse, std::min_element
+#include <stdexcept> // std::invalid_argument
+#include <utility>   // std::move, std::pair
+
+namespace sparse
+{
+    Permutation Permutation::FromOrder(std::vector<int> order)
+    {
+        Permutation p;
+        p.perm = std::move(order);
+        p.inverse.resize(p.perm.size());
+
+        gemm::utils::parallelFor(0, p.perm.size(), 1 << 14, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                p.inverse[p.perm[i]] = i;
+            }
+        });
+
+        return p;
+    }
+
+    // SymmetricGraph is the adjacency structure of A + A^T without the diagonal, the orderings only look at the pattern.
+    struct SymmetricGraph
+    {
+        int n;
+        std::vector<int> start; // n + 1 entries
+        std::vector<int> adj;
+
+        int Degree(const int v) const { return start[v + 1] - start[v]; }
+    };
+
+    // __symmetricGraph merges the sorted rows of A and A^T in two parallel passes, count then fill
+    SymmetricGraph __symmetricGraph(const SparseCSR &A)
+    {
+        const SparseCSR T = A.Transpose();
+        const int n = A.Rows();
+
+        // forEachNeighbour(v, visit) visits the sorted union of row v of A and of A^T, without v itself
+        auto forEachNeighbour = [&](const int v, auto visit) {
+            int i = A.RowStart()[v], iEnd = A.RowStart()[v + 1];
+            int j = T.RowStart()[v], jEnd = T.RowStart()[v + 1];
+            while (i < iEnd || j < jEnd)
+            {
+                int col;
+                if (j == jEnd || (i < iEnd && A.ColIdx()[i] < T.ColIdx()[j]))
+                {
+                    col = A.ColIdx()[i++];
+                }
+                else if (i == iEnd || T.ColIdx()[j] < A.ColIdx()[i])
+                {
+                    col = T.ColIdx()[j++];
+                }
+                else
+                {
+                    col = A.ColIdx()[i++];
+                    j++;
+                }
+
+                if (col != v)
+                {
+                    visit(col);
+                }
+            }
+        };
+
+        SymmetricGraph g;
+        g.n = n;
+        g.start.assign(n + 1, 0);
+
+        gemm::utils::parallelFor(0, n, 1024, [&](const long long begin, const long long end) {
+            for (long long v = begin; v < end; v++)
+            {
+                int degree = 0;
+                forEachNeighbour(v, [&](const int) { degree++; });
+                g.start[v + 1] = degree;
+            }
+        });
+        for (int v = 0; v < n; v++)
+        {
+            g.start[v + 1] += g.start[v];
+        }
+
+        g.adj.resize(g.start[n]);
+        gemm::utils::parallelFor(0, n, 1024, [&](const long long begin, const long long end) {
+            for (long long v = begin; v < end; v++)
+            {
+                int p = g.start[v];
+                forEachNeighbour(v, [&](const int u) { g.adj[p++] = u; });
+            }
+        });
+
+        return g;
+    }
+
+    // __levelBFS runs a breadth-first search from root inside its component, marking with tag.
+    // Returns the number of levels, last receives the vertices of the last level.
+    int __levelBFS(const SymmetricGraph &g, const int root, std::vector<int> &mark, const int tag, std::vector<int> &queue, std::vector<int> &last)
+    {
+        queue.clear();
+        queue.push_back(root);
+        mark[root] = tag;
+
+        int levels = 0;
+        size_t levelBegin = 0;
+        while (levelBegin < queue.size())
+        {
+            size_t levelEnd = queue.size();
+            last.assign(queue.begin() + levelBegin, queue.begin() + levelEnd);
+            levels++;
+
+            for (size_t k = levelBegin; k < levelEnd; k++)
+            {
+                int v = queue[k];
+                for (int i = g.start[v]; i < g.start[v + 1]; i++)
+                {
+                    if (mark[g.adj[i]] != tag)
+                    {
+                        mark[g.adj[i]] = tag;
+                        queue.push_back(g.adj[i]);
+                    }
+                }
+            }
+            levelBegin = levelEnd;
+        }
+
+        return levels;
+    }
+
+    // O(nnz * log(max degree)), every pseudo-peripheral search is bounded to a few BFS of the component
+    Permutation ReverseCuthillMcKee(const SparseCSR &A)
+    {
+        const SymmetricGraph g = __symmetricGraph(A);
+        const int n = g.n;
+
+        // component roots are tried by ascending degree
+        std::vector<int> byDegree(n);
+        for (int v = 0; v < n; v++)
+        {
+            byDegree[v] = v;
+        }
+        std::stable_sort(byDegree.begin(), byDegree.end(), [&](const int v1, const int v2) -> bool {
+            return g.Degree(v1) < g.Degree(v2);
+        });
+
+        std::vector<int> order;
+        order.reserve(n);
+        std::vector<char> visited(n, 0);
+        std::vector<int> mark(n, -1), queue, last, neighbours;
+        int tag = 0;
+
+        for (int seed : byDegree)
+        {
+            if (visited[seed])
+            {
+                continue;
+            }
+
+            // pseudo-peripheral root (George and Liu): move to a minimum degree vertex of the last level
+            // while the number of levels grows
+            int root = seed;
+            int levels = __levelBFS(g, root, mark, tag++, queue, last);
+            for (int round = 0; round < 8; round++)
+            {
+                int candidate = *std::min_element(last.begin(), last.end(), [&](const int v1, const int v2) -> bool {
+                    return g.Degree(v1) < g.Degree(v2);
+                });
+                int candidateLevels = __levelBFS(g, candidate, mark, tag++, queue, last);
+                if (candidateLevels <= levels)
+                {
+                    break;
+                }
+                root = candidate;
+                levels = candidateLevels;
+            }
+
+            // Cuthill-McKee: breadth-first, the unvisited neighbours of a vertex by ascending degree
+            size_t head = order.size();
+            order.push_back(root);
+            visited[root] = 1;
+            while (head < order.size())
+            {
+                int v = order[head++];
+
+                neighbours.clear();
+                for (int i = g.start[v]; i < g.start[v + 1]; i++)
+                {
+                    if (visited[g.adj[i]] == 0)
+                    {
+                        visited[g.adj[i]] = 1;
+                        neighbours.push_back(g.adj[i]);
+                    }
+                }
+                std::sort(neighbours.begin(), neighbours.end(), [&](const int v1, const int v2) -> bool {
+                    return g.Degree(v1) < g.Degree(v2) || (g.Degree(v1) == g.Degree(v2) && v1 < v2);
+                });
+                order.insert(order.end(), neighbours.begin(), neighbours.end());
+            }
+        }
+
+        std::reverse(order.begin(), order.end());
+
+        return Permutation::FromOrder(std::move(order));
+    }
+
+    Permutation DegreeOrder(const SparseCSR &A)
+    {
+        const SymmetricGraph g = __symmetricGraph(A);
+
+        std::vector<int> order(g.n);
+        for (int v = 0; v < g.n; v++)
+        {
+            order[v] = v;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](const int v1, const int v2) -> bool {
+            return g.Degree(v1) > g.Degree(v2);
+        });
+
+        return Permutation::FromOrder(std::move(order));
+    }
+
+    // Label propagation: every vertex takes the most frequent label of its neighbours, in vertex order,
+    // a vertex keeps its label on ties. The pass is sequential so the result is deterministic.
+    Permutation ClusterOrder(const SparseCSR &A, const int iterations)
+    {
+        const SymmetricGraph g = __symmetricGraph(A);
+        const int n = g.n;
+
+        std::vector<int> label(n);
+        for (int v = 0; v < n; v++)
+        {
+            label[v] = v;
+        }
+
+        std::vector<int> labels;
+        for (int it = 0; it < iterations; it++)
+        {
+            long long changed = 0;
+            for (int v = 0; v < n; v++)
+            {
+                if (g.Degree(v) == 0)
+                {
+                    continue;
+                }
+
+                labels.clear();
+                for (int i = g.start[v]; i < g.start[v + 1]; i++)
+                {
+                    labels.push_back(label[g.adj[i]]);
+                }
+                std::sort(labels.begin(), labels.end());
+
+                int best = label[v], bestCount = 0, ownCount = 0;
+                for (size_t k = 0; k < labels.size();)
+                {
+                    size_t e = k;
+                    while (e < labels.size() && labels[e] == labels[k])
+                    {
+                        e++;
+                    }
+                    int count = e - k;
+                    if (labels[k] == label[v])
+                    {
+                        ownCount = count;
+                    }
+                    if (count > bestCount) // the smallest label wins among the most frequent
+                    {
+                        best = labels[k];
+                        bestCount = count;
+                    }
+                    k = e;
+                }
+
+                if (ownCount < bestCount && best != label[v])
+                {
+                    label[v] = best;
+                    changed++;
+                }
+            }
+
+            if (changed * 1000 <= n) // converged up to 0.1% of the vertices
+            {
+                break;
+            }
+        }
+
+        // communities are numbered by their first vertex, counting sort keeps the vertex order inside a community
+        std::vector<int> rank(n, -1), count(n + 1, 0);
+        int communities = 0;
+        for (int v = 0; v < n; v++)
+        {
+            if (rank[label[v]] < 0)
+            {
+                rank[label[v]] = communities++;
+            }
+            count[rank[label[v]] + 1]++;
+        }
+        for (int c = 0; c < communities; c++)
+        {
+            count[c + 1] += count[c];
+        }
+
+        std::vector<int> order(n);
+        for (int v = 0; v < n; v++)
+        {
+            order[count[rank[label[v]]]++] = v;
+        }
+
+        return Permutation::FromOrder(std::move(order));
+    }
+
+    // B[i][j] = A[perm[i]][perm[j]], rows are copied in parallel and sorted by their new column
+    SparseCSR PermuteSymmetric(const SparseCSR &A, const Permutation &p)
+    {
+        if (A.Rows() != A.Cols() || A.Rows() != p.Size())
+        {
+            throw std::invalid_argument("sparse: PermuteSymmetric needs a square matrix of the permutation size");
+        }
+
+        const int n = A.Rows();
+        SparseCSR B(n, n, A.Nnz()); // allocate memory
+
+        int *rowStart = B.RowStart();
+        rowStart[0] = 0;
+        for (int i = 0; i < n; i++)
+        {
+            rowStart[i + 1] = rowStart[i] + A.RowStart()[p.perm[i] + 1] - A.RowStart()[p.perm[i]];
+        }
+
+        std::vector<int> bounds = utils::balancedPartition(rowStart, n, gemm::utils::numThreads() * 4);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            std::vector<std::pair<int, float>> row;
+
+            for (int i = bounds[begin]; i < bounds[end]; i++)
+            {
+                int old = p.perm[i];
+
+                row.clear();
+                for (int k = A.RowStart()[old]; k < A.RowStart()[old + 1]; k++)
+                {
+                    row.emplace_back(p.inverse[A.ColIdx()[k]], A.Values()[k]);
+                }
+                std::sort(row.begin(), row.end(), [](const std::pair<int, float> &e1, const std::pair<int, float> &e2) -> bool {
+                    return e1.first < e2.first;
+                });
+
+                for (size_t k = 0; k < row.size(); k++)
+                {
+                    B.ColIdx()[rowStart[i] + k] = row[k].first;
+                    B.Values()[rowStart[i] + k] = row[k].second;
+                }
+            }
+        });
+
+        return B;
+    }
+
+    ReorderedCSR Reorder(const SparseCSR &A, const ReorderMethod method)
+    {
+        if (A.Rows() != A.Cols())
+        {
+            throw std::invalid_argument("sparse: Reorder needs a square matrix");
+        }
+
+        ReorderedCSR r;
+        switch (method)
+        {
+        case ReorderRCM:
+            r.permutation = ReverseCuthillMcKee(A);
+            break;
+        case ReorderDegree:
+            r.permutation = DegreeOrder(A);
+            break;
+        case ReorderCluster:
+            r.permutation = ClusterOrder(A);
+            break;
+        }
+        r.matrix = PermuteSymmetric(A, r.permutation);
+
+        return r;
+    }
+
+    void PermuteVector(const Permutation &p, const float *x, float *out)
+    {
+        gemm::utils::parallelFor(0, p.Size(), 1 << 14, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                out[i] = x[p.perm[i]];
+            }
+        });
+    }
+
+    void UnpermuteVector(const Permutation &p, const float *y, float *out)
+    {
+        gemm::utils::parallelFor(0, p.Size(), 1 << 14, [&](const long long begin, const long long end) {
+            for (long long i = begin; i < end; i++)
+            {
+                out[p.perm[i]] = y[i];
+            }
+        });
+    }
+
+} // namespace sparse
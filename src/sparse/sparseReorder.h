@@ -0,0 +1,66 @@
+#ifndef __SPARSE_REORDER_H__
+#define __SPARSE_REORDER_H__
+
+#include "sparseCSR.h"
+
+#include <vector>
+
+namespace sparse
+{
+    // Permutation of the rows and columns of a square matrix.
+    // perm[new] = old and inverse[old] = new, the reordered matrix is B = P * A * P^T, B[i][j] = A[perm[i]][perm[j]].
+    struct Permutation
+    {
+        std::vector<int> perm;
+        std::vector<int> inverse;
+
+        int Size() const { return perm.size(); }
+
+        // FromOrder builds the permutation whose new index i is order[i]
+        static Permutation FromOrder(std::vector<int> order);
+    };
+
+    enum ReorderMethod
+    {
+        ReorderRCM,     // reverse Cuthill-McKee, small bandwidth, meshes and banded problems
+        ReorderDegree,  // degree descending, hubs first, power-law graphs
+        ReorderCluster, // label propagation communities kept together, graphs with community structure
+    };
+
+    // ReorderedCSR is a symmetrically permuted matrix with the permutation needed to map the results back.
+    struct ReorderedCSR
+    {
+        SparseCSR matrix;
+        Permutation permutation;
+    };
+
+    // ReverseCuthillMcKee orders the vertices of the graph of A + A^T by breadth-first search from a
+    // pseudo-peripheral vertex of every connected component, neighbours by ascending degree, then reverses the order.
+    // O(nnz * log(max degree))
+    Permutation ReverseCuthillMcKee(const SparseCSR &A);
+
+    // DegreeOrder sorts the vertices by descending degree in A + A^T, ties keep their original order.
+    // O(nnz + rows * log(rows))
+    Permutation DegreeOrder(const SparseCSR &A);
+
+    // ClusterOrder finds communities of the graph of A + A^T by label propagation and numbers
+    // the vertices of a community consecutively, communities and vertices keep their original order.
+    // O(iterations * nnz * log(max degree))
+    Permutation ClusterOrder(const SparseCSR &A, const int iterations = 10);
+
+    // PermuteSymmetric returns B = P * A * P^T in parallel, A is square.
+    // O(nnz * log(max row length))
+    SparseCSR PermuteSymmetric(const SparseCSR &A, const Permutation &p);
+
+    // Reorder computes the permutation of method and applies it, throws std::invalid_argument when A is not square.
+    ReorderedCSR Reorder(const SparseCSR &A, const ReorderMethod method);
+
+    // PermuteVector maps a vector into the new order, out[new] = x[perm[new]] (e.g. x of y = A * x)
+    void PermuteVector(const Permutation &p, const float *x, float *out);
+
+    // UnpermuteVector maps a result back to the original order, out[perm[new]] = y[new]
+    void UnpermuteVector(const Permutation &p, const float *y, float *out);
+
+} // namespace sparse
+
+#endif // __SPARSE_REORDER_H__
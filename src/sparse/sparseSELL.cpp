@@ -0,0 +1,286 @@
+#include "sparseSELL.h"
+
+#include "sparseUtils.h" // balancedPartition
+
+#include "gemm_thread.h" // parallelFor, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::stable_sort, std::max, std::fill_n
+#include <utility>   // std::move
+#include <vector>    // std::vector
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace sparse
+{
+    // __sigmaOrder returns the rows of A sorted by descending length inside every window of sigma rows
+    std::vector<int> __sigmaOrder(const SparseCSR &A, const int sigma)
+    {
+        const int *rowStart = A.RowStart();
+
+        std::vector<int> order(A.Rows());
+        for (int i = 0; i < A.Rows(); i++)
+        {
+            order[i] = i;
+        }
+
+        for (int w = 0; w < A.Rows(); w += sigma)
+        {
+            int end = std::min(A.Rows(), w + sigma);
+            std::stable_sort(order.begin() + w, order.begin() + end, [&](const int r1, const int r2) -> bool {
+                return rowStart[r1 + 1] - rowStart[r1] > rowStart[r2 + 1] - rowStart[r2];
+            });
+        }
+
+        return order;
+    }
+
+    // __chunkDot computes acc[r] = sum_j val[j * C + r] * x[col[j * C + r]] for the C rows of a chunk
+    inline void __chunkDot(const int *col, const float *val, const int width, const int C, const float *x, float *acc)
+    {
+#if defined(__AVX512F__)
+        if (C == 16)
+        {
+            __m512 sum = _mm512_setzero_ps();
+            for (int j = 0; j < width; j++)
+            {
+                __m512i idx = _mm512_load_si512((const void *)(col + j * 16));
+                sum = _mm512_fmadd_ps(_mm512_load_ps(val + j * 16), _mm512_i32gather_ps(idx, x, 4), sum);
+            }
+            _mm512_storeu_ps(acc, sum);
+            return;
+        }
+#endif
+#if defined(__AVX2__)
+        if (C == 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int j = 0; j < width; j++)
+            {
+                __m256i idx = _mm256_load_si256((const __m256i *)(col + j * 8));
+                sum = _mm256_fmadd_ps(_mm256_load_ps(val + j * 8), _mm256_i32gather_ps(x, idx, 4), sum);
+            }
+            _mm256_storeu_ps(acc, sum);
+            return;
+        }
+#endif
+
+        std::fill_n(acc, C, 0.0f);
+        for (int j = 0; j < width; j++)
+        {
+            for (int r = 0; r < C; r++) // one lane per row
+            {
+                acc[r] += val[j * C + r] * x[col[j * C + r]];
+            }
+        }
+    }
+
+    int SparseSELL::DefaultC()
+    {
+#if defined(__AVX512F__)
+        return 16;
+#else
+        return 8;
+#endif
+    }
+
+    long long SparseSELL::PaddedSizeOf(const SparseCSR &A, const int C, const int sigma)
+    {
+        const int *rowStart = A.RowStart();
+        std::vector<int> order = __sigmaOrder(A, std::max(C, sigma / C * C));
+
+        long long padded = 0;
+        for (int c = 0; c * C < A.Rows(); c++)
+        {
+            int width = 0;
+            for (int r = c * C; r < std::min(A.Rows(), (c + 1) * C); r++)
+            {
+                width = std::max(width, rowStart[order[r] + 1] - rowStart[order[r]]);
+            }
+            padded += (long long)width * C;
+        }
+        return padded;
+    }
+
+    SparseSELL::SparseSELL()
+    {
+        this->rows = 0;
+        this->cols = 0;
+        this->nnz = 0;
+        this->C = DefaultC();
+        this->sigma = DefaultSigma;
+        this->chunks = 0;
+
+        this->chunkStart = nullptr;
+        this->chunkWidth = nullptr;
+        this->perm = nullptr;
+        this->colIdx = nullptr;
+        this->values = nullptr;
+    }
+
+    // O(nnz + rows * log(sigma))
+    SparseSELL::SparseSELL(const SparseCSR &A, const int C, const int sigma)
+    {
+        this->rows = A.Rows();
+        this->cols = A.Cols();
+        this->nnz = A.Nnz();
+        this->C = std::max(1, C);
+        this->sigma = std::max(this->C, sigma / this->C * this->C); // windows hold whole chunks
+        this->chunks = (rows + this->C - 1) / this->C;
+
+        const int *rowStart = A.RowStart();
+        std::vector<int> order = __sigmaOrder(A, this->sigma);
+
+        this->chunkStart = gemm::utils::allocArray<int>(chunks + 1);
+        this->chunkWidth = gemm::utils::allocArray<int>(chunks);
+        this->perm = gemm::utils::allocArray<int>(chunks * this->C);
+
+        this->chunkStart[0] = 0;
+        for (int c = 0; c < chunks; c++)
+        {
+            int width = 0;
+            for (int r = 0; r < this->C; r++)
+            {
+                int sorted = c * this->C + r;
+                this->perm[sorted] = (sorted < rows) ? order[sorted] : -1;
+                if (sorted < rows)
+                {
+                    width = std::max(width, rowStart[order[sorted] + 1] - rowStart[order[sorted]]);
+                }
+            }
+            this->chunkWidth[c] = width;
+            this->chunkStart[c + 1] = this->chunkStart[c] + width * this->C;
+        }
+
+        this->colIdx = gemm::utils::allocArray<int>(this->chunkStart[chunks]);
+        this->values = gemm::utils::allocArray<float>(this->chunkStart[chunks]);
+
+        const int *aColIdx = A.ColIdx();
+        const float *aValues = A.Values();
+
+        gemm::utils::parallelFor(0, chunks, 64, [&](const long long begin, const long long end) {
+            for (long long c = begin; c < end; c++)
+            {
+                int *col = this->colIdx + this->chunkStart[c];
+                float *val = this->values + this->chunkStart[c];
+
+                for (int r = 0; r < this->C; r++)
+                {
+                    int row = this->perm[c * this->C + r];
+                    int len = (row >= 0) ? rowStart[row + 1] - rowStart[row] : 0;
+
+                    for (int j = 0; j < len; j++)
+                    {
+                        col[j * this->C + r] = aColIdx[rowStart[row] + j];
+                        val[j * this->C + r] = aValues[rowStart[row] + j];
+                    }
+                    for (int j = len; j < this->chunkWidth[c]; j++)
+                    {
+                        col[j * this->C + r] = 0; // padding
+                        val[j * this->C + r] = 0.0;
+                    }
+                }
+            }
+        });
+    }
+
+    SparseSELL::SparseSELL(const int rows, const int cols, const int nnz, const ElementCOO *array, const int C, const int sigma)
+        : SparseSELL(SparseCSR(rows, cols, nnz, array), C, sigma)
+    {
+    }
+
+    SparseSELL::~SparseSELL()
+    {
+        gemm::utils::alignedFree(chunkStart);
+        gemm::utils::alignedFree(chunkWidth);
+        gemm::utils::alignedFree(perm);
+        gemm::utils::alignedFree(colIdx);
+        gemm::utils::alignedFree(values);
+    }
+
+    SparseSELL::SparseSELL(SparseSELL &&x) : SparseSELL()
+    {
+        *this = std::move(x);
+    }
+
+    SparseSELL &SparseSELL::operator=(SparseSELL &&x)
+    {
+        // prevent from moving myself
+        if (&x == this)
+        {
+            return *this;
+        }
+
+        std::swap(this->rows, x.rows);
+        std::swap(this->cols, x.cols);
+        std::swap(this->nnz, x.nnz);
+        std::swap(this->C, x.C);
+        std::swap(this->sigma, x.sigma);
+        std::swap(this->chunks, x.chunks);
+
+        std::swap(this->chunkStart, x.chunkStart); // move, x frees the old buffers
+        std::swap(this->chunkWidth, x.chunkWidth);
+        std::swap(this->perm, x.perm);
+        std::swap(this->colIdx, x.colIdx);
+        std::swap(this->values, x.values);
+
+        return *this;
+    }
+
+    // O(padded size), zero entries (the padding) are dropped
+    SparseCSR SparseSELL::ToCSR() const
+    {
+        std::vector<ElementCOO> array;
+        array.reserve(nnz);
+
+        for (int c = 0; c < chunks; c++)
+        {
+            for (int r = 0; r < C; r++)
+            {
+                int row = perm[c * C + r];
+                if (row < 0)
+                {
+                    continue;
+                }
+
+                for (int j = 0; j < chunkWidth[c]; j++)
+                {
+                    int k = chunkStart[c] + j * C + r;
+                    if (values[k] != 0.0)
+                    {
+                        array.push_back(ElementCOO{row, colIdx[k], values[k]});
+                    }
+                }
+            }
+        }
+
+        return SparseCSR(rows, cols, array.size(), array.data());
+    }
+
+    void SparseSELL::SpMV(const float *x, float *y, const float alpha, const float beta) const
+    {
+        // chunks are balanced by stored entries
+        std::vector<int> bounds = utils::balancedPartition(chunkStart, chunks, gemm::utils::numThreads() * 4);
+
+        gemm::utils::parallelFor(0, bounds.size() - 1, 1, [&](const long long begin, const long long end) {
+            std::vector<float> acc(C);
+
+            for (int c = bounds[begin]; c < bounds[end]; c++)
+            {
+                __chunkDot(colIdx + chunkStart[c], values + chunkStart[c], chunkWidth[c], C, x, acc.data());
+
+                for (int r = 0; r < C; r++)
+                {
+                    int row = perm[c * C + r];
+                    if (row >= 0)
+                    {
+                        y[row] = (beta == 0.0f) ? alpha * acc[r] : alpha * acc[r] + beta * y[row];
+                    }
+                }
+            }
+        });
+    }
+
+} // namespace sparse
@@ -0,0 +1,64 @@
+#ifndef __SPARSE_SELL_H__
+#define __SPARSE_SELL_H__
+
+#include "sparseCSR.h"
+
+namespace sparse
+{
+    // SparseSELL is the SELL-C-sigma (sliced ELLPACK) format.
+    // Rows are sorted by length inside windows of sigma rows, then grouped into chunks of C rows.
+    // A chunk of width w is stored column-major: entry j of row r lives at chunkStart[chunk] + j * C + r,
+    // so C consecutive rows are processed by one SIMD lane each. Short rows are padded with (col 0, val 0).
+    class SparseSELL
+    {
+    private:
+        int rows;
+        int cols;
+        int nnz;
+        int C;
+        int sigma;
+        int chunks;
+
+        int *chunkStart; // chunks + 1 entries, offsets into colIdx and values
+        int *chunkWidth;
+        int *perm; // perm[sorted row] = original row, -1 for the padding rows of the last chunk
+        int *colIdx;
+        float *values;
+
+    public:
+        // DefaultC returns the default chunk height, one SIMD register of floats of the instruction set
+        // the sparse library is compiled for (16 with AVX-512, 8 otherwise)
+        static int DefaultC();
+        static const int DefaultSigma = 256;
+
+        SparseSELL();
+        SparseSELL(const SparseCSR &A, const int C = DefaultC(), const int sigma = DefaultSigma);
+        SparseSELL(const int rows, const int cols, const int nnz, const ElementCOO *array, const int C = DefaultC(), const int sigma = DefaultSigma);
+
+        ~SparseSELL();
+
+        SparseSELL(const SparseSELL &x) = delete;
+        SparseSELL &operator=(const SparseSELL &x) = delete;
+
+        SparseSELL(SparseSELL &&x);
+        SparseSELL &operator=(SparseSELL &&x);
+
+        int Rows() const { return rows; }
+        int Cols() const { return cols; }
+        int Nnz() const { return nnz; }
+
+        // PaddedSize returns the number of stored entries including padding
+        int PaddedSize() const { return (chunkStart != nullptr) ? chunkStart[chunks] : 0; }
+
+        SparseCSR ToCSR() const;
+
+        // SpMV computes y = alpha*A*x + beta*y, y is not read when beta == 0
+        void SpMV(const float *x, float *y, const float alpha = 1.0, const float beta = 0.0) const;
+
+        // PaddedSizeOf returns the SELL-C-sigma storage size of A without building it
+        static long long PaddedSizeOf(const SparseCSR &A, const int C = DefaultC(), const int sigma = DefaultSigma);
+    };
+
+} // namespace sparse
+
+#endif // __SPARSE_SELL_H__
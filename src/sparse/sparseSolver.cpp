@@ -0,0 +1,619 @@
+#include "sparseSolver.h"
+
+#include "sparseUtils.h" // balancedPartition, rowDot
+
+#include "gemm_thread.h" // parallelFor, numThreads
+#include "gemm_utils.h"  // allocArray, alignedFree
+
+#include <algorithm> // std::fill_n, std::lower_bound, std::max
+#include <array>     // std::array
+#include <cmath>     // std::sqrt
+#include <stdexcept> // std::invalid_argument
+
+namespace sparse
+{
+    // most reductions computed by one sweep
+    const int MaxReductions = 2;
+
+    // triangular solve levels with fewer rows run serially, larger ones in chunks of LevelGrain rows
+    const int LevelParallelRows = 2048;
+    const int LevelGrain = 512;
+
+    // offset between the work vectors in floats, one cache line
+    const int WorkSkew = 16;
+
+    // __sweep calls body(begin, end, sums) on every range of bounds in parallel, sums has D zeroed entries per range.
+    // Returns the sums of all ranges, added in range order.
+    template <int D, typename Body>
+    std::array<double, D> __sweep(const std::vector<int> &bounds, std::vector<double> &partials, Body body)
+    {
+        const int ranges = bounds.size() - 1;
+
+        gemm::utils::parallelFor(0, ranges, 1, [&](const long long begin, const long long end) {
+            for (long long k = begin; k < end; k++)
+            {
+                double *sums = partials.data() + k * MaxReductions;
+                std::fill_n(sums, D, 0.0);
+                body(bounds[k], bounds[k + 1], sums);
+            }
+        });
+
+        std::array<double, D> total{};
+        for (int k = 0; k < ranges; k++)
+        {
+            for (int d = 0; d < D; d++)
+            {
+                total[d] += partials[k * MaxReductions + d];
+            }
+        }
+        return total;
+    }
+
+    // __forLevels calls row(i) for the rows of every level, level after level, and returns the sum of the results.
+    // Large levels run in parallel chunks whose sums are added in chunk order.
+    template <typename Row>
+    double __forLevels(const std::vector<int> &levelStart, const std::vector<int> &levelRows, std::vector<double> &partials, Row row)
+    {
+        double total = 0.0;
+        for (size_t l = 0; l + 1 < levelStart.size(); l++)
+        {
+            const int begin = levelStart[l];
+            const int end = levelStart[l + 1];
+
+            if (end - begin < LevelParallelRows)
+            {
+                for (int k = begin; k < end; k++)
+                {
+                    total += row(levelRows[k]);
+                }
+                continue;
+            }
+
+            gemm::utils::parallelFor(begin, end, LevelGrain, [&](const long long chunkBegin, const long long chunkEnd) {
+                double sum = 0.0;
+                for (long long k = chunkBegin; k < chunkEnd; k++)
+                {
+                    sum += row(levelRows[k]);
+                }
+                partials[(chunkBegin - begin) / LevelGrain] = sum;
+            });
+            for (int c = 0; c < (end - begin + LevelGrain - 1) / LevelGrain; c++)
+            {
+                total += partials[c];
+            }
+        }
+        return total;
+    }
+
+    SparseSolver::SparseSolver(const SparseCSR &A, const SolverOptions &options) : A(&A), options(options)
+    {
+        if (A.Rows() != A.Cols())
+        {
+            throw std::invalid_argument("sparse: SparseSolver needs a square matrix");
+        }
+
+        const int n = A.Rows();
+        const int *rowStart = A.RowStart();
+        const int *colIdx = A.ColIdx();
+        const int parts = gemm::utils::numThreads() * 4;
+
+        this->matrixBounds = utils::balancedPartition(rowStart, n, parts);
+        for (int k = 0; k <= parts; k++)
+        {
+            this->vectorBounds.push_back((long long)k * n / parts);
+        }
+        this->partials.resize(std::max<long long>((long long)MaxReductions * parts, n / LevelGrain + 1));
+
+        if (options.preconditioner != PreconditionerNone)
+        {
+            this->diagPos.resize(n);
+            for (int i = 0; i < n; i++)
+            {
+                const int *it = std::lower_bound(colIdx + rowStart[i], colIdx + rowStart[i + 1], i);
+                if (it == colIdx + rowStart[i + 1] || *it != i)
+                {
+                    throw std::invalid_argument("sparse: SparseSolver preconditioner needs every diagonal entry");
+                }
+                this->diagPos[i] = it - colIdx;
+            }
+        }
+
+        switch (options.preconditioner)
+        {
+        case PreconditionerNone:
+            this->invDiag.assign(n, 1.0f);
+            break;
+        case PreconditionerJacobi:
+            this->invDiag.resize(n);
+            for (int i = 0; i < n; i++)
+            {
+                const float d = A.Values()[this->diagPos[i]];
+                if (d == 0.0f)
+                {
+                    throw std::invalid_argument("sparse: SparseSolver Jacobi preconditioner on a zero diagonal entry");
+                }
+                this->invDiag[i] = 1.0f / d;
+            }
+            break;
+        case PreconditionerILU0:
+            __factorILU0();
+            __buildLevels();
+            break;
+        }
+
+        // one block for all work vectors, every vector starts WorkSkew floats further into a page than the previous one:
+        // separate pool buffers are aligned to large powers of two, then p[i] and q[i] of SpMV collide in the cache
+        float **work[] = {&this->r, &this->rhat, &this->p, &this->q, &this->s, &this->t, &this->y, &this->z};
+        const long long stride = ((long long)n + WorkSkew - 1) / WorkSkew * WorkSkew + WorkSkew;
+        this->workspace = gemm::utils::allocArray<float>(stride * 8);
+        for (int k = 0; k < 8; k++)
+        {
+            *work[k] = this->workspace + k * stride;
+        }
+    }
+
+    SparseSolver::~SparseSolver()
+    {
+        gemm::utils::alignedFree(this->workspace);
+    }
+
+    void SparseSolver::SetOptions(const int maxIterations, const double tolerance)
+    {
+        this->options.maxIterations = maxIterations;
+        this->options.tolerance = tolerance;
+    }
+
+    void SparseSolver::__factorILU0()
+    {
+        // IKJ Gaussian elimination restricted to the pattern of A:
+        // row i is eliminated with the finished rows k < i of its lower part
+        const int n = this->A->Rows();
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+        this->luValues.assign(this->A->Values(), this->A->Values() + this->A->Nnz());
+        float *lu = this->luValues.data();
+
+        std::vector<int> pos(n, -1); // position of every column of row i
+        for (int i = 0; i < n; i++)
+        {
+            for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            {
+                pos[colIdx[k]] = k;
+            }
+
+            for (int k = rowStart[i]; k < this->diagPos[i]; k++)
+            {
+                const int j = colIdx[k];
+                lu[k] /= lu[this->diagPos[j]];
+                for (int m = this->diagPos[j] + 1; m < rowStart[j + 1]; m++)
+                {
+                    if (pos[colIdx[m]] >= 0)
+                    {
+                        lu[pos[colIdx[m]]] -= lu[k] * lu[m];
+                    }
+                }
+            }
+
+            if (lu[this->diagPos[i]] == 0.0f)
+            {
+                throw std::invalid_argument("sparse: SparseSolver ILU(0) zero pivot");
+            }
+
+            for (int k = rowStart[i]; k < rowStart[i + 1]; k++)
+            {
+                pos[colIdx[k]] = -1;
+            }
+        }
+    }
+
+    void SparseSolver::__buildLevels()
+    {
+        // the level of a row is one more than the deepest row it depends on,
+        // rows are bucketed by level in increasing row order
+        const int n = this->A->Rows();
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+
+        auto bucket = [n](const std::vector<int> &level, const int levels, std::vector<int> &levelStart, std::vector<int> &levelRows) {
+            levelStart.assign(levels + 1, 0);
+            for (int i = 0; i < n; i++)
+            {
+                levelStart[level[i] + 1]++;
+            }
+            for (int l = 0; l < levels; l++)
+            {
+                levelStart[l + 1] += levelStart[l];
+            }
+            levelRows.resize(n);
+            std::vector<int> next(levelStart.begin(), levelStart.end() - 1);
+            for (int i = 0; i < n; i++)
+            {
+                levelRows[next[level[i]]++] = i;
+            }
+        };
+
+        std::vector<int> level(n);
+        int levels = 0;
+        for (int i = 0; i < n; i++)
+        {
+            int l = 0;
+            for (int k = rowStart[i]; k < this->diagPos[i]; k++)
+            {
+                l = std::max(l, level[colIdx[k]] + 1);
+            }
+            level[i] = l;
+            levels = std::max(levels, l + 1);
+        }
+        bucket(level, levels, this->lowerLevelStart, this->lowerLevelRows);
+
+        levels = 0;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            int l = 0;
+            for (int k = this->diagPos[i] + 1; k < rowStart[i + 1]; k++)
+            {
+                l = std::max(l, level[colIdx[k]] + 1);
+            }
+            level[i] = l;
+            levels = std::max(levels, l + 1);
+        }
+        bucket(level, levels, this->upperLevelStart, this->upperLevelRows);
+    }
+
+    double SparseSolver::__applyILU(const float *in, float *out)
+    {
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+        const float *lu = this->luValues.data();
+        const int *diag = this->diagPos.data();
+
+        // L*w = in, L has a unit diagonal, w is written to out
+        __forLevels(this->lowerLevelStart, this->lowerLevelRows, this->partials, [&](const int i) {
+            out[i] = in[i] - utils::rowDot(colIdx, lu, out, rowStart[i], diag[i]);
+            return 0.0;
+        });
+
+        // U*out = w in place, the dot product with in is taken as the rows are finished
+        return __forLevels(this->upperLevelStart, this->upperLevelRows, this->partials, [&](const int i) {
+            out[i] = (out[i] - utils::rowDot(colIdx, lu, out, diag[i] + 1, rowStart[i + 1])) / lu[diag[i]];
+            return (double)in[i] * out[i];
+        });
+    }
+
+    std::array<double, 2> SparseSolver::__residual(const float *b, const float *x, float *copy)
+    {
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+        const float *values = this->A->Values();
+        float *r = this->r;
+
+        return __sweep<2>(this->matrixBounds, this->partials, [&](const int begin, const int end, double *sums) {
+            double bb = 0.0, rr = 0.0;
+            for (int i = begin; i < end; i++)
+            {
+                const float ri = b[i] - utils::rowDot(colIdx, values, x, rowStart[i], rowStart[i + 1]);
+                r[i] = ri;
+                if (copy != nullptr)
+                {
+                    copy[i] = ri;
+                }
+                bb += (double)b[i] * b[i];
+                rr += (double)ri * ri;
+            }
+            sums[0] = bb;
+            sums[1] = rr;
+        });
+    }
+
+    double SparseSolver::__precondition(float *out)
+    {
+        if (this->invDiag.empty())
+        {
+            return __applyILU(this->r, out);
+        }
+
+        const float *invD = this->invDiag.data();
+        const float *r = this->r;
+        return __sweep<1>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *sums) {
+            double sum = 0.0;
+            for (int i = begin; i < end; i++)
+            {
+                out[i] = invD[i] * r[i];
+                sum += (double)r[i] * out[i];
+            }
+            sums[0] = sum;
+        })[0];
+    }
+
+    SolverResult SparseSolver::CG(const float *b, float *x)
+    {
+        const int n = this->A->Rows();
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+        const float *values = this->A->Values();
+        const float *invD = this->invDiag.data();
+        float *r = this->r, *p = this->p, *q = this->q, *z = this->z;
+        const bool ilu = this->invDiag.empty();
+
+        // r = b - A*x with ||b||^2 and ||r||^2
+        std::array<double, 2> norms = __residual(b, x, nullptr);
+        const double bb = norms[0];
+        double rr = norms[1];
+        if (bb == 0.0)
+        {
+            std::fill_n(x, n, 0.0f);
+            return SolverResult{0, 0.0, true};
+        }
+        const double target = this->options.tolerance * this->options.tolerance * bb;
+
+        // p = M^-1 r, rz = r . M^-1 r
+        double rz = __precondition(p);
+
+        SolverResult result{0, 0.0, false};
+        while (true)
+        {
+            if (rr <= target && result.iterations > 0)
+            {
+                // the recurrence residual drifts from b - A*x in single precision: check it, restart when it is off
+                rr = __residual(b, x, nullptr)[1];
+                if (rr > target)
+                {
+                    rz = __precondition(p);
+                }
+            }
+            if (rr <= target)
+            {
+                result.converged = true;
+                break;
+            }
+            if (result.iterations >= this->options.maxIterations)
+            {
+                break;
+            }
+
+            // q = A*p fused with p . q
+            const double pq = __sweep<1>(this->matrixBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                double sum = 0.0;
+                for (int i = begin; i < end; i++)
+                {
+                    const float qi = utils::rowDot(colIdx, values, p, rowStart[i], rowStart[i + 1]);
+                    q[i] = qi;
+                    sum += (double)p[i] * qi;
+                }
+                sums[0] = sum;
+            })[0];
+            if (pq <= 0.0)
+            {
+                break; // A is not positive definite
+            }
+            const float alpha = rz / pq;
+
+            // r -= alpha*q fused with ||r||^2 and r . M^-1 r
+            double rzNext;
+            if (ilu)
+            {
+                rr = __sweep<1>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                    double sum = 0.0;
+                    for (int i = begin; i < end; i++)
+                    {
+                        r[i] -= alpha * q[i];
+                        sum += (double)r[i] * r[i];
+                    }
+                    sums[0] = sum;
+                })[0];
+                rzNext = __applyILU(r, z);
+            }
+            else
+            {
+                std::array<double, 2> sums = __sweep<2>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                    double rrSum = 0.0, rzSum = 0.0;
+                    for (int i = begin; i < end; i++)
+                    {
+                        const float ri = r[i] - alpha * q[i];
+                        r[i] = ri;
+                        rrSum += (double)ri * ri;
+                        rzSum += (double)ri * (invD[i] * ri);
+                    }
+                    sums[0] = rrSum;
+                    sums[1] = rzSum;
+                });
+                rr = sums[0];
+                rzNext = sums[1];
+            }
+            const float beta = rzNext / rz;
+            rz = rzNext;
+
+            // x += alpha*p, p = M^-1 r + beta*p, the Jacobi preconditioner is applied on the fly
+            if (ilu)
+            {
+                __sweep<0>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *) {
+                    for (int i = begin; i < end; i++)
+                    {
+                        x[i] += alpha * p[i];
+                        p[i] = z[i] + beta * p[i];
+                    }
+                });
+            }
+            else
+            {
+                __sweep<0>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *) {
+                    for (int i = begin; i < end; i++)
+                    {
+                        x[i] += alpha * p[i];
+                        p[i] = invD[i] * r[i] + beta * p[i];
+                    }
+                });
+            }
+            result.iterations++;
+        }
+
+        result.residual = std::sqrt(rr / bb);
+        return result;
+    }
+
+    SolverResult SparseSolver::BiCGSTAB(const float *b, float *x)
+    {
+        const int n = this->A->Rows();
+        const int *rowStart = this->A->RowStart();
+        const int *colIdx = this->A->ColIdx();
+        const float *values = this->A->Values();
+        const float *invD = this->invDiag.data();
+        float *r = this->r, *rhat = this->rhat, *p = this->p, *v = this->q;
+        float *s = this->s, *t = this->t, *y = this->y, *z = this->z;
+        const bool ilu = this->invDiag.empty();
+
+        // r = rhat = b - A*x with ||b||^2 and ||r||^2
+        std::array<double, 2> norms = __residual(b, x, rhat);
+        const double bb = norms[0];
+        double rr = norms[1];
+        if (bb == 0.0)
+        {
+            std::fill_n(x, n, 0.0f);
+            return SolverResult{0, 0.0, true};
+        }
+        const double target = this->options.tolerance * this->options.tolerance * bb;
+
+        double rho = rr, rhoPrev = 1.0, alpha = 1.0, omega = 1.0;
+        bool first = true; // p and v are not read in the first iteration after a (re)start
+        SolverResult result{0, 0.0, false};
+        while (true)
+        {
+            if (rr <= target && result.iterations > 0)
+            {
+                // the recurrence residual drifts from b - A*x in single precision: check it, restart when it is off
+                rr = __residual(b, x, rhat)[1];
+                rho = rr;
+                first = true;
+            }
+            if (rr <= target)
+            {
+                result.converged = true;
+                break;
+            }
+            if (result.iterations >= this->options.maxIterations || rho == 0.0)
+            {
+                break; // rho == 0: breakdown, r is orthogonal to rhat
+            }
+
+            // p = r + beta*(p - omega*v), y = M^-1 p
+            const float beta = first ? 0.0f : (rho / rhoPrev) * (alpha / omega);
+            const float omegaF = first ? 0.0f : omega;
+            __sweep<0>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *) {
+                for (int i = begin; i < end; i++)
+                {
+                    const float pi = first ? r[i] : r[i] + beta * (p[i] - omegaF * v[i]);
+                    p[i] = pi;
+                    if (ilu == false)
+                    {
+                        y[i] = invD[i] * pi;
+                    }
+                }
+            });
+            if (ilu)
+            {
+                __applyILU(p, y);
+            }
+            first = false;
+
+            // v = A*y fused with rhat . v
+            const double rv = __sweep<1>(this->matrixBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                double sum = 0.0;
+                for (int i = begin; i < end; i++)
+                {
+                    const float vi = utils::rowDot(colIdx, values, y, rowStart[i], rowStart[i + 1]);
+                    v[i] = vi;
+                    sum += (double)rhat[i] * vi;
+                }
+                sums[0] = sum;
+            })[0];
+            if (rv == 0.0)
+            {
+                break;
+            }
+            alpha = rho / rv;
+            const float alphaF = alpha;
+
+            // s = r - alpha*v fused with ||s||^2, z = M^-1 s
+            const double ss = __sweep<1>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                double sum = 0.0;
+                for (int i = begin; i < end; i++)
+                {
+                    const float si = r[i] - alphaF * v[i];
+                    s[i] = si;
+                    if (ilu == false)
+                    {
+                        z[i] = invD[i] * si;
+                    }
+                    sum += (double)si * si;
+                }
+                sums[0] = sum;
+            })[0];
+
+            if (ss <= target)
+            {
+                // converged on the half step: x += alpha*y
+                __sweep<0>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *) {
+                    for (int i = begin; i < end; i++)
+                    {
+                        x[i] += alphaF * y[i];
+                    }
+                });
+                rr = ss;
+                result.iterations++;
+                continue;
+            }
+            if (ilu)
+            {
+                __applyILU(s, z);
+            }
+
+            // t = A*z fused with t . s and t . t
+            std::array<double, 2> ts = __sweep<2>(this->matrixBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                double tsSum = 0.0, ttSum = 0.0;
+                for (int i = begin; i < end; i++)
+                {
+                    const float ti = utils::rowDot(colIdx, values, z, rowStart[i], rowStart[i + 1]);
+                    t[i] = ti;
+                    tsSum += (double)ti * s[i];
+                    ttSum += (double)ti * ti;
+                }
+                sums[0] = tsSum;
+                sums[1] = ttSum;
+            });
+            if (ts[1] == 0.0)
+            {
+                break;
+            }
+            omega = ts[0] / ts[1];
+            const float omegaNext = omega;
+
+            // x += alpha*y + omega*z, r = s - omega*t fused with rhat . r and ||r||^2
+            std::array<double, 2> next = __sweep<2>(this->vectorBounds, this->partials, [&](const int begin, const int end, double *sums) {
+                double rhoSum = 0.0, rrSum = 0.0;
+                for (int i = begin; i < end; i++)
+                {
+                    x[i] += alphaF * y[i] + omegaNext * z[i];
+                    const float ri = s[i] - omegaNext * t[i];
+                    r[i] = ri;
+                    rhoSum += (double)rhat[i] * ri;
+                    rrSum += (double)ri * ri;
+                }
+                sums[0] = rhoSum;
+                sums[1] = rrSum;
+            });
+            rhoPrev = rho;
+            rho = next[0];
+            rr = next[1];
+            result.iterations++;
+
+            if (omega == 0.0)
+            {
+                break;
+            }
+        }
+
+        result.residual = std::sqrt(rr / bb);
+        return result;
+    }
+
+} // namespace sparse
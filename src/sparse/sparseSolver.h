@@ -0,0 +1,106 @@
+#ifndef __SPARSE_SOLVER_H__
+#define __SPARSE_SOLVER_H__
+
+#include "sparseCSR.h"
+
+#include <array>  // std::array
+#include <vector> // std::vector
+
+namespace sparse
+{
+    enum SolverPreconditioner
+    {
+        PreconditionerNone,
+        PreconditionerJacobi, // M = diag(A)
+        PreconditionerILU0,   // M = L*U, incomplete LU on the pattern of A
+    };
+
+    struct SolverOptions
+    {
+        int maxIterations = 1000;
+        double tolerance = 1e-6; // stop when ||b - A*x|| <= tolerance * ||b||
+        SolverPreconditioner preconditioner = PreconditionerJacobi;
+    };
+
+    struct SolverResult
+    {
+        int iterations;
+        double residual; // ||b - A*x|| / ||b||, the recurrence residual unless converged (then checked against b - A*x)
+        bool converged;
+    };
+
+    // SparseSolver solves A*x = b with preconditioned Krylov methods on a square SparseCSR.
+    // The constructor sets the preconditioner up and allocates every work vector once, solves reuse them.
+    // An iteration is a few fused parallel sweeps: SpMV produces its dot products in the same pass
+    // and the vector updates apply the Jacobi preconditioner and compute the next reductions on the fly,
+    // so CG reads the matrix once and the vectors about three times per iteration.
+    // Dot products are accumulated in double per range of rows and summed in range order,
+    // results do not depend on the thread schedule.
+    // ILU(0) triangular solves run level by level (rows of a level are independent), small levels serially.
+    // A must outlive the solver and must not change while it is used.
+    class SparseSolver
+    {
+    private:
+        const SparseCSR *A;
+        SolverOptions options;
+
+        std::vector<int> matrixBounds; // rows balanced by non-zero count, range k is [b[k], b[k + 1])
+        std::vector<int> vectorBounds; // rows split evenly
+        std::vector<double> partials;  // reductions of every range
+
+        std::vector<float> invDiag; // 1 / diag(A) (Jacobi), ones without preconditioner, empty for ILU(0)
+
+        // ILU(0): unit lower L and upper U share the pattern of A
+        std::vector<float> luValues;
+        std::vector<int> diagPos; // position of the diagonal in every row
+        std::vector<int> lowerLevelStart, lowerLevelRows;
+        std::vector<int> upperLevelStart, upperLevelRows;
+
+        // work vectors, rows entries each, in one block allocated last so that a throwing constructor leaks nothing
+        float *workspace;
+        float *r, *rhat, *p, *q, *s, *t, *y, *z;
+
+        void __factorILU0();
+        void __buildLevels();
+
+        // __applyILU solves L*U*out = in, returns in . out
+        double __applyILU(const float *in, float *out);
+
+        // __residual computes r = b - A*x (also into copy when not nullptr), returns ||b||^2 and ||r||^2
+        std::array<double, 2> __residual(const float *b, const float *x, float *copy);
+
+        // __precondition computes out = M^-1 r, returns r . out
+        double __precondition(float *out);
+
+    public:
+        // throws std::invalid_argument when A is not square,
+        // or a diagonal entry is missing or zero (Jacobi) or a pivot is zero (ILU(0))
+        explicit SparseSolver(const SparseCSR &A, const SolverOptions &options = SolverOptions());
+        ~SparseSolver();
+
+        SparseSolver(const SparseSolver &) = delete;
+        SparseSolver &operator=(const SparseSolver &) = delete;
+
+        const SolverOptions &Options() const { return options; }
+
+        // SetOptions changes the stop criteria, the preconditioner is the one chosen at construction
+        void SetOptions(const int maxIterations, const double tolerance);
+
+        // CG is the preconditioned conjugate gradient method, A and the preconditioner must be symmetric positive definite.
+        // input    : b[rows], x[rows] initial guess
+        // function : solve A*x = b
+        // output   : x[rows]
+        // O(iterations * nnz), three sweeps per iteration (Jacobi)
+        SolverResult CG(const float *b, float *x);
+
+        // BiCGSTAB is the right preconditioned stabilized biconjugate gradient method for general square A.
+        // input    : b[rows], x[rows] initial guess
+        // function : solve A*x = b
+        // output   : x[rows]
+        // O(iterations * nnz), five sweeps per iteration, two of them SpMV (Jacobi)
+        SolverResult BiCGSTAB(const float *b, float *x);
+    };
+
+} // namespace sparse
+
+#endif // __SPARSE_SOLVER_H__
@@ -0,0 +1,223 @@
+#include "sparseUtils.h"
+
+#include "sparseCSR.h" // SPARSE_FOR_EACH_CSR_TYPE
+
+#include "gemm_thread.h" // parallelRun, numThreads
+
+#include <algorithm> // std::lower_bound, std::max, std::min, std::fill_n, std::copy
+#include <utility>   // std::swap
+
+namespace sparse::utils
+{
+    int bitWidth(const long long n)
+    {
+        int bits = 0;
+        while (bits < 63 && (1LL << bits) < n)
+        {
+            bits++;
+        }
+        return bits;
+    }
+
+    bool fitsPackedKey(const long long majors, const long long minors)
+    {
+        return bitWidth(majors) + bitWidth(minors) <= 64;
+    }
+
+    // __chunks returns the number of static chunks used for n items, about 4096 items per chunk at least
+    inline int __chunks(const long long n)
+    {
+        return (int)std::max<long long>(1, std::min<long long>(gemm::utils::numThreads(), n / 4096 + 1));
+    }
+
+    // __chunk returns the static range [begin, end) of chunk t out of T
+    inline void __chunk(const long long n, const int t, const int T, long long &begin, long long &end)
+    {
+        begin = n * t / T;
+        end = n * (t + 1) / T;
+    }
+
+    template <typename ValueT>
+    void radixSortPairs(uint64_t *keys, ValueT *vals, uint64_t *tmpKeys, ValueT *tmpVals, const long long n, const int lowBit, const int highBit)
+    {
+        const int buckets = 1 << RadixBits;
+        const int T = __chunks(n);
+
+        // hist[t * buckets + b] = number of keys of chunk t with digit b, then the scatter offset
+        std::vector<long long> hist((long long)T * buckets);
+
+        uint64_t *srcKeys = keys, *dstKeys = tmpKeys;
+        ValueT *srcVals = vals, *dstVals = tmpVals;
+
+        for (int shift = lowBit; shift < highBit; shift += RadixBits)
+        {
+            const int bits = std::min(RadixBits, highBit - shift);
+            const uint64_t mask = (uint64_t(1) << bits) - 1;
+
+            gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+                for (int t = tid; t < T; t += nthreads)
+                {
+                    long long *h = hist.data() + (long long)t * buckets;
+                    std::fill_n(h, buckets, 0);
+
+                    long long begin, end;
+                    __chunk(n, t, T, begin, end);
+                    for (long long i = begin; i < end; i++)
+                    {
+                        h[(srcKeys[i] >> shift) & mask]++;
+                    }
+                }
+            });
+
+            // exclusive prefix sum, bucket major then chunk, keeps the sort stable
+            long long offset = 0;
+            bool constantDigit = false;
+            for (int b = 0; b < buckets; b++)
+            {
+                long long bucketTotal = 0;
+                for (int t = 0; t < T; t++)
+                {
+                    long long count = hist[(long long)t * buckets + b];
+                    hist[(long long)t * buckets + b] = offset;
+                    offset += count;
+                    bucketTotal += count;
+                }
+                constantDigit = constantDigit || (bucketTotal == n);
+            }
+
+            if (constantDigit)
+            {
+                continue; // every key has the same digit, the pass would be the identity
+            }
+
+            gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+                for (int t = tid; t < T; t += nthreads)
+                {
+                    long long *h = hist.data() + (long long)t * buckets;
+
+                    long long begin, end;
+                    __chunk(n, t, T, begin, end);
+                    for (long long i = begin; i < end; i++)
+                    {
+                        long long j = h[(srcKeys[i] >> shift) & mask]++;
+                        dstKeys[j] = srcKeys[i];
+                        dstVals[j] = srcVals[i];
+                    }
+                }
+            });
+
+            std::swap(srcKeys, dstKeys);
+            std::swap(srcVals, dstVals);
+        }
+
+        if (srcKeys != keys)
+        {
+            gemm::utils::parallelFor(0, n, 1 << 16, [&](const long long begin, const long long end) {
+                std::copy(srcKeys + begin, srcKeys + end, keys + begin);
+                std::copy(srcVals + begin, srcVals + end, vals + begin);
+            });
+        }
+    }
+
+    long long countDistinctKeys(const uint64_t *keys, const long long n)
+    {
+        const int T = __chunks(n);
+        std::vector<long long> counts(T, 0);
+
+        gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+            for (int t = tid; t < T; t += nthreads)
+            {
+                long long begin, end;
+                __chunk(n, t, T, begin, end);
+                for (long long i = begin; i < end; i++)
+                {
+                    counts[t] += (i == 0 || keys[i] != keys[i - 1]);
+                }
+            }
+        });
+
+        long long total = 0;
+        for (long long count : counts)
+        {
+            total += count;
+        }
+        return total;
+    }
+
+    template <typename IndexT, typename ColT, typename ValueT>
+    void compressSortedKeys(const uint64_t *keys, const ValueT *vals, const long long n, const IndexT rows, const int minorBits, IndexT *rowStart, ColT *colIdx, ValueT *values)
+    {
+        const int T = __chunks(n);
+        const uint64_t minorMask = (uint64_t(1) << minorBits) - 1; // minorBits <= 63
+
+        // distinct keys per chunk, then the output offset of every chunk
+        std::vector<long long> offsets(T + 1, 0);
+        gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+            for (int t = tid; t < T; t += nthreads)
+            {
+                long long begin, end;
+                __chunk(n, t, T, begin, end);
+                for (long long i = begin; i < end; i++)
+                {
+                    offsets[t + 1] += (i == 0 || keys[i] != keys[i - 1]);
+                }
+            }
+        });
+        for (int t = 0; t < T; t++)
+        {
+            offsets[t + 1] += offsets[t];
+        }
+
+        // every chunk writes the keys starting inside it, a run of equal keys may continue into the next chunk
+        gemm::utils::parallelRun([&](const int tid, const int nthreads) {
+            for (int t = tid; t < T; t += nthreads)
+            {
+                long long begin, end;
+                __chunk(n, t, T, begin, end);
+
+                long long p = offsets[t];
+                for (long long i = begin; i < end; i++)
+                {
+                    if (i > 0 && keys[i] == keys[i - 1])
+                    {
+                        continue;
+                    }
+
+                    IndexT row = keys[i] >> minorBits;
+                    IndexT prevRow = (i == 0) ? -1 : IndexT(keys[i - 1] >> minorBits);
+                    for (IndexT r = prevRow + 1; r <= row; r++)
+                    {
+                        rowStart[r] = p;
+                    }
+
+                    ValueT sum = vals[i];
+                    for (long long k = i + 1; k < n && keys[k] == keys[i]; k++)
+                    {
+                        sum += vals[k]; // duplicate entry
+                    }
+
+                    colIdx[p] = ColT(keys[i] & minorMask);
+                    values[p] = sum;
+                    p++;
+                }
+            }
+        });
+
+        // rows after the last key
+        IndexT lastRow = (n == 0) ? -1 : IndexT(keys[n - 1] >> minorBits);
+        for (IndexT r = lastRow + 1; r <= rows; r++)
+        {
+            rowStart[r] = offsets[T];
+        }
+    }
+
+    template void radixSortPairs<float>(uint64_t *, float *, uint64_t *, float *, const long long, const int, const int);
+    template void radixSortPairs<double>(uint64_t *, double *, uint64_t *, double *, const long long, const int, const int);
+    template void radixSortPairs<uint64_t>(uint64_t *, uint64_t *, uint64_t *, uint64_t *, const long long, const int, const int);
+
+#define SPARSE_INSTANTIATE_COMPRESS(IndexT, ColT, ValueT) \
+    template void compressSortedKeys<IndexT, ColT, ValueT>(const uint64_t *, const ValueT *, const long long, const IndexT, const int, IndexT *, ColT *, ValueT *);
+
+    SPARSE_FOR_EACH_CSR_TYPE(SPARSE_INSTANTIATE_COMPRESS)
+
+} // namespace sparse::utils
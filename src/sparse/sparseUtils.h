@@ -0,0 +1,141 @@
+#ifndef __SPARSE_UTILS_H__
+#define __SPARSE_UTILS_H__
+
+#include <algorithm> // std::lower_bound, std::max
+#include <cstdint>   // uint64_t
+#include <vector>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace sparse::utils
+{
+    // balancedPartition splits the rows [0, n) into at most `parts` contiguous ranges of about equal weight.
+    // prefix[i] is the total weight of the rows before i, prefix has n + 1 entries (e.g. SparseCSR rowStart balances rows by non-zero count).
+    // The returned boundaries b satisfy b.front() == 0, b.back() == n, range k is [b[k], b[k + 1]).
+    template <typename IndexT, typename T>
+    std::vector<IndexT> balancedPartition(const T *prefix, const IndexT n, const int parts)
+    {
+        std::vector<IndexT> bounds;
+        bounds.push_back(0);
+
+        if (n == 0)
+        {
+            bounds.push_back(0);
+            return bounds;
+        }
+
+        const T total = prefix[n];
+        const int k = std::max(1, parts);
+
+        for (int p = 1; p < k; p++)
+        {
+            // first row whose prefix reaches p/k of the total weight
+            T target = T((long double)total * p / k);
+            IndexT row = std::lower_bound(prefix, prefix + n + 1, target) - prefix;
+            row = std::max(row, bounds.back());
+            if (row > bounds.back() && row < n)
+            {
+                bounds.push_back(row);
+            }
+        }
+        bounds.push_back(n);
+
+        return bounds;
+    }
+
+    // rowPrefix returns the prefix sum of weight(i) over the rows [0, n), with n + 1 entries.
+    template <typename IndexT, typename Weight>
+    std::vector<long long> rowPrefix(const IndexT n, Weight weight)
+    {
+        std::vector<long long> prefix(n + 1);
+        prefix[0] = 0;
+        for (IndexT i = 0; i < n; i++)
+        {
+            prefix[i + 1] = prefix[i] + weight(i);
+        }
+        return prefix;
+    }
+
+    // RadixBits is the digit width of one LSD radix pass.
+    const int RadixBits = 11;
+
+    // radixSortPairs sorts keys[n] stably by the key bits [lowBit, highBit) and moves vals along.
+    // Every LSD pass builds per-thread histograms, prefix sums them and scatters in parallel;
+    // passes whose digit is the same for all keys are skipped. tmpKeys and tmpVals are scratch buffers of n entries.
+    // Instantiated for float, double and uint64_t values.
+    template <typename ValueT>
+    void radixSortPairs(uint64_t *keys, ValueT *vals, uint64_t *tmpKeys, ValueT *tmpVals, const long long n, const int lowBit, const int highBit);
+
+    // packedKey packs (major, minor) so that sorting the keys sorts by major, then minor.
+    // minor takes the low minorBits bits, the caller checks bitWidth(majors) + minorBits <= 64 with fitsPackedKey.
+    inline uint64_t packedKey(const uint64_t major, const uint64_t minor, const int minorBits)
+    {
+        return (major << minorBits) | minor;
+    }
+
+    // fitsPackedKey tells whether (major, minor) pairs of [0, majors) x [0, minors) fit into a packed key
+    bool fitsPackedKey(const long long majors, const long long minors);
+
+    // compressSortedKeys turns sorted packed keys into CSR arrays in parallel, values of equal keys are summed.
+    // rowStart needs rows + 1 entries, colIdx and values need as many entries as there are distinct keys.
+    // Instantiated for the index, column and value types of SparseCSR.
+    template <typename IndexT, typename ColT, typename ValueT>
+    void compressSortedKeys(const uint64_t *keys, const ValueT *vals, const long long n, const IndexT rows, const int minorBits, IndexT *rowStart, ColT *colIdx, ValueT *values);
+
+    // countDistinctKeys returns the number of distinct keys of a sorted array.
+    long long countDistinctKeys(const uint64_t *keys, const long long n);
+
+    // bitWidth returns the number of bits needed to store values in [0, n).
+    int bitWidth(const long long n);
+
+    // rowDot returns sum_k values[k] * x[colIdx[k]] over [begin, end)
+    inline float rowDot(const int *colIdx, const float *values, const float *x, int begin, const int end)
+    {
+        float sum = 0.0;
+
+#if defined(__AVX512F__)
+        __m512 acc = _mm512_setzero_ps();
+        for (; begin + 16 <= end; begin += 16)
+        {
+            __m512i idx = _mm512_loadu_si512((const void *)(colIdx + begin));
+            __m512 xv = _mm512_i32gather_ps(idx, x, 4);
+            acc = _mm512_fmadd_ps(_mm512_loadu_ps(values + begin), xv, acc);
+        }
+        sum = _mm512_reduce_add_ps(acc);
+#elif defined(__AVX2__)
+        __m256 acc = _mm256_setzero_ps();
+        for (; begin + 8 <= end; begin += 8)
+        {
+            __m256i idx = _mm256_loadu_si256((const __m256i *)(colIdx + begin));
+            __m256 xv = _mm256_i32gather_ps(x, idx, 4);
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(values + begin), xv, acc);
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        sum = _mm_cvtss_f32(half);
+#else
+        // four independent partial sums
+        float sum0 = 0.0, sum1 = 0.0, sum2 = 0.0, sum3 = 0.0;
+        for (; begin + 4 <= end; begin += 4)
+        {
+            sum0 += values[begin] * x[colIdx[begin]];
+            sum1 += values[begin + 1] * x[colIdx[begin + 1]];
+            sum2 += values[begin + 2] * x[colIdx[begin + 2]];
+            sum3 += values[begin + 3] * x[colIdx[begin + 3]];
+        }
+        sum = (sum0 + sum1) + (sum2 + sum3);
+#endif
+
+        for (; begin < end; begin++)
+        {
+            sum += values[begin] * x[colIdx[begin]];
+        }
+        return sum;
+    }
+
+} // namespace sparse::utils
+
+#endif // __SPARSE_UTILS_H__